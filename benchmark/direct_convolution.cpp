@@ -0,0 +1,165 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+
+// Compare the direct convolution kernel of ConvolutionLayer with
+// a straightforward loop that checks every tap against the border,
+// and with im2col + gemm, for shapes with few channels and batch
+// size 1, where DIRECT is meant to be used.
+//
+// usage: ./direct_convolution
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <vector>
+
+#include "cnn/layer.hpp"
+#include "cnn/rng.hpp"
+
+namespace {
+
+struct Shape {
+  int c;
+  int h;
+  int w;
+  int num_output;
+  int kernel_size;
+};
+
+// the direct convolution before it was blocked: every (output,
+// input) channel pair is convolved separately and every tap of
+// every output pixel is checked against the border
+template <typename Dtype>
+void reference_convolution(const cnn::Array<Dtype>& weight,
+                           const cnn::Array<Dtype>& bias,
+                           const cnn::Array<Dtype>& b, cnn::Array<Dtype>* t) {
+  int k = weight.h_;
+  for (int n = 0; n < b.n_; n++)
+    for (int o = 0; o < t->c_; o++) {
+      Dtype* dst = &(*t)(n, o, 0, 0);
+      cnn::set_to<Dtype>(b.h_ * b.w_, dst, bias[o]);
+      for (int c = 0; c < b.c_; c++) {
+        const Dtype* src = &b(n, c, 0, 0);
+        const Dtype* w = &weight(o, c, 0, 0);
+        for (int h = 0; h < b.h_; h++)
+          for (int x = 0; x < b.w_; x++) {
+            Dtype sum = 0;
+            for (int i = 0; i < k; i++)
+              for (int j = 0; j < k; j++) {
+                int y = h + i - k / 2;
+                int z = x + j - k / 2;
+                if (y < 0 || y >= b.h_ || z < 0 || z >= b.w_) continue;
+                sum += src[y * b.w_ + z] * w[i * k + j];
+              }
+            dst[h * b.w_ + x] += sum;
+          }
+      }
+    }
+}
+
+// the best of a few runs, in milliseconds
+template <typename Func>
+double measure(Func func) {
+  static constexpr int kNumRuns = 5;
+  func();  // warm up
+  double best = std::numeric_limits<double>::max();
+  for (int i = 0; i < kNumRuns; i++) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+template <typename Dtype>
+std::vector<double> run(const Shape& s) {
+  cnn::LayerProto proto;
+  proto.set_phase(cnn::TEST);
+  proto.set_type(cnn::CONVOLUTION);
+  proto.mutable_conv_proto()->set_num_output(s.num_output);
+  proto.mutable_conv_proto()->set_kernel_size(s.kernel_size);
+
+  cnn::Array<Dtype> bottom;
+  bottom.init(1, s.c, s.h, s.w);
+  cnn::uniform<Dtype>(&bottom, -1, 1);
+
+  std::vector<double> res;
+  cnn::Array<Dtype> top;
+  cnn::Array<Dtype> expected;
+  for (auto algorithm : {cnn::ConvolutionLayerProto::DIRECT,
+                         cnn::ConvolutionLayerProto::IM2COL_GEMM}) {
+    proto.mutable_conv_proto()->set_algorithm(algorithm);
+    auto layer = cnn::Layer<Dtype>::create(proto);
+    layer->reshape({&bottom}, {}, {&top}, {});
+
+    // the same parameters for all algorithms
+    cnn::set_seed(0);
+    cnn::uniform<Dtype>(layer->mutable_param()[0], -1, 1);
+    cnn::uniform<Dtype>(layer->mutable_param()[1], -1, 1);
+
+    if (res.empty()) {
+      expected.init_like(top);
+      res.push_back(measure([&]() {
+        reference_convolution(*layer->param()[0], *layer->param()[1], bottom,
+                              &expected);
+      }));
+    }
+
+    res.push_back(measure([&]() { layer->fprop({&bottom}, {&top}); }));
+
+    Dtype max_diff = 0;
+    for (int i = 0; i < top.total_; i++) {
+      max_diff = std::max<Dtype>(max_diff, std::abs(top[i] - expected[i]));
+    }
+    CHECK_LT(max_diff, 1e-3) << "wrong result";
+  }
+  return res;
+}
+
+}  // namespace
+
+int main(int /*argc*/, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+
+  std::vector<Shape> shapes = {
+      {1, 128, 128, 8, 3},   {3, 112, 112, 16, 3}, {3, 112, 112, 16, 5},
+      {8, 64, 64, 8, 5},     {16, 56, 56, 16, 3},  {16, 28, 28, 32, 7},
+      {32, 28, 28, 32, 3},   {64, 14, 14, 64, 3},
+  };
+
+  std::cout << "float, batch size 1, fprop, best of 5 runs in ms\n\n";
+  std::cout << std::setw(24) << "C x H x W -> O, K" << std::setw(12)
+            << "reference" << std::setw(12) << "DIRECT" << std::setw(12)
+            << "IM2COL_GEMM" << std::setw(10) << "speedup\n";
+  for (const auto& s : shapes) {
+    auto t = run<float>(s);
+    std::ostringstream name;
+    name << s.c << " x " << s.h << " x " << s.w << " -> " << s.num_output
+         << ", " << s.kernel_size;
+    std::cout << std::fixed << std::setprecision(3) << std::setw(24)
+              << name.str() << std::setw(12) << t[0] << std::setw(12) << t[1]
+              << std::setw(12) << t[2] << std::setw(9) << std::setprecision(1)
+              << t[0] / t[1] << "x\n";
+  }
+
+  return 0;
+}
@@ -0,0 +1,180 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+
+// Compare fprop and bprop of FullConnectedLayer and ConvolutionLayer
+// when their parameters, activations, gradients and scratch buffers
+// live in 4 KiB pages (AlignedAllocator), in transparent huge pages
+// and in hugetlbfs pages (HugePageAllocator).
+//
+// Transparent huge pages need `madvise` or `always` in
+// /sys/kernel/mm/transparent_hugepage/enabled, hugetlbfs needs
+// pages reserved with e.g. `echo 512 > /proc/sys/vm/nr_hugepages`;
+// without them HugePageAllocator falls back and the numbers agree.
+//
+// usage: ./huge_pages
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "cnn/allocator.hpp"
+#include "cnn/layer.hpp"
+#include "cnn/rng.hpp"
+
+namespace {
+
+struct Case {
+  std::string name;
+  cnn::LayerProto proto;
+  int n;
+  int c;
+  int h;
+  int w;
+};
+
+// the best of a few runs, in milliseconds
+template <typename Func>
+double measure(Func func) {
+  static constexpr int kNumRuns = 5;
+  func();  // warm up
+  double best = std::numeric_limits<double>::max();
+  for (int i = 0; i < kNumRuns; i++) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+// AnonHugePages from /proc/meminfo in MiB, or -1 if unavailable
+double anon_huge_pages() {
+  std::ifstream is("/proc/meminfo");
+  std::string key;
+  double kb;
+  std::string unit;
+  while (is >> key >> kb) {
+    std::getline(is, unit);
+    if (key == "AnonHugePages:") return kb / 1024;
+  }
+  return -1;
+}
+
+// fprop and bprop time in ms, and the MiB of transparent huge pages
+// in use while the layer and its arrays are alive
+std::vector<double> run(const Case& c, cnn::Allocator* allocator) {
+  cnn::Allocator* old = cnn::set_default_allocator(allocator);
+
+  cnn::Array<float> bottom;
+  cnn::Array<float> bottom_gradient;
+  cnn::Array<float> top;
+  cnn::Array<float> top_gradient;
+  bottom.init(c.n, c.c, c.h, c.w);
+
+  auto layer = cnn::Layer<float>::create(c.proto);
+  layer->reshape({&bottom}, {&bottom_gradient}, {&top}, {&top_gradient});
+
+  cnn::set_seed(0);
+  cnn::uniform<float>(&bottom, -1, 1);
+  cnn::uniform<float>(&top_gradient, -1, 1);
+  for (auto* p : layer->mutable_param()) {
+    cnn::uniform<float>(p, -1, 1);
+  }
+
+  std::vector<double> res;
+  res.push_back(measure([&]() { layer->fprop({&bottom}, {&top}); }));
+  res.push_back(measure([&]() {
+    layer->bprop({&bottom}, {&bottom_gradient}, {&top}, {&top_gradient});
+  }));
+  res.push_back(anon_huge_pages());
+
+  cnn::set_default_allocator(old);
+  return res;
+}
+
+}  // namespace
+
+int main(int /*argc*/, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+
+  std::vector<Case> cases;
+  {
+    Case c{"fc 4096 -> 4096, n 64", {}, 64, 4096, 1, 1};
+    c.proto.set_phase(cnn::TRAIN);
+    c.proto.set_type(cnn::FULL_CONNECTED);
+    c.proto.mutable_fc_proto()->set_num_output(4096);
+    cases.push_back(c);
+  }
+  {
+    Case c{"fc 25088 -> 1024, n 32", {}, 32, 512, 7, 7};
+    c.proto.set_phase(cnn::TRAIN);
+    c.proto.set_type(cnn::FULL_CONNECTED);
+    c.proto.mutable_fc_proto()->set_num_output(1024);
+    cases.push_back(c);
+  }
+  {
+    Case c{"conv 64x56x56 -> 64, 3, n 16", {}, 16, 64, 56, 56};
+    c.proto.set_phase(cnn::TRAIN);
+    c.proto.set_type(cnn::CONVOLUTION);
+    c.proto.mutable_conv_proto()->set_num_output(64);
+    c.proto.mutable_conv_proto()->set_kernel_size(3);
+    cases.push_back(c);
+  }
+  {
+    Case c{"conv 128x28x28 -> 128, 3, n 32", {}, 32, 128, 28, 28};
+    c.proto.set_phase(cnn::TRAIN);
+    c.proto.set_type(cnn::CONVOLUTION);
+    c.proto.mutable_conv_proto()->set_num_output(128);
+    c.proto.mutable_conv_proto()->set_kernel_size(3);
+    cases.push_back(c);
+  }
+
+  cnn::AlignedAllocator small_pages;
+  cnn::HugePageAllocator thp;
+  cnn::HugePageAllocator hugetlb(cnn::HugePageAllocator::kHugePageSize, true);
+
+  std::cout << "float, best of 5 runs in ms; "
+            << "THP is the AnonHugePages in MiB during the run\n\n";
+  std::cout << std::setw(32) << "layer" << std::setw(10) << "pass"
+            << std::setw(10) << "4 KiB" << std::setw(10) << "THP"
+            << std::setw(10) << "hugetlb" << std::setw(10) << "speedup"
+            << std::setw(8) << "THP\n";
+  for (const auto& c : cases) {
+    auto t0 = run(c, &small_pages);
+    auto t1 = run(c, &thp);
+    auto t2 = run(c, &hugetlb);
+    for (int i = 0; i < 2; i++) {
+      std::cout << std::fixed << std::setprecision(3) << std::setw(32)
+                << (i == 0 ? c.name : "") << std::setw(10)
+                << (i == 0 ? "fprop" : "bprop") << std::setw(10) << t0[i]
+                << std::setw(10) << t1[i] << std::setw(10) << t2[i]
+                << std::setw(9) << std::setprecision(2)
+                << t0[i] / std::min(t1[i], t2[i]) << "x" << std::setw(8)
+                << std::setprecision(0) << t1[2] << "\n";
+    }
+  }
+
+  return 0;
+}
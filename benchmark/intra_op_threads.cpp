@@ -0,0 +1,182 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+
+// Time a training iteration (fprop, bprop and update_parameters)
+// and an inference pass of a small CNN with an increasing number
+// of threads in NetworkProto::num_threads, to see how the layers
+// scale with the cores.
+//
+// With a BLAS backend, limit its own threads, e.g.,
+// OPENBLAS_NUM_THREADS=1, so that they do not compete with the pool.
+//
+// usage: ./intra_op_threads [max_threads]
+//   max_threads defaults to std::thread::hardware_concurrency()
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+
+#include "cnn/io.hpp"
+#include "cnn/network.hpp"
+#include "cnn/rng.hpp"
+
+namespace {
+
+const char* kModel = R"(
+  layer_proto {
+    name: "input" type: INPUT top: "data" top: "label"
+    input_proto { n: 64 c: 3 h: 32 w: 32 }
+  }
+  layer_proto {
+    name: "conv1" type: CONVOLUTION bottom: "data" top: "conv1"
+    conv_proto { num_output: 32 kernel_size: 3 }
+  }
+  layer_proto {
+    name: "bn1" type: BATCH_NORMALIZATION bottom: "conv1" top: "bn1"
+    batch_normalization_proto { momentum: 0.9 }
+  }
+  layer_proto { name: "relu1" type: RELU bottom: "bn1" top: "relu1" }
+  layer_proto {
+    name: "pool1" type: MAX_POOLING bottom: "relu1" top: "pool1"
+    max_pooling_proto { win_size: 2 stride: 2 }
+  }
+  layer_proto {
+    name: "conv2" type: CONVOLUTION bottom: "pool1" top: "conv2"
+    conv_proto { num_output: 64 kernel_size: 3 }
+  }
+  layer_proto {
+    name: "bn2" type: BATCH_NORMALIZATION bottom: "conv2" top: "bn2"
+    batch_normalization_proto { momentum: 0.9 }
+  }
+  layer_proto { name: "relu2" type: RELU bottom: "bn2" top: "relu2" }
+  layer_proto {
+    name: "pool2" type: MAX_POOLING bottom: "relu2" top: "pool2"
+    max_pooling_proto { win_size: 2 stride: 2 }
+  }
+  layer_proto {
+    name: "drop1" type: DROP_OUT bottom: "pool2" top: "drop1"
+    dropout_proto { keep_prob: 0.5 }
+  }
+  layer_proto {
+    name: "fc1" type: FULL_CONNECTED bottom: "drop1" top: "fc1"
+    fc_proto { num_output: 256 }
+  }
+  layer_proto { name: "relu3" type: RELU bottom: "fc1" top: "relu3" }
+  layer_proto {
+    name: "fc2" type: FULL_CONNECTED bottom: "relu3" top: "fc2"
+    fc_proto { num_output: 10 }
+  }
+  layer_proto {
+    name: "loss" type: SOFTMAX_WITH_LOG_LOSS
+    bottom: "fc2" bottom: "label" top: "loss"
+  }
+)";
+
+void random_input(const std::vector<cnn::Array<float>*>& top) {
+  cnn::uniform<float>(top[0], -1, 1);
+  for (int i = 0; i < top[1]->total_; i++) {
+    (*top[1])[i] = i % 10;
+  }
+}
+
+// the best of a few runs, in milliseconds
+template <typename Func>
+double measure(Func func) {
+  static constexpr int kNumRuns = 5;
+  func();  // warm up
+  double best = std::numeric_limits<double>::max();
+  for (int i = 0; i < kNumRuns; i++) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto end = std::chrono::steady_clock::now();
+    best = std::min(
+        best, std::chrono::duration<double, std::milli>(end - start).count());
+  }
+  return best;
+}
+
+// training and inference time in ms
+std::pair<double, double> run(int num_threads, cnn::Phase phase) {
+  cnn::NetworkProto proto;
+  cnn::string_to_proto(kModel, &proto);
+  proto.set_num_threads(num_threads);
+  for (auto& p : *proto.mutable_layer_proto()) {
+    p.set_phase(phase);
+  }
+
+  cnn::set_seed(0);
+  cnn::Network<float> network(proto);
+  network.register_data_callback(&random_input);
+  network.reshape();
+
+  double train = 0;
+  if (phase == cnn::TRAIN) {
+    int iter = 0;
+    train = measure([&]() {
+      network.fprop();
+      network.bprop();
+      network.update_parameters(iter++, 1e-3);
+    });
+  }
+  double test = measure([&]() { network.fprop(); });
+  return {train, test};
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  google::InitGoogleLogging(argv[0]);
+
+  int max_threads = std::max(1u, std::thread::hardware_concurrency());
+  if (argc > 1) {
+    max_threads = std::atoi(argv[1]);
+  }
+
+  std::cout << "float, batch 64, 3x32x32 input, best of 5 runs in ms\n\n";
+  std::cout << std::setw(8) << "threads" << std::setw(12) << "train"
+            << std::setw(10) << "speedup" << std::setw(12) << "inference"
+            << std::setw(10) << "speedup"
+            << "\n";
+
+  double train1 = 0;
+  double test1 = 0;
+  for (int n = 1; n <= max_threads; n *= 2) {
+    double train = run(n, cnn::TRAIN).first;
+    double test = run(n, cnn::TEST).second;
+    if (n == 1) {
+      train1 = train;
+      test1 = test;
+    }
+    std::cout << std::fixed << std::setprecision(3) << std::setw(8) << n
+              << std::setw(12) << train << std::setw(9)
+              << std::setprecision(2) << train1 / train << "x"
+              << std::setw(12) << std::setprecision(3) << test
+              << std::setw(9) << std::setprecision(2) << test1 / test
+              << "x\n";
+
+    if (n < max_threads && 2 * n > max_threads) {
+      n = max_threads / 2;  // so that max_threads is measured as well
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,76 @@
+#
+# BLAS_INCLUDE_DIRS
+# BLAS_LIBRARIES
+#
+# Looks for MKL and then OpenBLAS and defines CNN_USE_MKL or
+# CNN_USE_OPENBLAS for the one found; see include/cnn/blas.hpp.
+# If neither is found, or CNN_USE_BLAS is OFF, the portable
+# kernels in array_math.hpp are used.
+#
+
+option(CNN_USE_BLAS "Use MKL or OpenBLAS if it is installed" ON)
+
+set(BLAS_INCLUDE_DIRS "")
+set(BLAS_LIBRARIES "")
+
+if (CNN_USE_BLAS)
+    find_path(MKL_INCLUDE_DIRS
+            mkl_cblas.h
+            PATHS
+            $ENV{MKLROOT}/include
+            /opt/intel/mkl/include
+            DOC "Path to mkl_cblas.h"
+    )
+    find_library(MKL_RT_LIBRARY
+            NAMES mkl_rt
+            PATHS
+            $ENV{MKLROOT}/lib/intel64
+            /opt/intel/mkl/lib/intel64
+            DOC "Path to libmkl_rt.so"
+    )
+
+    if (MKL_INCLUDE_DIRS AND MKL_RT_LIBRARY)
+        set(BLAS_INCLUDE_DIRS ${MKL_INCLUDE_DIRS})
+        set(BLAS_LIBRARIES ${MKL_RT_LIBRARY})
+        add_definitions(-DCNN_USE_MKL)
+        message(STATUS "BLAS backend: MKL")
+    else()
+        find_path(OPENBLAS_INCLUDE_DIRS
+                cblas.h
+                PATHS
+                /usr/local/include
+                /usr/local/opt/openblas/include
+                /usr/include/openblas
+                $ENV{HOME}/software/openblas/include
+                DOC "Path to cblas.h"
+        )
+        find_library(OPENBLAS_LIBRARIES
+                NAMES libopenblas.so libopenblas.dylib openblas
+                PATHS
+                /usr/local/lib
+                /usr/local/opt/openblas/lib
+                /usr/lib/x86_64-linux-gnu
+                $ENV{HOME}/software/openblas/lib
+                DOC "Path to libopenblas.so"
+        )
+        if (OPENBLAS_INCLUDE_DIRS AND OPENBLAS_LIBRARIES)
+            set(BLAS_INCLUDE_DIRS ${OPENBLAS_INCLUDE_DIRS})
+            set(BLAS_LIBRARIES ${OPENBLAS_LIBRARIES})
+            add_definitions(-DCNN_USE_OPENBLAS)
+            message(STATUS "BLAS backend: OpenBLAS")
+        endif()
+    endif()
+endif()
+
+if (BLAS_LIBRARIES)
+    include_directories(${BLAS_INCLUDE_DIRS})
+    message(STATUS "BLAS_INCLUDE_DIRS: ${BLAS_INCLUDE_DIRS}")
+    message(STATUS "BLAS_LIBRARIES: ${BLAS_LIBRARIES}")
+else()
+    message(STATUS "BLAS backend: none, using the portable kernels")
+endif()
+
+#[[
+sudo apt-get install libopenblas-dev
+brew install openblas
+]]
@@ -0,0 +1,62 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+#include <cstddef>
+
+namespace cnn {
+
+/**
+ * Heap allocations made by a thread.
+ *
+ * They are counted only if the library is built with
+ * CNN_TRACK_ALLOCATIONS (cmake -DCNN_TRACK_ALLOCATIONS=ON), which
+ * replaces the global operator new; the memory of AlignedAllocator
+ * and HugePageAllocator is counted as well.
+ */
+struct AllocationStats {
+  size_t num_allocations;
+  size_t bytes;
+};
+
+inline AllocationStats operator+(const AllocationStats& a,
+                                 const AllocationStats& b) {
+  return {a.num_allocations + b.num_allocations, a.bytes + b.bytes};
+}
+
+inline AllocationStats operator-(const AllocationStats& a,
+                                 const AllocationStats& b) {
+  return {a.num_allocations - b.num_allocations, a.bytes - b.bytes};
+}
+
+/** true if the library is built with CNN_TRACK_ALLOCATIONS */
+bool allocation_tracking_enabled();
+
+/**
+ * The allocations of the calling thread since it started;
+ * all zero if allocation_tracking_enabled() is false. Those of
+ * other threads, e.g., the workers of a ThreadPool, are not
+ * included; see ThreadPool::worker_allocation_stats().
+ */
+AllocationStats thread_allocation_stats();
+
+namespace internal {
+
+/** count an allocation of the calling thread */
+void record_allocation(size_t bytes);
+
+}  // namespace internal
+
+}  // namespace cnn
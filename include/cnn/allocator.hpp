@@ -0,0 +1,189 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+#include <cstddef>
+
+namespace cnn {
+
+/**
+ * Alignment in bytes of the memory behind every Array,
+ * i.e., a cache line and an AVX-512 register.
+ */
+constexpr size_t kArrayAlignment = 64;
+
+/**
+ * The memory behind Array.
+ *
+ * Implement it to back arrays with pools, arenas, etc.
+ * and pass it to Array::set_allocator() or set_default_allocator().
+ * An allocator has to outlive the arrays allocated from it.
+ */
+class Allocator {
+ public:
+  virtual ~Allocator() = default;
+
+  /**
+   * Return at least the given number of bytes, aligned to
+   * kArrayAlignment. It aborts if the memory cannot be allocated.
+   */
+  virtual void* allocate(size_t bytes) = 0;
+
+  /**
+   * Release memory returned by allocate().
+   *
+   * @param p the pointer returned by allocate()
+   * @param bytes the same size that was passed to allocate()
+   */
+  virtual void deallocate(void* p, size_t bytes) = 0;
+};
+
+/**
+ * Heap memory aligned to kArrayAlignment.
+ */
+class AlignedAllocator : public Allocator {
+ public:
+  void* allocate(size_t bytes) override;
+  void deallocate(void* p, size_t bytes) override;
+};
+
+/**
+ * Back large allocations with 2 MiB huge pages to cut TLB misses
+ * on big activations and gradients.
+ *
+ * Blocks of at least `threshold` bytes are rounded up to a multiple
+ * of kHugePageSize and mapped at a kHugePageSize aligned address.
+ * By default the mapping is anonymous memory marked with
+ * madvise(MADV_HUGEPAGE), which asks the kernel to back it with
+ * transparent huge pages (THP must be set to `madvise` or `always`
+ * in /sys/kernel/mm/transparent_hugepage/enabled).
+ * With `use_hugetlb`, the mapping is taken from the reserved
+ * hugetlbfs pool (/proc/sys/vm/nr_hugepages) instead; if the pool
+ * is exhausted, it falls back to transparent huge pages.
+ *
+ * Smaller blocks, and every block on systems other than Linux,
+ * come from an AlignedAllocator.
+ */
+class HugePageAllocator : public Allocator {
+ public:
+  static constexpr size_t kHugePageSize = size_t(2) << 20;
+
+  /**
+   * @param threshold blocks of at least this many bytes use huge pages
+   * @param use_hugetlb true to map from the hugetlbfs pool
+   */
+  explicit HugePageAllocator(size_t threshold = kHugePageSize,
+                             bool use_hugetlb = false)
+      : threshold_(threshold), use_hugetlb_(use_hugetlb) {}
+
+  void* allocate(size_t bytes) override;
+  void deallocate(void* p, size_t bytes) override;
+
+  size_t threshold() const { return threshold_; }
+  bool use_hugetlb() const { return use_hugetlb_; }
+
+ private:
+  bool is_large(size_t bytes) const;
+
+  size_t threshold_;
+  bool use_hugetlb_;
+  AlignedAllocator small_;
+};
+
+/**
+ * One block of memory shared by arrays that are never in use at the
+ * same time, e.g., activations assigned to the same buffer by
+ * Network::plan_memory(). Every allocate() returns the same block.
+ *
+ * The block is taken from default_allocator() at construction
+ * and given back by the destructor.
+ */
+class SharedBufferAllocator : public Allocator {
+ public:
+  explicit SharedBufferAllocator(size_t bytes);
+  ~SharedBufferAllocator() override;
+
+  SharedBufferAllocator(const SharedBufferAllocator&) = delete;
+  SharedBufferAllocator& operator=(const SharedBufferAllocator&) = delete;
+
+  /** It aborts if `bytes` exceeds the size of the block. */
+  void* allocate(size_t bytes) override;
+
+  /** The block stays until the allocator is destroyed. */
+  void deallocate(void* /*p*/, size_t /*bytes*/) override {}
+
+  size_t bytes() const { return bytes_; }
+
+ private:
+  Allocator* owner_;
+  size_t bytes_;
+  void* d_;
+};
+
+/**
+ * A single slab carved into consecutive blocks, e.g., all the arrays
+ * of a Network with NetworkProto.use_arena. Every allocate() returns
+ * the next block, aligned to kArrayAlignment; deallocate() does
+ * nothing.
+ *
+ * The slab is taken from default_allocator() at construction
+ * and given back by the destructor.
+ */
+class ArenaAllocator : public Allocator {
+ public:
+  explicit ArenaAllocator(size_t bytes);
+  ~ArenaAllocator() override;
+
+  ArenaAllocator(const ArenaAllocator&) = delete;
+  ArenaAllocator& operator=(const ArenaAllocator&) = delete;
+
+  /** It aborts if the slab has no room for `bytes` any more. */
+  void* allocate(size_t bytes) override;
+
+  /** The memory stays until the arena is destroyed. */
+  void deallocate(void* /*p*/, size_t /*bytes*/) override {}
+
+  /** `bytes` rounded up to kArrayAlignment, i.e., what it takes */
+  static size_t block_size(size_t bytes) {
+    return (bytes + kArrayAlignment - 1) / kArrayAlignment * kArrayAlignment;
+  }
+
+  const char* data() const { return d_; }
+  size_t bytes() const { return bytes_; }
+  size_t used() const { return used_; }
+
+ private:
+  Allocator* owner_;
+  size_t bytes_;
+  size_t used_;
+  char* d_;
+};
+
+/**
+ * Return the allocator used by arrays that have not been given one.
+ * It is an AlignedAllocator unless replaced by set_default_allocator().
+ */
+Allocator* default_allocator();
+
+/**
+ * Replace the default allocator; nullptr restores the
+ * AlignedAllocator. Arrays that already hold memory keep using
+ * the allocator they got it from.
+ *
+ * @return the previous default allocator
+ */
+Allocator* set_default_allocator(Allocator* allocator);
+
+}  // namespace cnn
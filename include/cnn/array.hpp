@@ -17,13 +17,34 @@
 #include <string>
 #include <vector>
 
+#include "cnn/allocator.hpp"
 #include "proto/cnn.pb.h"
 
 namespace cnn {
 
+/**
+ * A 4-d array in NCHW layout.
+ *
+ * The data is aligned to kArrayAlignment and is followed by padding
+ * up to padded_total() elements, so kernels can use aligned loads
+ * and process the array in whole vector registers. init() sets the
+ * padding to 0; the element-wise functions of array_math.hpp may
+ * overwrite it, but nothing reads it as part of the array.
+ *
+ * The memory comes from an Allocator and is reused by init() as long
+ * as it is large enough.
+ */
 template <typename Dtype>
 class Array {
  public:
+  /**
+   * Number of elements the array is padded to a multiple of,
+   * i.e., the number of elements in kArrayAlignment bytes.
+   */
+  static constexpr int kPadding = (sizeof(Dtype) < kArrayAlignment)
+                                      ? kArrayAlignment / sizeof(Dtype)
+                                      : 1;
+
   Array();
   ~Array();
   Array(const Array<Dtype>&) = delete;
@@ -32,10 +53,34 @@ class Array {
   Array(Array<Dtype>&&);
   Array& operator=(Array<Dtype>&&);
 
-  void init(int n, int c, int h, int w);
+  /**
+   * Set the shape of the array.
+   *
+   * @param zero_fill true to set all elements to 0; pass false
+   *                  for buffers that are overwritten right away.
+   *                  The padding is set to 0 in either case.
+   */
+  void init(int n, int c, int h, int w, bool zero_fill = true);
 
   template <typename U>
-  void init_like(const Array<U>& arr);
+  void init_like(const Array<U>& arr, bool zero_fill = true);
+
+  /**
+   * Use the given allocator for this array; nullptr selects
+   * default_allocator() at the next allocation. The current memory
+   * is released, so the array becomes empty.
+   */
+  void set_allocator(Allocator* allocator);
+
+  /**
+   * Release the memory; the array becomes empty.
+   */
+  void release();
+
+  /** total_ rounded up to a multiple of kPadding */
+  int padded_total() const {
+    return (total_ + kPadding - 1) / kPadding * kPadding;
+  }
 
   template <typename U>
   bool has_same_shape(const Array<U>& arr) const;
@@ -68,6 +113,12 @@ class Array {
 
   Dtype* d_;  //!< pointer to the data
 
+  int capacity_;  //!< number of elements d_ can hold, >= padded_total()
+
+ private:
+  Allocator* allocator_;  //!< set_allocator(), nullptr for the default
+  Allocator* owner_;      //!< the allocator d_ comes from
+
  public:
   void from_proto(const ArrayProto& proto);
   void to_proto(ArrayProto* proto) const;
@@ -0,0 +1,276 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include "cnn/array.hpp"
+
+namespace cnn {
+
+/**
+ * Lazy element-wise expressions over arrays.
+ *
+ * An expression only records its operands; nothing is computed
+ * until it is assigned, which runs a single loop over the
+ * elements. For example,
+ *
+ * @code
+ *  assign(n, t, (array_expr(n, x) - mu) * scale + bias);
+ * @endcode
+ *
+ * reads x and writes t once, instead of once per operation as
+ * sub_scalar() followed by scale_arr() would do.
+ *
+ * The destination may be one of the operands, but it must not
+ * partially overlap any of them.
+ */
+template <typename Derived>
+struct Expr {
+  const Derived& self() const { return static_cast<const Derived&>(*this); }
+};
+
+/**
+ * n consecutive elements starting at d_.
+ */
+template <typename Dtype>
+struct ArrayExpr : public Expr<ArrayExpr<Dtype>> {
+  using value_type = Dtype;
+
+  ArrayExpr(int n, const Dtype* d) : n_(n), d_(d) {}
+
+  Dtype operator[](int i) const { return d_[i]; }
+  int size() const { return n_; }
+
+  int n_;
+  const Dtype* d_;
+};
+
+/**
+ * A scalar that is broadcast to every element.
+ */
+template <typename Dtype>
+struct ScalarExpr : public Expr<ScalarExpr<Dtype>> {
+  using value_type = Dtype;
+
+  explicit ScalarExpr(const Dtype& v) : v_(v) {}
+
+  const Dtype& operator[](int) const { return v_; }
+
+  /** -1 since a scalar matches expressions of any size */
+  int size() const { return -1; }
+
+  Dtype v_;
+};
+
+/**
+ * Op applied element-wise to two expressions.
+ *
+ * The operands are held by value, so an expression built from
+ * temporaries can be stored and assigned later.
+ */
+template <typename Op, typename L, typename R>
+struct BinaryExpr : public Expr<BinaryExpr<Op, L, R>> {
+  using value_type = typename L::value_type;
+
+  BinaryExpr(const L& l, const R& r) : l_(l), r_(r) {
+    if (l_.size() >= 0 && r_.size() >= 0) {
+      CHECK_EQ(l_.size(), r_.size());
+    }
+  }
+
+  value_type operator[](int i) const { return Op::apply(l_[i], r_[i]); }
+  int size() const { return (l_.size() >= 0) ? l_.size() : r_.size(); }
+
+  L l_;
+  R r_;
+};
+
+/**
+ * Wrap an array, or n elements starting at d, into an expression.
+ */
+template <typename Dtype>
+ArrayExpr<Dtype> array_expr(const Array<Dtype>& arr) {
+  return ArrayExpr<Dtype>(arr.total_, arr.d_);
+}
+
+template <typename Dtype>
+ArrayExpr<Dtype> array_expr(int n, const Dtype* d) {
+  return ArrayExpr<Dtype>(n, d);
+}
+
+namespace internal {
+
+struct AddOp {
+  template <typename Dtype>
+  static Dtype apply(const Dtype& a, const Dtype& b) {
+    return a + b;
+  }
+};
+
+struct SubOp {
+  template <typename Dtype>
+  static Dtype apply(const Dtype& a, const Dtype& b) {
+    return a - b;
+  }
+};
+
+struct MulOp {
+  template <typename Dtype>
+  static Dtype apply(const Dtype& a, const Dtype& b) {
+    return a * b;
+  }
+};
+
+struct DivOp {
+  template <typename Dtype>
+  static Dtype apply(const Dtype& a, const Dtype& b) {
+    return a / b;
+  }
+};
+
+struct MaxOp {
+  template <typename Dtype>
+  static Dtype apply(const Dtype& a, const Dtype& b) {
+    return (a > b) ? a : b;
+  }
+};
+
+/**
+ * Number of elements an expression is evaluated for at a time.
+ *
+ * Each block is computed into a local buffer with a loop of
+ * constant trip count, which the compiler vectorizes even at -O2
+ * and without knowing whether the destination aliases an operand.
+ */
+constexpr int kExprBlock = 16;
+
+template <typename Dtype, typename E>
+void assign_block(int i, int len, Dtype* dst, const E& e) {
+  if (len == kExprBlock) {
+    Dtype tmp[kExprBlock];
+    for (int j = 0; j < kExprBlock; j++) {
+      tmp[j] = e[i + j];
+    }
+    for (int j = 0; j < kExprBlock; j++) {
+      dst[i + j] = tmp[j];
+    }
+  } else  // NOLINT
+  {
+    for (int j = 0; j < len; j++) {
+      dst[i + j] = e[i + j];
+    }
+  }
+}
+
+inline void assign_blocks(int, int) {}
+
+template <typename Dtype, typename E, typename... Rest>
+void assign_blocks(int i, int len, Dtype* dst, const Expr<E>& e,
+                   const Rest&... rest) {
+  assign_block(i, len, dst, e.self());
+  assign_blocks(i, len, rest...);
+}
+
+inline void check_sizes(int) {}
+
+template <typename Dtype, typename E, typename... Rest>
+void check_sizes(int n, Dtype*, const Expr<E>& e, const Rest&... rest) {
+  if (e.self().size() >= 0) {
+    CHECK_EQ(e.self().size(), n);
+  }
+  check_sizes(n, rest...);
+}
+
+}  // namespace internal
+
+#define CNN_EXPR_BINARY_OPERATOR(op, Op)                                    \
+  template <typename L, typename R>                                         \
+  BinaryExpr<internal::Op, L, R> operator op(const Expr<L>& l,              \
+                                             const Expr<R>& r) {            \
+    return BinaryExpr<internal::Op, L, R>(l.self(), r.self());              \
+  }                                                                         \
+                                                                            \
+  template <typename L>                                                     \
+  BinaryExpr<internal::Op, L, ScalarExpr<typename L::value_type>>           \
+  operator op(const Expr<L>& l, const typename L::value_type& r) {          \
+    using S = ScalarExpr<typename L::value_type>;                           \
+    return BinaryExpr<internal::Op, L, S>(l.self(), S(r));                  \
+  }                                                                         \
+                                                                            \
+  template <typename R>                                                     \
+  BinaryExpr<internal::Op, ScalarExpr<typename R::value_type>, R>           \
+  operator op(const typename R::value_type& l, const Expr<R>& r) {          \
+    using S = ScalarExpr<typename R::value_type>;                           \
+    return BinaryExpr<internal::Op, S, R>(S(l), r.self());                  \
+  }
+
+CNN_EXPR_BINARY_OPERATOR(+, AddOp)
+CNN_EXPR_BINARY_OPERATOR(-, SubOp)
+CNN_EXPR_BINARY_OPERATOR(*, MulOp)
+CNN_EXPR_BINARY_OPERATOR(/, DivOp)
+
+#undef CNN_EXPR_BINARY_OPERATOR
+
+/**
+ * Element-wise maximum of two expressions.
+ */
+template <typename L, typename R>
+BinaryExpr<internal::MaxOp, L, R> maximum(const Expr<L>& l,
+                                          const Expr<R>& r) {
+  return BinaryExpr<internal::MaxOp, L, R>(l.self(), r.self());
+}
+
+/**
+ * dst[i] = e[i] for i in [0, n)
+ */
+template <typename Dtype, typename E>
+void assign(int n, Dtype* dst, const Expr<E>& e) {
+  internal::check_sizes(n, dst, e);
+  for (int i = 0; i < n; i += internal::kExprBlock) {
+    int len = std::min(internal::kExprBlock, n - i);
+    internal::assign_block(i, len, dst, e.self());
+  }
+}
+
+template <typename Dtype, typename E>
+void assign(Array<Dtype>* dst, const Expr<E>& e) {
+  assign(dst->total_, dst->d_, e);
+}
+
+/**
+ * Assign several expressions of n elements in a single pass,
+ *
+ * @code
+ *  fused_assign(n, dst0, e0, dst1, e1, ...);
+ * @endcode
+ *
+ * The result is the same as assigning them one after the other:
+ * every block of elements is assigned to dst0, then to dst1, and
+ * so on, so e1 sees the new values of dst0. The difference is
+ * that the block is still in the cache when e1 reads it.
+ */
+template <typename Dtype, typename E, typename... Rest>
+void fused_assign(int n, Dtype* dst, const Expr<E>& e, const Rest&... rest) {
+  internal::check_sizes(n, dst, e, rest...);
+  for (int i = 0; i < n; i += internal::kExprBlock) {
+    int len = std::min(internal::kExprBlock, n - i);
+    internal::assign_blocks(i, len, dst, e, rest...);
+  }
+}
+
+}  // namespace cnn
@@ -14,10 +14,246 @@
   -----------------------------------------------------------------  */
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
 #include "cnn/array.hpp"
+#include "cnn/blas.hpp"
+#include "cnn/simd.hpp"
+#include "cnn/thread_pool.hpp"
 
 namespace cnn {
 
+namespace internal {
+
+/**
+ * std::true_type if the operations on Dtype can be forwarded
+ * to the BLAS backend, see blas.hpp; std::false_type otherwise.
+ */
+template <typename Dtype>
+using HasBlas = std::integral_constant<bool, Blas<Dtype>::kEnabled>;
+
+/**
+ * std::true_type if the element-wise operations on Dtype have
+ * vectorized kernels, see simd.hpp; std::false_type otherwise.
+ */
+template <typename Dtype>
+using HasSimd = std::integral_constant<bool, Simd<Dtype>::kEnabled>;
+
+using GenericBackend = std::integral_constant<int, 0>;
+using SimdBackend = std::integral_constant<int, 1>;
+using BlasBackend = std::integral_constant<int, 2>;
+
+/**
+ * The backend for operations that both BLAS and the vectorized
+ * kernels provide; a tuned BLAS library is preferred.
+ */
+template <typename Dtype>
+using BackendOf = std::integral_constant<
+    int, Blas<Dtype>::kEnabled
+             ? BlasBackend::value
+             : (Simd<Dtype>::kEnabled ? SimdBackend::value
+                                      : GenericBackend::value)>;
+
+template <typename Dtype>
+Dtype ax_sub_by_squared(std::false_type, int n, Dtype alpha, const Dtype* x,
+                        Dtype beta, const Dtype* y) {
+  Dtype res = 0;
+  for (int i = 0; i < n; i++) {
+    Dtype diff = alpha * x[i] - beta * y[i];
+    res += diff * diff;
+  }
+  return res;
+}
+
+template <typename Dtype>
+Dtype ax_sub_by_squared(std::true_type, int n, Dtype alpha, const Dtype* x,
+                        Dtype beta, const Dtype* y) {
+  return Simd<Dtype>::kernels().ax_sub_by_squared(n, alpha, x, beta, y);
+}
+
+template <typename Dtype>
+Dtype ax_dot_by(GenericBackend, int n, Dtype alpha, const Dtype* x,
+                Dtype beta, const Dtype* y) {
+  Dtype res = 0;
+  for (int i = 0; i < n; i++) {
+    res += alpha * x[i] * beta * y[i];
+  }
+  return res;
+}
+
+template <typename Dtype>
+Dtype ax_dot_by(SimdBackend, int n, Dtype alpha, const Dtype* x, Dtype beta,
+                const Dtype* y) {
+  return alpha * beta * Simd<Dtype>::kernels().dot(n, x, y);
+}
+
+template <typename Dtype>
+Dtype ax_dot_by(BlasBackend, int n, Dtype alpha, const Dtype* x, Dtype beta,
+                const Dtype* y) {
+  return alpha * beta * Blas<Dtype>::dot(n, x, y);
+}
+
+template <typename Dtype>
+void ax_plus_by(GenericBackend, int n, Dtype alpha, const Dtype* x,
+                Dtype beta, Dtype* y) {
+  for (int i = 0; i < n; i++) {
+    y[i] = alpha * x[i] + beta * y[i];
+  }
+}
+
+template <typename Dtype>
+void ax_plus_by(SimdBackend, int n, Dtype alpha, const Dtype* x, Dtype beta,
+                Dtype* y) {
+  Simd<Dtype>::kernels().ax_plus_by(n, alpha, x, beta, y);
+}
+
+template <typename Dtype>
+void ax_plus_by(BlasBackend, int n, Dtype alpha, const Dtype* x, Dtype beta,
+                Dtype* y) {
+  Blas<Dtype>::axpby(n, alpha, x, beta, y);
+}
+
+template <typename Dtype>
+void set_to(std::false_type, int n, Dtype* arr, Dtype val) {
+  for (int i = 0; i < n; i++) {
+    arr[i] = val;
+  }
+}
+
+template <typename Dtype>
+void set_to(std::true_type, int n, Dtype* arr, Dtype val) {
+  Simd<Dtype>::kernels().set_to(n, val, arr);
+}
+
+template <typename Dtype>
+void scale_arr(std::false_type, int n, Dtype alpha, const Dtype* src,
+               Dtype* dst) {
+  for (int i = 0; i < n; i++) {
+    dst[i] = alpha * src[i];
+  }
+}
+
+template <typename Dtype>
+void scale_arr(std::true_type, int n, Dtype alpha, const Dtype* src,
+               Dtype* dst) {
+  Simd<Dtype>::kernels().scale_arr(n, alpha, src, dst);
+}
+
+template <typename Dtype>
+Dtype sum_arr(std::false_type, int n, const Dtype* src) {
+  Dtype res = 0;
+  for (int i = 0; i < n; i++) {
+    res += src[i];
+  }
+  return res;
+}
+
+template <typename Dtype>
+Dtype sum_arr(std::true_type, int n, const Dtype* src) {
+  return Simd<Dtype>::kernels().sum_arr(n, src);
+}
+
+template <typename Dtype>
+Dtype sum_squared_arr(std::false_type, int n, const Dtype* src) {
+  Dtype res = 0;
+  for (int i = 0; i < n; i++) {
+    res += src[i] * src[i];
+  }
+  return res;
+}
+
+template <typename Dtype>
+Dtype sum_squared_arr(std::true_type, int n, const Dtype* src) {
+  return Simd<Dtype>::kernels().sum_squared_arr(n, src);
+}
+
+template <typename Dtype>
+void sub_scalar(std::false_type, int n, Dtype alpha, const Dtype* src,
+                Dtype* dst) {
+  for (int i = 0; i < n; i++) {
+    dst[i] = src[i] - alpha;
+  }
+}
+
+template <typename Dtype>
+void sub_scalar(std::true_type, int n, Dtype alpha, const Dtype* src,
+                Dtype* dst) {
+  Simd<Dtype>::kernels().sub_scalar(n, alpha, src, dst);
+}
+
+template <typename Dtype>
+Dtype max_arr(std::false_type, int n, const Dtype* src) {
+  Dtype res = -std::numeric_limits<double>::infinity();
+  for (int i = 0; i < n; i++) {
+    if (src[i] > res) {
+      res = src[i];
+    }
+  }
+  return res;
+}
+
+template <typename Dtype>
+Dtype max_arr(std::true_type, int n, const Dtype* src) {
+  return Simd<Dtype>::kernels().max_arr(n, src);
+}
+
+// the generic versions call exp() and log() unqualified, so that
+// the overloads for Jet in jet.hpp are found by ADL
+
+template <typename Dtype>
+void exp_arr(std::false_type, int n, const Dtype* src, Dtype* dst) {
+  using std::exp;
+  for (int i = 0; i < n; i++) {
+    dst[i] = exp(src[i]);
+  }
+}
+
+template <typename Dtype>
+void exp_arr(std::true_type, int n, const Dtype* src, Dtype* dst) {
+  Simd<Dtype>::kernels().exp_arr(n, src, dst);
+}
+
+template <typename Dtype>
+void log_arr(std::false_type, int n, const Dtype* src, Dtype* dst) {
+  using std::log;
+  for (int i = 0; i < n; i++) {
+    dst[i] = log(src[i]);
+  }
+}
+
+template <typename Dtype>
+void log_arr(std::true_type, int n, const Dtype* src, Dtype* dst) {
+  Simd<Dtype>::kernels().log_arr(n, src, dst);
+}
+
+template <typename Dtype>
+Dtype sub_exp_sum(std::false_type, int n, Dtype alpha, const Dtype* src,
+                  Dtype* dst) {
+  using std::exp;
+  Dtype res = 0;
+  for (int i = 0; i < n; i++) {
+    Dtype e = exp(src[i] - alpha);
+    res += e;
+    if (dst) {
+      dst[i] = e;
+    }
+  }
+  return res;
+}
+
+template <typename Dtype>
+Dtype sub_exp_sum(std::true_type, int n, Dtype alpha, const Dtype* src,
+                  Dtype* dst) {
+  return Simd<Dtype>::kernels().sub_exp_sum(n, alpha, src, dst);
+}
+
+}  // namespace internal
+
 /**
  *
  * compute
@@ -34,12 +270,8 @@ namespace cnn {
 template <typename Dtype>
 Dtype ax_sub_by_squared(int n, Dtype alpha, const Dtype* x, Dtype beta,
                         const Dtype* y) {
-  Dtype res = 0;
-  for (int i = 0; i < n; i++) {
-    Dtype diff = alpha * x[i] - beta * y[i];
-    res += diff * diff;
-  }
-  return res;
+  return internal::ax_sub_by_squared(internal::HasSimd<Dtype>(), n, alpha, x,
+                                     beta, y);
 }
 
 /**
@@ -56,11 +288,8 @@ Dtype ax_sub_by_squared(int n, Dtype alpha, const Dtype* x, Dtype beta,
 template <typename Dtype>
 Dtype ax_dot_by(int n, Dtype alpha, const Dtype* x, Dtype beta,
                 const Dtype* y) {
-  Dtype res = 0;
-  for (int i = 0; i < n; i++) {
-    res += alpha * x[i] * beta * y[i];
-  }
-  return res;
+  return internal::ax_dot_by(internal::BackendOf<Dtype>(), n, alpha, x, beta,
+                             y);
 }
 
 /**
@@ -74,9 +303,7 @@ Dtype ax_dot_by(int n, Dtype alpha, const Dtype* x, Dtype beta,
  */
 template <typename Dtype>
 void ax_plus_by(int n, Dtype alpha, const Dtype* x, Dtype beta, Dtype* y) {
-  for (int i = 0; i < n; i++) {
-    y[i] = alpha * x[i] + beta * y[i];
-  }
+  internal::ax_plus_by(internal::BackendOf<Dtype>(), n, alpha, x, beta, y);
 }
 
 /**
@@ -88,94 +315,593 @@ void ax_plus_by(int n, Dtype alpha, const Dtype* x, Dtype beta, Dtype* y) {
  * @param val the given value
  */
 template <typename Dtype>
-void set_to(Array<Dtype>* arr, Dtype val) {
+void set_to(int n, Dtype* arr, Dtype val) {
   if (!val) {
-    memset(arr->d_, 0, sizeof(Dtype) * arr->total_);
+    memset(static_cast<void*>(arr), 0, sizeof(Dtype) * n);
   } else  // NOLINT
   {
-    for (int i = 0; i < arr->total_; i++) {
-      arr->d_[i] = val;
+    internal::set_to(internal::HasSimd<Dtype>(), n, arr, val);
+  }
+}
+
+template <typename Dtype>
+void set_to(Array<Dtype>* arr, Dtype val) {
+  // the padding is included so the kernel has no remainder loop
+  set_to(arr->padded_total(), arr->d_, val);
+}
+
+/**
+ * dst[i] = alpha * src[i]
+ */
+template <typename Dtype>
+void scale_arr(int n, Dtype alpha, const Dtype* src, Dtype* dst) {
+  internal::scale_arr(internal::HasSimd<Dtype>(), n, alpha, src, dst);
+}
+
+template <typename Dtype>
+void scale_arr(Dtype alpha, const Array<Dtype>& src, Array<Dtype>* dst) {
+  int n = (src.total_ == dst->total_) ? src.padded_total() : src.total_;
+  scale_arr(n, alpha, src.d_, dst->d_);
+}
+
+/**
+ * res = src[0] + src[1] + src[2] + ... + src[total-1]
+ */
+template <typename Dtype>
+Dtype sum_arr(int n, const Dtype* src) {
+  return internal::sum_arr(internal::HasSimd<Dtype>(), n, src);
+}
+
+template <typename Dtype>
+Dtype sum_arr(const Array<Dtype>& src) {
+  return sum_arr(src.total_, src.d_);
+}
+
+template <typename Dtype>
+Dtype sum_squared_arr(int n, const Dtype* src) {
+  return internal::sum_squared_arr(internal::HasSimd<Dtype>(), n, src);
+}
+
+/**
+ * dst[i] = src[i] - alpha
+ */
+template <typename Dtype>
+void sub_scalar(int n, Dtype alpha, const Dtype* src, Dtype* dst) {
+  internal::sub_scalar(internal::HasSimd<Dtype>(), n, alpha, src, dst);
+}
+
+/**
+ * dst[i] = src[i] - alpha
+ */
+template <typename Dtype>
+void sub_scalar(Dtype alpha, const Array<Dtype>& src, Array<Dtype>* dst) {
+  int n = (src.total_ == dst->total_) ? src.padded_total() : src.total_;
+  sub_scalar(n, alpha, src.d_, dst->d_);
+}
+
+/**
+ * res = max(src[0], src[1], ..., src[n-1]);
+ * -infinity if n is 0.
+ */
+template <typename Dtype>
+Dtype max_arr(int n, const Dtype* src) {
+  return internal::max_arr(internal::HasSimd<Dtype>(), n, src);
+}
+
+/**
+ * dst[i] = exp(src[i])
+ *
+ * For float and double, a polynomial approximation is evaluated
+ * with the instructions of simd_isa(). Its error is at most
+ * 1.1 ulp for float and 2 ulp for double where the result is
+ * normal. Results that would be subnormal are flushed to 0, and
+ * the result saturates at a finite value for inputs close to or
+ * above ln(max), i.e., 88.3 for float and 709 for double, instead
+ * of becoming infinity.
+ *
+ * Other types, e.g., Jet, use exp() element by element.
+ *
+ * src and dst may be the same array.
+ */
+template <typename Dtype>
+void exp_arr(int n, const Dtype* src, Dtype* dst) {
+  internal::exp_arr(internal::HasSimd<Dtype>(), n, src, dst);
+}
+
+/**
+ * dst[i] = log(src[i])
+ *
+ * As exp_arr(), float and double use a polynomial approximation;
+ * its error is at most 1 ulp for both. src[i] must be a positive,
+ * finite and normal number.
+ */
+template <typename Dtype>
+void log_arr(int n, const Dtype* src, Dtype* dst) {
+  internal::log_arr(internal::HasSimd<Dtype>(), n, src, dst);
+}
+
+/**
+ * dst[i] = exp(src[i] - alpha)
+ *
+ * @return dst[0] + dst[1] + ... + dst[n-1]
+ *
+ * dst can be nullptr if only the sum is needed. It is the core of
+ * softmax, with alpha being the maximum of src; see exp_arr()
+ * for the accuracy.
+ */
+template <typename Dtype>
+Dtype sub_exp_sum(int n, Dtype alpha, const Dtype* src, Dtype* dst) {
+  return internal::sub_exp_sum(internal::HasSimd<Dtype>(), n, alpha, src, dst);
+}
+
+/**
+ * res = log(exp(src[0]) + exp(src[1]) + ... + exp(src[n-1]))
+ *
+ * The maximum is subtracted before exp(), so it does not overflow.
+ */
+template <typename Dtype>
+Dtype log_sum_exp(int n, const Dtype* src) {
+  using std::log;
+  Dtype m = max_arr(n, src);
+  return m + log(sub_exp_sum(n, m, src, static_cast<Dtype*>(nullptr)));
+}
+
+namespace internal {
+
+/**
+ * Block sizes for gemm().
+ *
+ * A kMC x kKC block of op(A) is packed into panels of kMR rows and
+ * a kKC x kNC block of op(B) is packed into panels of kNR columns,
+ * so that the micro kernel computes a kMR x kNR tile of C whose
+ * accumulators stay in registers.
+ */
+struct GemmBlocking {
+  static constexpr int kMR = 4;
+  static constexpr int kNR = 8;
+  static constexpr int kMC = 64;
+  static constexpr int kKC = 256;
+  static constexpr int kNC = 2048;
+};
+
+/**
+ * Pack op(A)[0:mc, 0:kc] into panels of kMR rows.
+ * Inside a panel, the kMR elements of a column are contiguous.
+ * Rows beyond mc are padded with 0.
+ */
+template <typename Dtype>
+void gemm_pack_a(bool trans, int mc, int kc, const Dtype* a, int lda,
+                 Dtype* dst) {
+  static constexpr int MR = GemmBlocking::kMR;
+  for (int i = 0; i < mc; i += MR) {
+    int rows = std::min(MR, mc - i);
+    for (int p = 0; p < kc; p++) {
+      int r = 0;
+      if (trans) {
+        for (; r < rows; r++) *dst++ = a[p * lda + i + r];
+      } else  // NOLINT
+      {
+        for (; r < rows; r++) *dst++ = a[(i + r) * lda + p];
+      }
+      for (; r < MR; r++) *dst++ = Dtype(0);
     }
   }
 }
 
+/**
+ * Pack op(B)[0:kc, 0:nc] into panels of kNR columns.
+ * Inside a panel, the kNR elements of a row are contiguous.
+ * Columns beyond nc are padded with 0.
+ */
 template <typename Dtype>
-void set_to(int n, Dtype* arr, Dtype val) {
-  if (!val) {
-    memset(arr, 0, sizeof(Dtype) * n);
-  } else  // NOLINT
-  {
-    for (int i = 0; i < n; i++) {
-      arr[i] = val;
+void gemm_pack_b(bool trans, int kc, int nc, const Dtype* b, int ldb,
+                 Dtype* dst) {
+  static constexpr int NR = GemmBlocking::kNR;
+  for (int j = 0; j < nc; j += NR) {
+    int cols = std::min(NR, nc - j);
+    for (int p = 0; p < kc; p++) {
+      int c = 0;
+      if (trans) {
+        for (; c < cols; c++) *dst++ = b[(j + c) * ldb + p];
+      } else  // NOLINT
+      {
+        const Dtype* src = b + p * ldb + j;
+        for (; c < cols; c++) *dst++ = src[c];
+      }
+      for (; c < NR; c++) *dst++ = Dtype(0);
     }
   }
 }
 
 /**
- * dst[i] = alpha * src[i]
+ * acc[i*kNR + j] = sum_p a[p*kMR + i] * b[p*kNR + j]
  */
 template <typename Dtype>
-void scale_arr(Dtype alpha, const Array<Dtype>& src, Array<Dtype>* dst) {
-  for (int i = 0; i < src.total_; i++) {
-    dst->d_[i] = alpha * src.d_[i];
+void gemm_micro_kernel(int kc, const Dtype* a, const Dtype* b, Dtype* acc) {
+  static constexpr int MR = GemmBlocking::kMR;
+  static constexpr int NR = GemmBlocking::kNR;
+  Dtype c[MR * NR];
+  for (int i = 0; i < MR * NR; i++) c[i] = Dtype(0);
+
+  for (int p = 0; p < kc; p++) {
+    for (int i = 0; i < MR; i++) {
+      Dtype ai = a[i];
+      for (int j = 0; j < NR; j++) {
+        c[i * NR + j] += ai * b[j];
+      }
+    }
+    a += MR;
+    b += NR;
   }
+
+  for (int i = 0; i < MR * NR; i++) acc[i] = c[i];
 }
 
+/**
+ * Return a per-thread scratch buffer with at least n elements.
+ * It only grows, so no allocation happens once the largest
+ * size has been seen.
+ */
 template <typename Dtype>
-void scale_arr(int n, Dtype alpha, const Dtype* src, Dtype* dst) {
-  for (int i = 0; i < n; i++) {
-    dst[i] = alpha * src[i];
+Dtype* gemm_buffer(int which, int n) {
+  thread_local std::vector<Dtype> buffers[2];
+  auto& buf = buffers[which];
+  if (buf.size() < static_cast<size_t>(n)) {
+    buf.resize(n);
   }
+  return buf.data();
 }
 
 /**
- * res = src[0] + src[1] + src[2] + ... + src[total-1]
+ * Grow the buffers of gemm_buffer() in the calling thread to the
+ * largest size gemm() and gemm_packed() with blocks of at most kKC
+ * columns use, so that a thread of a pool does not allocate in its
+ * first product; nothing if a BLAS backend computes the products.
  */
 template <typename Dtype>
-Dtype sum_arr(const Array<Dtype>& src) {
-  Dtype res = 0;
-  for (int i = 0; i < src.total_; i++) {
-    res += src.d_[i];
+void gemm_reserve_buffers() {
+  if (Blas<Dtype>::kEnabled) return;
+  gemm_buffer<Dtype>(0, GemmBlocking::kMC * GemmBlocking::kKC);
+  gemm_buffer<Dtype>(1, GemmBlocking::kKC * GemmBlocking::kNC);
+}
+
+/**
+ * The blocked gemm loop shared by gemm() and gemm_packed().
+ *
+ * If packed_a is not NULL, it is op(A) packed by gemm_pack() with
+ * blocks of KC columns, and a, lda and trans_a are ignored;
+ * otherwise blocks of op(A) are packed on the fly.
+ */
+template <typename Dtype>
+void gemm_blocked(bool trans_a, bool trans_b, int m, int n, int k, Dtype alpha,
+                  const Dtype* a, int lda, const Dtype* packed_a, int KC,
+                  const Dtype* b, int ldb, Dtype beta, Dtype* c, int ldc) {
+  static constexpr int MR = GemmBlocking::kMR;
+  static constexpr int NR = GemmBlocking::kNR;
+  static constexpr int MC = GemmBlocking::kMC;
+  static constexpr int NC = GemmBlocking::kNC;
+
+  if (m <= 0 || n <= 0) return;
+
+  if (k <= 0) {
+    for (int i = 0; i < m; i++) {
+      if (beta == Dtype(0)) {
+        cnn::set_to<Dtype>(n, c + i * ldc, 0);
+      } else  // NOLINT
+      {
+        cnn::scale_arr<Dtype>(n, beta, c + i * ldc, c + i * ldc);
+      }
+    }
+    return;
+  }
+
+  // packed panels are padded to a multiple of MR rows and NR columns
+  int max_mc = (std::min(MC, m) + MR - 1) / MR * MR;
+  int max_nc = (std::min(NC, n) + NR - 1) / NR * NR;
+  int max_kc = std::min(KC, k);
+
+  Dtype* block_a = nullptr;
+  if (!packed_a) {
+    block_a = gemm_buffer<Dtype>(0, max_mc * max_kc);
+  }
+  Dtype* packed_b = gemm_buffer<Dtype>(1, max_kc * max_nc);
+
+  Dtype acc[MR * NR];
+
+  for (int jc = 0; jc < n; jc += NC) {
+    int nc = std::min(NC, n - jc);
+    for (int pc = 0; pc < k; pc += KC) {
+      int kc = std::min(KC, k - pc);
+
+      // the first block along k applies beta; the others accumulate
+      Dtype cur_beta = (pc == 0) ? beta : Dtype(1);
+
+      const Dtype* b_block =
+          trans_b ? (b + jc * ldb + pc) : (b + pc * ldb + jc);
+      gemm_pack_b(trans_b, kc, nc, b_block, ldb, packed_b);
+
+      for (int ic = 0; ic < m; ic += MC) {
+        int mc = std::min(MC, m - ic);
+
+        // the panel of rows [ic + ir, ic + ir + MR) and columns
+        // [pc, pc + kc) starts at a_panels + ir * kc
+        const Dtype* a_panels;
+        if (packed_a) {
+          int padded_m = (m + MR - 1) / MR * MR;
+          a_panels = packed_a + pc * padded_m + ic * kc;
+        } else  // NOLINT
+        {
+          const Dtype* a_block =
+              trans_a ? (a + pc * lda + ic) : (a + ic * lda + pc);
+          gemm_pack_a(trans_a, mc, kc, a_block, lda, block_a);
+          a_panels = block_a;
+        }
+
+        for (int jr = 0; jr < nc; jr += NR) {
+          int cols = std::min(NR, nc - jr);
+          for (int ir = 0; ir < mc; ir += MR) {
+            int rows = std::min(MR, mc - ir);
+            gemm_micro_kernel(kc, a_panels + ir * kc, packed_b + jr * kc,
+                              acc);
+
+            Dtype* dst = c + (ic + ir) * ldc + jc + jr;
+            for (int i = 0; i < rows; i++) {
+              for (int j = 0; j < cols; j++) {
+                Dtype v = alpha * acc[i * NR + j];
+                if (cur_beta == Dtype(0)) {
+                  dst[i * ldc + j] = v;
+                } else  // NOLINT
+                {
+                  dst[i * ldc + j] = v + cur_beta * dst[i * ldc + j];
+                }
+              }
+            }
+          }
+        }
+      }
+    }
   }
-  return res;
 }
 
 template <typename Dtype>
-Dtype sum_arr(int n, const Dtype* src) {
-  Dtype res = 0;
-  for (int i = 0; i < n; i++) {
-    res += src[i];
+void gemm(std::false_type, bool trans_a, bool trans_b, int m, int n, int k,
+          Dtype alpha, const Dtype* a, int lda, const Dtype* b, int ldb,
+          Dtype beta, Dtype* c, int ldc) {
+  gemm_blocked<Dtype>(trans_a, trans_b, m, n, k, alpha, a, lda, nullptr,
+                      GemmBlocking::kKC, b, ldb, beta, c, ldc);
+}
+
+template <typename Dtype>
+void gemm(std::true_type, bool trans_a, bool trans_b, int m, int n, int k,
+          Dtype alpha, const Dtype* a, int lda, const Dtype* b, int ldb,
+          Dtype beta, Dtype* c, int ldc) {
+  if (m <= 0 || n <= 0 || k <= 0) {
+    // cblas rejects the leading dimensions of empty matrices
+    gemm(std::false_type(), trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb,
+         beta, c, ldc);
+    return;
   }
-  return res;
+  Blas<Dtype>::gemm(trans_a, trans_b, m, n, k, alpha, a, lda, b, ldb, beta, c,
+                    ldc);
 }
 
 template <typename Dtype>
-Dtype sum_squared_arr(int n, const Dtype* src) {
-  Dtype res = 0;
-  for (int i = 0; i < n; i++) {
-    res += src[i] * src[i];
+void gemv(std::false_type, bool trans_a, int m, int n, Dtype alpha,
+          const Dtype* a, int lda, const Dtype* x, Dtype beta, Dtype* y) {
+  if (!trans_a) {
+    for (int i = 0; i < m; i++) {
+      const Dtype* row = a + i * lda;
+      Dtype sum = 0;
+      for (int j = 0; j < n; j++) {
+        sum += row[j] * x[j];
+      }
+      y[i] = (beta == Dtype(0)) ? alpha * sum : alpha * sum + beta * y[i];
+    }
+    return;
+  }
+
+  if (beta == Dtype(0)) {
+    std::fill(y, y + n, Dtype(0));
+  } else if (beta != Dtype(1)) {
+    for (int j = 0; j < n; j++) {
+      y[j] *= beta;
+    }
+  }
+  for (int i = 0; i < m; i++) {
+    const Dtype* row = a + i * lda;
+    Dtype s = alpha * x[i];
+    for (int j = 0; j < n; j++) {
+      y[j] += s * row[j];
+    }
   }
-  return res;
 }
 
+template <typename Dtype>
+void gemv(std::true_type, bool trans_a, int m, int n, Dtype alpha,
+          const Dtype* a, int lda, const Dtype* x, Dtype beta, Dtype* y) {
+  if (m <= 0 || n <= 0) {
+    gemv(std::false_type(), trans_a, m, n, alpha, a, lda, x, beta, y);
+    return;
+  }
+  Blas<Dtype>::gemv(trans_a, m, n, alpha, a, lda, x, beta, y);
+}
+
+}  // namespace internal
+
 /**
- * dst[i] = src[i] - alpha
+ * General matrix multiplication for row major matrices.
+ *
+ * C = alpha * op(A) * op(B) + beta * C
+ *
+ * where op(A) is an m x k matrix and op(B) is a k x n matrix;
+ * op(X) is X if trans_x is false and X^T otherwise.
+ *
+ * If beta is 0, C is not read, so it can be uninitialized.
+ *
+ * For float and double it calls cblas_?gemm if a BLAS backend is
+ * enabled; see blas.hpp. Otherwise the in-tree implementation is
+ * used, which is cache blocked and uses a register tiled micro
+ * kernel; see internal::GemmBlocking.
+ *
+ * @param trans_a true to use A^T
+ * @param trans_b true to use B^T
+ * @param m number of rows of op(A) and C
+ * @param n number of columns of op(B) and C
+ * @param k number of columns of op(A) and rows of op(B)
+ * @param alpha scale for op(A)*op(B)
+ * @param a pointer to A
+ * @param lda leading dimension of A, i.e., distance between two rows
+ * @param b pointer to B
+ * @param ldb leading dimension of B
+ * @param beta scale for C
+ * @param c pointer to C
+ * @param ldc leading dimension of C
  */
 template <typename Dtype>
-void sub_scalar(Dtype alpha, const Array<Dtype>& src, Array<Dtype>* dst) {
-  for (int i = 0; i < src.total_; i++) {
-    dst->d_[i] = src.d_[i] - alpha;
-  }
+void gemm(bool trans_a, bool trans_b, int m, int n, int k, Dtype alpha,
+          const Dtype* a, int lda, const Dtype* b, int ldb, Dtype beta,
+          Dtype* c, int ldc) {
+  internal::gemm(internal::HasBlas<Dtype>(), trans_a, trans_b, m, n, k, alpha,
+                 a, lda, b, ldb, beta, c, ldc);
 }
 
 /**
- * dst[i] = src[i] - alpha
+ * General matrix vector multiplication for a row major matrix.
+ *
+ * y = alpha * op(A) * x + beta * y
+ *
+ * where A is an m x n matrix and op(A) is A if trans_a is false
+ * and A^T otherwise, i.e., x has n elements and y has m elements
+ * if trans_a is false, and the other way round otherwise.
+ *
+ * If beta is 0, y is not read, so it can be uninitialized.
+ *
+ * @param trans_a true to use A^T
+ * @param m number of rows of A
+ * @param n number of columns of A
+ * @param alpha scale for op(A)*x
+ * @param a pointer to A
+ * @param lda leading dimension of A
+ * @param x pointer to x
+ * @param beta scale for y
+ * @param y pointer to y
  */
 template <typename Dtype>
-void sub_scalar(int n, Dtype alpha, const Dtype* src, Dtype* dst) {
-  for (int i = 0; i < n; i++) {
-    dst[i] = src[i] - alpha;
+void gemv(bool trans_a, int m, int n, Dtype alpha, const Dtype* a, int lda,
+          const Dtype* x, Dtype beta, Dtype* y) {
+  internal::gemv(internal::HasBlas<Dtype>(), trans_a, m, n, alpha, a, lda, x,
+                 beta, y);
+}
+
+/**
+ * @return the number of elements of an m x k matrix packed by gemm_pack()
+ */
+inline int gemm_packed_size(int m, int k) {
+  static constexpr int MR = internal::GemmBlocking::kMR;
+  return (m + MR - 1) / MR * MR * k;
+}
+
+/**
+ * Pack op(A) for gemm_packed(), so that a matrix used in many
+ * products, e.g., the weight of a layer, is packed only once.
+ *
+ * The columns are split into blocks of kc columns, the last one
+ * possibly narrower, and every block is packed as gemm() packs it:
+ * panels of kMR rows, padded with 0, where the kMR elements of a
+ * column are contiguous. With M = m rounded up to a multiple of kMR,
+ * element (i, p) of block [pc, pc + w) is at
+ *
+ *    pc * M + (i / kMR) * kMR * w + (p - pc) * kMR + i % kMR
+ *
+ * @param trans_a true to pack A^T
+ * @param m number of rows of op(A)
+ * @param k number of columns of op(A)
+ * @param a pointer to A
+ * @param lda leading dimension of A
+ * @param kc number of columns of a block, usually kKC; a caller
+ *           may choose another one to align the blocks with its data
+ * @param packed gemm_packed_size(m, k) elements on return
+ */
+template <typename Dtype>
+void gemm_pack(bool trans_a, int m, int k, const Dtype* a, int lda, int kc,
+               Dtype* packed) {
+  static constexpr int MR = internal::GemmBlocking::kMR;
+  int padded_m = (m + MR - 1) / MR * MR;
+  for (int pc = 0; pc < k; pc += kc) {
+    const Dtype* block = trans_a ? (a + pc * lda) : (a + pc);
+    internal::gemm_pack_a(trans_a, m, std::min(kc, k - pc), block, lda,
+                          packed + pc * padded_m);
   }
 }
 
+/**
+ * gemm() with op(A) packed by gemm_pack() with blocks of kc columns.
+ *
+ * C = alpha * op(A) * op(B) + beta * C
+ *
+ * The packed layout is that of the in-tree kernel, so this always
+ * uses it, even if a BLAS backend is enabled; the layers then skip
+ * packing and call gemm() with the matrix as it is instead.
+ */
+template <typename Dtype>
+void gemm_packed(bool trans_b, int m, int n, int k, Dtype alpha,
+                 const Dtype* packed_a, int kc, const Dtype* b, int ldb,
+                 Dtype beta, Dtype* c, int ldc) {
+  internal::gemm_blocked<Dtype>(false, trans_b, m, n, k, alpha, nullptr, 0,
+                                packed_a, kc, b, ldb, beta, c, ldc);
+}
+
+namespace internal {
+
+/**
+ * Columns of C per chunk of a gemm() split over threads: at least
+ * min_cols and about kParallelGrain multiply-adds, rounded up to
+ * whole micro tiles.
+ */
+inline int gemm_grain(int m, int k, int min_cols) {
+  static constexpr int NR = GemmBlocking::kNR;
+  int cols = std::max(parallel_grain(int64_t(m) * k), min_cols);
+  return (cols + NR - 1) / NR * NR;
+}
+
+}  // namespace internal
+
+/**
+ * gemm() with the columns of C split over the threads of `pool`;
+ * it runs in the calling thread if `pool` is NULL. Every column
+ * is computed as gemm() computes it, so the result does not depend
+ * on the number of threads unless a BLAS backend is enabled, whose
+ * own threads should then be limited, e.g., OPENBLAS_NUM_THREADS=1.
+ */
+template <typename Dtype>
+void gemm(ThreadPool* pool, bool trans_a, bool trans_b, int m, int n, int k,
+          Dtype alpha, const Dtype* a, int lda, const Dtype* b, int ldb,
+          Dtype beta, Dtype* c, int ldc) {
+  // every chunk packs op(A) again, so it has to be wide enough
+  // to amortize it
+  int grain = internal::gemm_grain(m, k, 4 * internal::GemmBlocking::kNR);
+  parallel_for(pool, 0, n, grain, [&](int begin, int end) {
+    const Dtype* b_cols = trans_b ? (b + begin * ldb) : (b + begin);
+    gemm<Dtype>(trans_a, trans_b, m, end - begin, k, alpha, a, lda, b_cols,
+                ldb, beta, c + begin, ldc);
+  });
+}
+
+/**
+ * gemm_packed() with the columns of C split over the threads of
+ * `pool`, see gemm(ThreadPool*, ...); op(A) is packed already,
+ * so a chunk can be as narrow as a micro tile.
+ */
+template <typename Dtype>
+void gemm_packed(ThreadPool* pool, bool trans_b, int m, int n, int k,
+                 Dtype alpha, const Dtype* packed_a, int kc, const Dtype* b,
+                 int ldb, Dtype beta, Dtype* c, int ldc) {
+  int grain = internal::gemm_grain(m, k, 1);
+  parallel_for(pool, 0, n, grain, [&](int begin, int end) {
+    const Dtype* b_cols = trans_b ? (b + begin * ldb) : (b + begin);
+    gemm_packed<Dtype>(trans_b, m, end - begin, k, alpha, packed_a, kc, b_cols,
+                       ldb, beta, c + begin, ldc);
+  });
+}
+
 }  // namespace cnn
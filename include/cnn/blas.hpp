@@ -0,0 +1,102 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+#if defined(CNN_USE_MKL)
+#include <mkl_cblas.h>
+#elif defined(CNN_USE_OPENBLAS)
+#include <cblas.h>
+#endif
+
+namespace cnn {
+
+/**
+ * The BLAS backend of array_math.hpp.
+ *
+ * CMake looks for MKL and then OpenBLAS at configure time and
+ * defines CNN_USE_MKL or CNN_USE_OPENBLAS if one is found; see
+ * cmake/blas.cmake. Pass -DCNN_USE_BLAS=OFF to disable it. The backend
+ * then provides the operations below for float and double through
+ * cblas. For other types, e.g., Jet, and without a BLAS library,
+ * kEnabled is false and array_math.hpp uses its portable kernels.
+ *
+ * All matrices are row major; see gemm() and gemv() in
+ * array_math.hpp for the meaning of the arguments.
+ */
+template <typename Dtype>
+struct Blas {
+  static constexpr bool kEnabled = false;
+};
+
+#if defined(CNN_USE_MKL) || defined(CNN_USE_OPENBLAS)
+
+template <>
+struct Blas<float> {
+  static constexpr bool kEnabled = true;
+
+  static float dot(int n, const float* x, const float* y) {
+    return cblas_sdot(n, x, 1, y, 1);
+  }
+
+  static void axpby(int n, float alpha, const float* x, float beta, float* y) {
+    cblas_saxpby(n, alpha, x, 1, beta, y, 1);
+  }
+
+  static void gemv(bool trans_a, int m, int n, float alpha, const float* a,
+                   int lda, const float* x, float beta, float* y) {
+    cblas_sgemv(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans, m, n,
+                alpha, a, lda, x, 1, beta, y, 1);
+  }
+
+  static void gemm(bool trans_a, bool trans_b, int m, int n, int k,
+                   float alpha, const float* a, int lda, const float* b,
+                   int ldb, float beta, float* c, int ldc) {
+    cblas_sgemm(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans,
+                trans_b ? CblasTrans : CblasNoTrans, m, n, k, alpha, a, lda,
+                b, ldb, beta, c, ldc);
+  }
+};
+
+template <>
+struct Blas<double> {
+  static constexpr bool kEnabled = true;
+
+  static double dot(int n, const double* x, const double* y) {
+    return cblas_ddot(n, x, 1, y, 1);
+  }
+
+  static void axpby(int n, double alpha, const double* x, double beta,
+                    double* y) {
+    cblas_daxpby(n, alpha, x, 1, beta, y, 1);
+  }
+
+  static void gemv(bool trans_a, int m, int n, double alpha, const double* a,
+                   int lda, const double* x, double beta, double* y) {
+    cblas_dgemv(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans, m, n,
+                alpha, a, lda, x, 1, beta, y, 1);
+  }
+
+  static void gemm(bool trans_a, bool trans_b, int m, int n, int k,
+                   double alpha, const double* a, int lda, const double* b,
+                   int ldb, double beta, double* c, int ldc) {
+    cblas_dgemm(CblasRowMajor, trans_a ? CblasTrans : CblasNoTrans,
+                trans_b ? CblasTrans : CblasNoTrans, m, n, k, alpha, a, lda,
+                b, ldb, beta, c, ldc);
+  }
+};
+
+#endif
+
+}  // namespace cnn
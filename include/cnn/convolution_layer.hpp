@@ -17,13 +17,92 @@
 
 #include <vector>
 
+#include "cnn/fft.hpp"
 #include "cnn/layer.hpp"
+#include "cnn/winograd.hpp"
 
 namespace cnn {
 /**
  * One input bottom[0] with shape (N, C, H, W)
- * and one output top[0] with shape (N, num_output, H, W)
+ * and one output top[0] with shape (N, num_output, H', W'), where
  *
+ *    H' = (H + 2*pad_h - dilation*(K - 1) - 1) / stride + 1
+ *    W' = (W + 2*pad_w - dilation*(K - 1) - 1) / stride + 1
+ *
+ * for a kernel of size K. With the default stride 1, dilation 1
+ * and padding K/2, the output has the same size as the input.
+ *
+ * The channels can be split into G groups: output channel i of
+ * group g = i / (num_output/G) reads only the C/G input channels
+ * of group g, so the weight has shape (num_output, C/G, K, K).
+ * G == C is the depthwise convolution.
+ *
+ * The forward pass is computed by the algorithm selected in
+ * ConvolutionLayerProto:
+ *
+ *  - DIRECT: convolve directly, several outputs and columns at a
+ *    time; see fprop_direct_block(). There is no extra memory and
+ *    no lowering, so it suits small channel counts and batch size 1.
+ *    Its backward pass is a simple reference implementation.
+ *    Kernel sizes 1, 3, 5 and 7 use kernels instantiated for that
+ *    size, with the loops over the taps unrolled by the compiler.
+ *
+ *  - IM2COL_GEMM: lower the input to a matrix of shape
+ *    (C*K*K, N*H'*W'), and multiply
+ *    it by the weight of shape (num_output, C*K*K) with gemm().
+ *    The batch is folded into the columns of the matrix. Every
+ *    group is a separate gemm on a block of rows of both matrices.
+ *    For depthwise convolutions, the lowered matrix is K*K times
+ *    larger than the input for only 2*K*K flops per element, so
+ *    dedicated kernels are used instead; see fprop_depthwise().
+ *    For 1x1 kernels without padding and stride, the lowered matrix
+ *    of a sample is the sample itself, so the gemm reads the bottom
+ *    directly; see fprop_pointwise().
+ *
+ *  - WINOGRAD_2X2, WINOGRAD_4X4: Winograd F(2x2, 3x3) and F(4x4, 3x3);
+ *    see Winograd. The transformed kernels are cached until
+ *    param_version() changes. Only kernel size 3 with the default
+ *    stride, padding and dilation and one group is supported;
+ *    other layers use IM2COL_GEMM instead.
+ *
+ *  - FFT: convolution in the frequency domain; see FFTConvolution.
+ *    Like Winograd, it requires the default stride, padding and
+ *    dilation and one group.
+ *    Its cost does not depend on the kernel size, so it pays off
+ *    for large kernels. reshape() estimates with
+ *    FFTConvolution::is_faster_than_gemm() whether it is faster than
+ *    IM2COL_GEMM for the given shape and uses IM2COL_GEMM otherwise.
+ *    The kernel spectra are cached until param_version() changes.
+ *
+ *  - AUTO: Network::reshape() measures the algorithms above and
+ *    selects the fastest one with set_algorithm().
+ *
+ * The forward passes of DIRECT and IM2COL_GEMM read the weight
+ * packed by gemm_pack(), which is the only packed_param();
+ * see pack_param(). With a BLAS backend, IM2COL_GEMM passes the
+ * weight as it is to cblas instead and packed_param() is empty
+ * unless the algorithm is DIRECT. The backward passes use the
+ * weight as it is.
+ *
+ * DIRECT and IM2COL_GEMM support any stride, padding, dilation
+ * and group.
+ *
+ * For IM2COL_GEMM, the backward pass is split into two kernels
+ * that never write to the same memory:
+ *
+ *  - the weight gradient dW += dY * col^T, where dY is the top
+ *    gradient as a matrix of shape (num_output, N*H'*W');
+ *
+ *  - the bottom gradient, computed as dcol = W^T * dY followed
+ *    by col2im(), which accumulates dcol into the bottom gradient
+ *    one sample at a time.
+ *
+ * For Winograd, the weight gradient is computed in the same way and
+ * the bottom gradient is a Winograd convolution of the top gradient
+ * with the kernels rotated by 180 degrees.
+ *
+ * For FFT, both gradients are computed in the frequency domain
+ * from the spectra of the bottom and the top gradient.
  */
 template <typename Dtype>
 class ConvolutionLayer : public Layer<Dtype> {
@@ -43,17 +122,287 @@ class ConvolutionLayer : public Layer<Dtype> {
              const std::vector<const Array<Dtype>*>& top,
              const std::vector<const Array<Dtype>*>& top_gradient) override;
 
+  /** the algorithm in use; it is never AUTO */
+  ConvolutionLayerProto::Algorithm algorithm() const { return algorithm_; }
+
+  /**
+   * Change the algorithm. reshape() has to be called before the
+   * next fprop() or bprop(). Unsupported algorithms are replaced
+   * by IM2COL_GEMM.
+   */
+  void set_algorithm(ConvolutionLayerProto::Algorithm algorithm);
+
+  /** @return false if the algorithm does not support this layer */
+  bool supports(ConvolutionLayerProto::Algorithm algorithm) const;
+
+  int stride() const { return stride_; }
+  int pad_h() const { return pad_h_; }
+  int pad_w() const { return pad_w_; }
+  int dilation() const { return dilation_; }
+  int group() const { return group_; }
+
+  /** @return true if the output has the same size as the input */
+  bool is_same_convolution() const;
+
+  /** @return H' for an input of the given height */
+  int output_height(int height) const;
+
+  /** @return W' for an input of the given width */
+  int output_width(int width) const;
+
  private:
-  void one_channel_convolution(const Dtype* weight, const Dtype* src,
-                               int height, int width, Dtype* dst);
+  /**
+   * Pack the weight of every group, a matrix of shape
+   * (num_output/G, C/G*K*K), with gemm_pack() in blocks of
+   * packed_kc() columns. The packed groups are concatenated,
+   * each taking gemm_packed_size() elements.
+   */
+  void pack_param() override;
+
+  /**
+   * @return the number of columns of a block of the packed weight
+   *         with k columns; it is a multiple of K*K, so that the taps
+   *         of a channel are in the same block, and at most kKC
+   *         unless K*K is larger
+   */
+  int packed_kc(int k) const;
+
+  /**
+   * @return the first tap of channel c in the given panel of the
+   *         packed weight of a group; the kDirectOutputs scales of
+   *         a tap are contiguous and so are the taps of a channel.
+   */
+  const Dtype* packed_kernel(const Dtype* weight, int group_channels,
+                             int panel, int c) const;
+
+  /**
+   * @return the weight packed by pack_param(); it is packed again
+   *         if the parameters have changed.
+   */
+  const Dtype* packed_weight();
 
+  /**
+   * @return true if fprop() reads packed_weight(), i.e., for DIRECT,
+   *         whose kernels depend on the packed layout, and for the
+   *         gemm based algorithms unless a BLAS backend is enabled
+   */
+  bool uses_packed_weight() const;
+
+  /**
+   * C = W_g * B + beta * C, where W_g is the weight of group g,
+   * B is a matrix with C/G*K*K rows and n columns and C has
+   * num_output/G rows and n columns. It uses gemm_packed() with
+   * packed_weight(), or gemm() with the weight as it is if
+   * uses_packed_weight() is false.
+   */
+  void weight_gemm(int g, int n, const Dtype* b, Dtype beta, Dtype* c);
+
+  void fprop_direct(const Array<Dtype>& bottom, Array<Dtype>* top);
+
+  /**
+   * Direct convolution for B outputs starting at first_output of
+   * sample n, whose group starts at input channel first_channel.
+   * K is the kernel size, so that the loops over the taps can be
+   * unrolled, or 0 for any kernel size.
+   *
+   * weight points to the packed weight of the group; the B outputs
+   * are one of its panels, see packed_kernel().
+   *
+   * The interior columns, whose taps are all inside the image, are
+   * computed in blocks of B outputs x kDirectColumns columns kept in
+   * registers while all input channels and taps are accumulated.
+   * The border columns are computed one at a time with the range
+   * of valid taps computed per column; rows outside the image are
+   * skipped per output row. No tap is checked individually.
+   *
+   * The top has to be initialized with the bias.
+   */
+  template <int B, int K>
+  void fprop_direct_block(const Array<Dtype>& bottom, int n,
+                          int first_channel, int first_output,
+                          const Dtype* weight, Array<Dtype>* top);
+
+  /**
+   * Set direct_kernels_ and direct_bprop_ for kernel size K,
+   * or for any kernel size if K is 0.
+   */
+  template <int K>
+  void select_direct_kernels();
+  void fprop_im2col_gemm(const Array<Dtype>& bottom, Array<Dtype>* top);
+
+  template <int M>
+  void fprop_winograd(const Array<Dtype>& bottom, Array<Dtype>* top);
+  void fprop_fft(const Array<Dtype>& bottom, Array<Dtype>* top);
+
+  /**
+   * 1x1 convolution with stride 1 and no padding for IM2COL_GEMM.
+   *
+   * Sample n of the bottom is a matrix X of shape (C, H*W), so
+   * Y = W * X is computed with one gemm per sample and group
+   * without im2col(). In bprop, dW += dY * X^T and dX += W^T * dY
+   * are accumulated into the gradients directly.
+   */
+  void fprop_pointwise(const Array<Dtype>& bottom, Array<Dtype>* top);
+
+  /**
+   * Depthwise convolution, i.e., G == C, for IM2COL_GEMM.
+   *
+   * Output channel o convolves input channel o / (num_output/C)
+   * directly, one output row at a time: every tap of the kernel is
+   * added to the row with a unit-stride loop over the columns whose
+   * input pixels are inside the image, so there are no branches in
+   * the inner loop and the row stays in the cache.
+   */
+  void fprop_depthwise(const Array<Dtype>& bottom, Array<Dtype>* top);
+
+  void bprop_direct(const Array<Dtype>& bottom,
+                    const Array<Dtype>& top_gradient,
+                    Array<Dtype>* bottom_gradient);
+  void bprop_im2col_gemm(const Array<Dtype>& bottom,
+                         const Array<Dtype>& top_gradient,
+                         Array<Dtype>* bottom_gradient);
+  template <int M>
+  void bprop_winograd(const Array<Dtype>& bottom,
+                      const Array<Dtype>& top_gradient,
+                      Array<Dtype>* bottom_gradient);
+  void bprop_fft(const Array<Dtype>& bottom, const Array<Dtype>& top_gradient,
+                 Array<Dtype>* bottom_gradient);
+  void bprop_pointwise(const Array<Dtype>& bottom,
+                       const Array<Dtype>& top_gradient,
+                       Array<Dtype>* bottom_gradient);
+  void bprop_depthwise(const Array<Dtype>& bottom,
+                       const Array<Dtype>& top_gradient,
+                       Array<Dtype>* bottom_gradient);
+
+  /**
+   * Compute the gradient for the weight and the bias with gemm.
+   *
+   * The threads split the columns of the weight gradient. If it has
+   * too few columns for that, e.g., for a first layer with one input
+   * channel, the samples are split into weight_gradient_parts_
+   * blocks instead, whose gradients are computed in partial_dw_ and
+   * then added in order. The blocks depend only on the shape, so the
+   * result does not depend on the number of threads.
+   *
+   * @return the top gradient as a matrix of shape (num_output, N*H'*W')
+   */
+  const Dtype* param_gradient(const Array<Dtype>& bottom,
+                              const Array<Dtype>& top_gradient);
+
+  /**
+   * Gradient for the weight from samples [n_begin, n_end).
+   *
+   * dw = beta * dw + dy[:, cols] * col[:, cols]^T
+   *
+   * where cols are the columns of the samples in the range;
+   * with more than one group, it is computed for every group
+   * from the rows of dy and col of that group.
+   *
+   * @param dy top gradient of shape (num_output, N*H'*W')
+   * @param col output of im2col() of shape (C*K*K, N*H'*W')
+   * @param num_pixels H'*W'
+   * @param num_cols N*H'*W'
+   * @param n_begin first sample, inclusive
+   * @param n_end last sample, exclusive
+   * @param beta scale for dw
+   * @param dw weight gradient of shape (num_output, C/G*K*K)
+   */
+  void weight_gradient(const Dtype* dy, const Dtype* col, int num_pixels,
+                       int num_cols, int n_begin, int n_end, Dtype beta,
+                       Dtype* dw);
+
+  /**
+   * @return the number of sample blocks of param_gradient() for
+   *         n samples, num_cols = N*H'*W' and k = C/G*K*K; 1 if the
+   *         columns of the weight gradient are split instead
+   */
+  int weight_gradient_parts(int n, int num_cols, int k) const;
+
+  /**
+   * Lower the bottom to a matrix of shape (C*K*K, N*H'*W').
+   *
+   * Row (c*K + i)*K + j contains the pixels of channel c that
+   * are multiplied with weight(c, i, j) for every output pixel;
+   * pixels outside the image are 0.
+   */
+  void im2col(const Array<Dtype>& bottom, Dtype* col);
+
+  /**
+   * The inverse of im2col(): every element in col is added
+   * to the bottom gradient pixel it was copied from.
+   */
+  void col2im(const Dtype* col, Array<Dtype>* bottom_gradient);
+
+  /**
+   * Gradients of DIRECT for one (output, input) channel pair.
+   * K is the kernel size or 0 for any kernel size; see
+   * fprop_direct_block().
+   */
+  template <int K>
   void one_channel_bprop(const Dtype* weight, const Dtype* bottom, int height,
-                         int width, const Dtype* top_gradient,
-                         Dtype* bottom_gradient, Dtype* param_gradient);
+                         int width, int out_height, int out_width,
+                         const Dtype* top_gradient, Dtype* bottom_gradient,
+                         Dtype* param_gradient);
 
  private:
+  //!< number of outputs computed together by fprop_direct()
+  static constexpr int kDirectOutputs = 4;
+  //!< number of columns computed together by fprop_direct()
+  static constexpr int kDirectColumns = 8;
+  //!< the most sample blocks of param_gradient()
+  static constexpr int kWeightGradientParts = 8;
+
+  using DirectKernel = void (ConvolutionLayer::*)(const Array<Dtype>&, int,
+                                                  int, int, const Dtype*,
+                                                  Array<Dtype>*);
+  using DirectBprop = void (ConvolutionLayer::*)(const Dtype*, const Dtype*,
+                                                 int, int, int, int,
+                                                 const Dtype*, Dtype*, Dtype*);
+
   int num_output_;
   int kernel_size_;
+  int stride_;
+  int pad_h_;
+  int pad_w_;
+  int dilation_;
+  int group_;
+  ConvolutionLayerProto::Algorithm algorithm_;
+
+  //!< fprop_direct_block<B, K>() at index B - 1, selected in reshape()
+  DirectKernel direct_kernels_[kDirectOutputs];
+  DirectBprop direct_bprop_;  //!< one_channel_bprop<K>()
+
+  Array<Dtype> col_;  //!< im2col() of the bottom, (1, 1, C*K*K, N*H'*W')
+
+  /** gemm output in fprop and the reordered top gradient in bprop;
+   * it has shape (1, 1, num_output, N*H'*W') and is used only for N > 1
+   */
+  Array<Dtype> gemm_top_;
+
+  int weight_gradient_parts_;  //!< see param_gradient()
+  //!< weight gradient of every sample block, (parts, 1, 1, size of dW)
+  Array<Dtype> partial_dw_;
+
+  Array<Dtype> winograd_weight_;  //!< transformed kernels for fprop
+  Array<Dtype> winograd_flipped_weight_;  //!< for the bottom gradient
+  int winograd_weight_version_;
+  int winograd_flipped_weight_version_;
+
+  Array<Dtype> winograd_v_;  //!< transformed input tiles
+  Array<Dtype> winograd_m_;  //!< output tiles before the output transform
+
+  FFTConvolution<Dtype> fft_;
+  bool use_fft_;  //!< false if FFT is selected but IM2COL_GEMM is faster
+  bool use_depthwise_;  //!< true to use fprop_depthwise() for IM2COL_GEMM
+  bool use_pointwise_;  //!< true to use fprop_pointwise() for IM2COL_GEMM
+
+  Array<Dtype> fft_weight_;          //!< kernel spectra for fprop
+  Array<Dtype> fft_flipped_weight_;  //!< for the bottom gradient
+  int fft_weight_version_;
+  int fft_flipped_weight_version_;
+
+  Array<Dtype> fft_x_;  //!< spectra of the bottom or its gradient
+  Array<Dtype> fft_y_;  //!< spectra of the top or its gradient
 };
 
 }  // namespace cnn
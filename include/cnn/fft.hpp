@@ -0,0 +1,261 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+#include <vector>
+
+#include "cnn/array.hpp"
+
+namespace cnn {
+
+/**
+ * One dimensional complex discrete Fourier transform
+ *
+ *    X[k] = sum_j x[j] * exp(-2*pi*i*j*k/n)
+ *
+ * computed by a mixed radix Cooley-Tukey FFT. The size must be
+ * of the form 2^a * 3^b * 5^c; use good_size() to find one.
+ *
+ * The real and imaginary parts are stored in separate arrays
+ * so that it works with Jet.
+ */
+template <typename Dtype>
+class FFT {
+ public:
+  FFT() : n_(0) {}
+  void init(int n);
+
+  int size() const { return n_; }
+
+  /**
+   * Transform n elements.
+   *
+   * @param in_re real part of the input, in_re[j * stride]
+   * @param in_im imaginary part of the input, in_im[j * stride];
+   *              NULL if the input is real
+   * @param stride distance between two input elements
+   * @param inverse true to compute the inverse transform
+   *                without dividing the result by n
+   * @param out_re real part of the output, contiguous
+   * @param out_im imaginary part of the output, contiguous
+   */
+  void transform(const Dtype* in_re, const Dtype* in_im, int stride,
+                 bool inverse, Dtype* out_re, Dtype* out_im) const;
+
+  /**
+   * @return the smallest number >= n of the form 2^a * 3^b * 5^c
+   */
+  static int good_size(int n);
+
+ private:
+  void transform(int n, int level, const Dtype* in_re, const Dtype* in_im,
+                 int stride, bool inverse, Dtype* out_re,
+                 Dtype* out_im) const;
+
+ private:
+  int n_;
+  std::vector<int> factors_;  //!< the radix of every level
+  std::vector<Dtype> cos_;    //!< cos(2*pi*j/n)
+  std::vector<Dtype> sin_;    //!< sin(2*pi*j/n)
+};
+
+/**
+ * Convolution with stride 1 and implicit zero padding, i.e., the
+ * output has the same size as the input, computed in the frequency
+ * domain.
+ *
+ * An image of H x W pixels is padded to Ph x Pw, where
+ * Ph >= H + K/2 and Pw >= W + K/2 for a kernel of size K, so
+ * that the circular convolution does not wrap around into the
+ * output pixels. The kernel is placed around the origin so that
+ * the output starts at pixel (0, 0) of the inverse transform.
+ *
+ * Since the images are real, only Q = Pw/2 + 1 columns of the
+ * spectrum are kept. Two rows are transformed with one complex FFT.
+ *
+ * A spectrum has S = Q * Ph complex values, stored as S real parts
+ * followed by S imaginary parts. The output spectrum of channel k is
+ *
+ *    Y_k = sum_c X_c .* U_kc
+ *
+ * where X_c is the spectrum of input channel c and U_kc is the
+ * spectrum of the kernel between them. The kernel spectra depend
+ * only on the parameters, so they are computed once and shared
+ * by all samples in the batch.
+ *
+ * It costs O((C + K) * Ph * Pw * log(Ph * Pw)) for the transforms
+ * and 8 * C * K * S flops for the products per sample, independent
+ * of the kernel size, compared with 2 * C * K * H * W * kernel_size^2
+ * for the direct convolution.
+ */
+template <typename Dtype>
+class FFTConvolution {
+ public:
+  FFTConvolution()
+      : height_(0), width_(0), kernel_size_(0), ph_(0), pw_(0), q_(0) {}
+
+  /**
+   * Prepare the transforms for images of height x width pixels.
+   * Nothing is done if the sizes are unchanged.
+   */
+  void init(int height, int width, int kernel_size);
+
+  int padded_height() const { return ph_; }
+  int padded_width() const { return pw_; }
+
+  /**
+   * @return the number of complex values in a spectrum
+   */
+  int spectrum_size() const { return q_ * ph_; }
+
+  /**
+   * Transform the kernels.
+   *
+   * @param weight kernels with shape (num_output, C, K, K)
+   * @param flip false to transform the kernels for the forward pass.
+   *             true to transform the kernels for the gradient of
+   *             the input, i.e., to swap the input and output
+   *             channels and rotate the kernels by 180 degrees.
+   * @param u on return it has shape (num_output, C, 2, S),
+   *          or (C, num_output, 2, S) if flip is true.
+   */
+  void transform_weight(const Array<Dtype>& weight, bool flip,
+                        Array<Dtype>* u) const;
+
+  /**
+   * Spectra of all channels of the input.
+   *
+   * @param in input with shape (N, C, H, W)
+   * @param x on return it contains N * C spectra, i.e.,
+   *          N * C * 2 * S elements
+   */
+  void forward(const Array<Dtype>& in, Dtype* x) const;
+
+  /**
+   * y[n][k] = sum_c x[n][c] .* u[k][c]
+   *
+   * @param x N * C spectra
+   * @param num_samples N, the number of samples
+   * @param u output of transform_weight() with shape (K, C, 2, S)
+   * @param y on return it contains N * K spectra
+   */
+  void multiply(const Dtype* x, int num_samples, const Array<Dtype>& u,
+                Dtype* y) const;
+
+  /**
+   * out[n][k] = ifft(y[n][k]) + bias[k]
+   *
+   * @param y N * K spectra; it is overwritten
+   * @param bias NULL or an array of K elements added to the output
+   * @param accumulate true to add the result to out;
+   *                   false to overwrite out
+   * @param out output with shape (N, K, H, W)
+   */
+  void inverse(Dtype* y, const Dtype* bias, bool accumulate,
+               Array<Dtype>* out) const;
+
+  /**
+   * Convolve the input with the transformed kernels, i.e.,
+   * forward(), multiply() and inverse().
+   *
+   * @param in input with shape (N, C, H, W)
+   * @param u output of transform_weight() with shape (K, C, 2, S)
+   * @param bias NULL or an array of K elements added to the output
+   * @param accumulate true to add the result to out;
+   *                   false to overwrite out
+   * @param x buffer with N * C * 2 * S elements
+   * @param y buffer with N * K * 2 * S elements
+   * @param out output with shape (N, K, H, W)
+   */
+  void convolve(const Array<Dtype>& in, const Array<Dtype>& u,
+                const Dtype* bias, bool accumulate, Dtype* x, Dtype* y,
+                Array<Dtype>* out) const;
+
+  /**
+   * Gradient for the kernels. The correlation of input channel c
+   * and output channel k is computed as
+   *
+   *    ifft(sum_n x[n][c] .* conj(dy[n][k]))
+   *
+   * and its K x K pixels around the origin are added to dw(k, c).
+   *
+   * @param x spectra of the input, see forward()
+   * @param dy spectra of the top gradient, see forward()
+   * @param num_samples N, the number of samples
+   * @param dw gradient with shape (K, C, kernel_size, kernel_size)
+   */
+  void weight_gradient(const Dtype* x, const Dtype* dy, int num_samples,
+                       Array<Dtype>* dw) const;
+
+  /** how many times faster gemm is than convolve() per flop */
+  static constexpr int kGemmSpeedup = 4;
+
+  /**
+   * A rough estimate whether convolve() is faster than im2col + gemm.
+   *
+   * It compares the flops of the two methods, with the gemm
+   * counted kGemmSpeedup times cheaper per flop since it runs
+   * much closer to the peak of the processor.
+   */
+  static bool is_faster_than_gemm(int num_input, int height, int width,
+                                  int num_output, int kernel_size);
+
+ private:
+  /**
+   * Spectrum of an image of height x width pixels, which are
+   * padded with zeros to Ph x Pw.
+   *
+   * @param src the image; row i starts at src[i * src_stride]
+   * @param dst S real parts followed by S imaginary parts
+   */
+  void forward(const Dtype* src, int height, int width, int src_stride,
+               Dtype* dst) const;
+
+  /**
+   * Inverse transform of some rows of a spectrum.
+   *
+   * @param src the spectrum; it is overwritten
+   * @param rows indices of the rows to compute
+   * @param dst on return row i contains the Pw pixels of rows[i]
+   */
+  void inverse(Dtype* src, const std::vector<int>& rows, Dtype* dst) const;
+
+ private:
+  int height_;
+  int width_;
+  int kernel_size_;
+  int ph_;  //!< padded height
+  int pw_;  //!< padded width
+  int q_;   //!< number of columns of the spectrum, pw_/2 + 1
+
+  FFT<Dtype> row_fft_;  //!< FFT with pw_ points
+  FFT<Dtype> col_fft_;  //!< FFT with ph_ points
+
+  std::vector<int> output_rows_;  //!< 0, 1, ..., height_ - 1
+  std::vector<int> kernel_rows_;  //!< rows -K/2, ..., K/2 modulo ph_
+
+  // scratch buffers of size max(ph_, pw_)
+  mutable std::vector<Dtype> in_re_;
+  mutable std::vector<Dtype> in_im_;
+  mutable std::vector<Dtype> out_re_;
+  mutable std::vector<Dtype> out_im_;
+
+  mutable std::vector<Dtype> rows_;      //!< output of inverse()
+  mutable std::vector<Dtype> spectrum_;  //!< one spectrum, 2 * S
+};
+
+}  // namespace cnn
+
+#include "../../src/fft.cpp"
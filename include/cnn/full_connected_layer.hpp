@@ -29,6 +29,18 @@ namespace cnn {
  *
  * param[0] contains weight parameters for inner product
  * and param[1] contains corresponding biases.
+ *
+ * With the bottom viewed as a matrix X of shape (N, K) and
+ * the weight as W of shape (M, K), fprop computes
+ * Y = X * W^T + b and bprop accumulates dW += dY^T * X and
+ * dX += dY * W, each with one call to gemm(). fprop computes
+ * Y^T = W * X^T with the weight packed once by gemm_pack(),
+ * which is the only packed_param(). With a BLAS backend, the
+ * weight is passed as it is to cblas and nothing is packed.
+ *
+ * Batches smaller than kGemmBatch use dot products and axpy
+ * instead, since the register tiles of gemm() would be mostly
+ * padding and packing the weight would dominate.
  */
 template <typename Dtype>
 class FullConnectedLayer : public Layer<Dtype> {
@@ -49,7 +61,34 @@ class FullConnectedLayer : public Layer<Dtype> {
              const std::vector<const Array<Dtype>*>& top_gradient) override;
 
  private:
+  void fprop_small_batch(const Array<Dtype>& bottom, Array<Dtype>* top);
+  void fprop_gemm(const Array<Dtype>& bottom, Array<Dtype>* top);
+
+  void bprop_small_batch(const Array<Dtype>& bottom,
+                         const Array<Dtype>& top_gradient,
+                         Array<Dtype>* bottom_gradient);
+  void bprop_gemm(const Array<Dtype>& bottom, const Array<Dtype>& top_gradient,
+                  Array<Dtype>* bottom_gradient);
+
+  /**
+   * Pack the weight with gemm_pack() for fprop_gemm(); it does
+   * nothing if a BLAS backend is enabled.
+   */
+  void pack_param() override;
+
+  /**
+   * @return the weight packed by pack_param(); it is packed again
+   *         if the parameters have changed.
+   */
+  const Dtype* packed_weight();
+
+ private:
+  //!< the smallest batch size that uses gemm()
+  static constexpr int kGemmBatch = 4;
+
   int num_output_;
+
+  Array<Dtype> gemm_top_;  //!< Y^T of shape (1, 1, M, N) for gemm()
 };
 
 }  // namespace cnn
@@ -21,8 +21,18 @@
 
 #include "cnn/array.hpp"
 #include "cnn/array_math.hpp"
+#include "cnn/thread_pool.hpp"
 
 namespace cnn {
+
+/**
+ * One SGD step over n parameters; the gradient and the history
+ * are updated in place. See Layer::update_parameters().
+ */
+template <typename Dtype>
+void sgd_update(int n, Dtype learning_rate, Dtype* param, Dtype* gradient,
+                Dtype* history);
+
 /**
  *
  * Every layer MUST implement the following functions
@@ -39,7 +49,12 @@ class Layer {
   const LayerProto& proto() const { return proto_; }
   LayerProto& proto() { return proto_; }
 
+  /**
+   * The caller may change the parameters through the returned
+   * pointers, so it increases param_version().
+   */
   std::vector<Array<Dtype>*> mutable_param() {
+    param_version_++;
     std::vector<Array<Dtype>*> res;
     for (int i = 0; i < param_.size(); i++) {
       res.push_back(param_[i].get());
@@ -71,6 +86,31 @@ class Layer {
     return res;
   }
 
+  /**
+   * It is increased whenever the parameters may have been changed,
+   * i.e., by mutable_param(), copy_trained_layer() and
+   * update_parameters(). Layers that cache values derived from the
+   * parameters compare it with the version they cached.
+   */
+  int param_version() const { return param_version_; }
+
+  /**
+   * The parameters in the layout used by fprop(), e.g., packed
+   * for gemm_packed(); it is empty if the layer has none.
+   *
+   * They are computed by pack_param() once per param_version(),
+   * i.e., once after copy_trained_layer() and once per
+   * update_parameters(), unless they are loaded from the proto.
+   */
+  std::vector<const Array<Dtype>*> packed_param() {
+    update_packed_param();
+    std::vector<const Array<Dtype>*> res;
+    for (int i = 0; i < packed_param_.size(); i++) {
+      res.push_back(packed_param_[i].get());
+    }
+    return res;
+  }
+
   void clear_gradient() {
     for (auto& g : gradient_) {
       if (g) {
@@ -83,6 +123,24 @@ class Layer {
 
   void update_parameters(int current_iter, double current_learning_rate);
 
+  /**
+   * Tell the layer that its parameters have been changed in place,
+   * e.g., by Network::update_parameters() over the arena.
+   */
+  void param_changed() {
+    param_version_++;
+    update_packed_param();
+  }
+
+  /**
+   * Let fprop() and bprop() split their loops over the threads of
+   * `pool`, which has to outlive the layer; NULL (the default) to
+   * run them in the calling thread. The result does not depend on
+   * the number of threads.
+   */
+  void set_thread_pool(ThreadPool* pool) { thread_pool_ = pool; }
+  ThreadPool* thread_pool() const { return thread_pool_; }
+
   /**
    * At layer construction, we have no idea of the shape of its inputs,
    * so this function MUST be called after constructing the whole network.
@@ -106,6 +164,36 @@ class Layer {
                      const std::vector<const Array<Dtype>*>& top,
                      const std::vector<const Array<Dtype>*>& top_gradient) = 0;
 
+ protected:
+  /**
+   * Compute packed_param_ from param_; layers whose fprop()
+   * uses a packed layout override it.
+   */
+  virtual void pack_param() {}
+
+  /**
+   * Call pack_param() if packed_param_ is older than param_.
+   */
+  void update_packed_param() {
+    if (packed_param_version_ != param_version_) {
+      pack_param();
+      packed_param_version_ = param_version_;
+    }
+  }
+
+  /**
+   * @return the data of the only packed_param_ after
+   *         update_packed_param(); it fails if it does not have
+   *         `total` elements, e.g., if it was saved by a build with
+   *         another gemm blocking
+   */
+  const Dtype* packed_param_data(int total);
+
+  /**
+   * Load packed_param_ from a proto whose param was just loaded.
+   */
+  void load_packed_param(const LayerProto& p);
+
  protected:
   std::vector<std::shared_ptr<Array<Dtype>>> param_;
   std::vector<std::shared_ptr<Array<Dtype>>> gradient_;
@@ -113,6 +201,13 @@ class Layer {
 
   LayerProto proto_;
 
+  int param_version_;
+
+  std::vector<std::shared_ptr<Array<Dtype>>> packed_param_;
+  int packed_param_version_;  //!< param_version_ of packed_param_
+
+  ThreadPool* thread_pool_;  //!< see set_thread_pool()
+
  private:
   Layer(const Layer<Dtype>&) = delete;
   Layer& operator=(const Layer<Dtype>&) = delete;
@@ -62,6 +62,7 @@ class LogLossLayer : public Layer<Dtype> {
 
  private:
   Dtype loss_;
+  Array<Dtype> buffer_;  //!< the clipped probabilities of the labels
 };
 
 }  // namespace cnn
@@ -14,17 +14,33 @@
   -----------------------------------------------------------------  */
 #pragma once
 
+#include <cstddef>
 #include <functional>
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
 #include "proto/cnn.pb.h"
 
+#include "cnn/allocation_tracker.hpp"
+#include "cnn/allocator.hpp"
 #include "cnn/array.hpp"
 #include "cnn/layer.hpp"
+#include "cnn/thread_pool.hpp"
 
 namespace cnn {
+
+/**
+ * Activation memory of a Network before and after plan_memory().
+ */
+struct MemoryPlan {
+  size_t bytes_before = 0;  //!< every activation has its own memory
+  size_t bytes_after = 0;   //!< kept activations plus the shared buffers
+  int num_shared = 0;       //!< number of activations in shared buffers
+  int num_buffers = 0;      //!< number of shared buffers
+};
+
 template <typename Dtype>
 class Network {
  public:
@@ -39,7 +55,82 @@ class Network {
   const NetworkProto& proto() const { return proto_; }
   NetworkProto& proto() { return proto_; }
 
+  /**
+   * Reshape all layers. ConvolutionLayers with algorithm AUTO
+   * are set to the fastest algorithm for their bottom shape,
+   * see autotune(). It starts with compile(), so it has to be
+   * called before fprop() and bprop().
+   *
+   * If proto().plan_memory() is true and all layers are in the TEST
+   * phase, plan_memory() is run afterwards; if proto().use_arena()
+   * is true, build_arena() is run last.
+   */
   void reshape();
+
+  /**
+   * Let activations whose lifetimes do not overlap share memory.
+   *
+   * The lifetime of an activation starts at the layer that produces
+   * it and ends at the last layer that reads it. Activations are
+   * assigned in layer order to the best fitting buffer that is free,
+   * so the peak is about the two largest adjacent activations.
+   * The outputs of the input layer and the activations that no layer
+   * reads, e.g., the predictions, keep their own memory.
+   *
+   * It is valid only for fprop() in the TEST phase, since bprop()
+   * reads the activations again; after it, get_data_top() of other
+   * layers returns memory that may have been overwritten. It has to
+   * be run again after reshape(), which undoes it.
+   *
+   * @return the memory before and after
+   */
+  const MemoryPlan& plan_memory();
+
+  /** the result of the last plan_memory(), zero if none */
+  const MemoryPlan& memory_plan() const { return memory_plan_; }
+
+  /**
+   * One SGD step for the parameters of all layers. With the arena,
+   * it is a single pass over all trainable parameters; otherwise
+   * every layer updates its own, see Layer::update_parameters().
+   */
+  void update_parameters(int current_iter, double learning_rate);
+
+  /**
+   * Write all parameters to a binary file with a single write.
+   * It requires proto().use_arena(); the file can be read back only
+   * by a network with the same layers and Dtype.
+   */
+  void save_param(const std::string& filename) const;
+
+  /** Read the parameters written by save_param(). */
+  void load_param(const std::string& filename);
+
+  /**
+   * The heap allocations of the calling thread and of the workers
+   * of the thread pool during the last fprop(), bprop() and
+   * update_parameters(); all zero unless allocation_tracking_enabled().
+   */
+  const AllocationStats& fprop_allocations() const {
+    return fprop_allocations_;
+  }
+  const AllocationStats& bprop_allocations() const {
+    return bprop_allocations_;
+  }
+  const AllocationStats& update_allocations() const {
+    return update_allocations_;
+  }
+
+  /**
+   * The number of threads the layers split their loops over,
+   * see proto().num_threads(); 1 if they run in the calling thread.
+   */
+  int num_threads() const {
+    return thread_pool_ ? thread_pool_->num_threads() : 1;
+  }
+
+  /** the size of the arena in bytes, 0 without proto().use_arena() */
+  size_t arena_bytes() const { return arena_ ? arena_->bytes() : 0; }
   /** forward propagation */
   void fprop();
 
@@ -49,7 +140,7 @@ class Network {
   void set_phase(Phase phase);
   Phase get_phase() const { return phase_; }
 
-  Dtype get_loss() const { return get_data_top(layers_.size() - 1)[0]->d_[0]; }
+  Dtype get_loss() const { return steps_.back().top[0]->d_[0]; }
   /**
    * we assume that the output of the last blob saves the predication
    */
@@ -57,7 +148,7 @@ class Network {
   void perform_predication();
   std::vector<Dtype> get_predications() const {
     std::vector<Dtype> res;
-    auto top = get_data_top(layers_.size() - 1)[0];
+    const auto* top = steps_.back().top[0];
     for (int i = 0; i < top->total_; i++) {
       res.push_back(top->d_[i]);
     }
@@ -66,7 +157,15 @@ class Network {
 
   int get_batch_size() const { return layers_[0]->proto().input_proto().n(); }
 
-  void save_network(const std::string& filename, bool is_binary = false);
+  /**
+   * Save the network with its parameters.
+   *
+   * @param with_packed_param true to save also Layer::packed_param(),
+   *                          so that copy_trained_network() does not
+   *                          have to pack the parameters again
+   */
+  void save_network(const std::string& filename, bool is_binary = false,
+                    bool with_packed_param = false);
 
   std::shared_ptr<Layer<Dtype>> layer(int i) const { return layers_[i]; }
   const std::vector<std::shared_ptr<Layer<Dtype>>>& layers() const {
@@ -93,17 +192,111 @@ class Network {
 
   void add_gradient(const std::string& name, std::shared_ptr<Array<Dtype>> arr);
 
+  /**
+   * If the i-th layer is a ConvolutionLayer with algorithm AUTO,
+   * time every algorithm it supports with the current bottom shape
+   * and select the fastest one. The layer is timed with fprop() in
+   * the TEST phase and with fprop() and bprop() in the TRAIN phase.
+   *
+   * The result is saved in the file proto().conv_algorithm_cache(),
+   * if any, and reused for the same shape, number of threads and
+   * phase without timing again.
+   */
+  void autotune(int i);
+
+  /**
+   * Run the i-th layer a few times.
+   *
+   * @param limit stop as soon as a run takes longer than this
+   * @return the fastest run in seconds
+   */
+  double time_layer(int i, double limit);
+
+  /**
+   * The arrays passed to a layer by fprop() and bprop(), resolved
+   * from the names of its bottoms and tops by compile().
+   */
+  struct Step {
+    std::vector<const Array<Dtype>*> bottom;
+    std::vector<Array<Dtype>*> bottom_gradient;
+    std::vector<Array<Dtype>*> top;
+    std::vector<const Array<Dtype>*> const_top;
+    std::vector<const Array<Dtype>*> top_gradient;
+  };
+
+  /**
+   * Fill steps_ and gradients_, so that fprop() and bprop() neither
+   * look up names nor build vectors. The arrays in data_ and
+   * gradient_ are created once by init() and never replaced, so the
+   * pointers stay valid; only their memory may move.
+   */
+  void compile();
+
+  /** give the activations shared by plan_memory() their own memory */
+  void undo_memory_plan();
+
+  /**
+   * Move all arrays of the network into one slab: the parameters
+   * that have gradients, all other parameters, their gradients in the
+   * same layout as the parameters, the history of the SGD update,
+   * the activations and the gradients of the activations.
+   * Activations shared by plan_memory() are left out.
+   *
+   * The shapes are known only after the layers are reshaped,
+   * so the arrays are allocated first and then moved.
+   */
+  void build_arena();
+
+  /** move the arrays in the arena back to their own memory */
+  void undo_arena();
+
+  /** move the content of `arr` to memory from `allocator` */
+  static void relocate(Array<Dtype>* arr, Allocator* allocator);
+
+  /** the allocations of the calling thread and of the pool workers */
+  AllocationStats allocation_stats();
+
  private:
   NetworkProto proto_;
 
+  /**
+   * the buffers of plan_memory(); they are declared before data_
+   * since they have to outlive the arrays allocated from them
+   */
+  std::vector<std::unique_ptr<SharedBufferAllocator>> buffers_;
+  std::vector<Array<Dtype>*> shared_;  //!< arrays using buffers_
+  MemoryPlan memory_plan_;
+
+  /** build_arena(); it has to outlive the arrays in it, too */
+  std::unique_ptr<ArenaAllocator> arena_;
+  std::vector<Array<Dtype>*> arena_arrays_;  //!< arrays in arena_
+  Array<Dtype> history_;    //!< history of update_parameters()
+  Dtype* param_begin_;      //!< the parameters in arena_
+  Dtype* gradient_begin_;   //!< the gradients of the parameters in arena_
+  int num_trainable_;       //!< elements from param_begin_ with gradients
+  size_t param_bytes_;      //!< bytes of all parameters
+
   /** it saves the input and output of all layers in the network*/
   std::map<std::string, std::shared_ptr<Array<Dtype>>> data_;
   std::map<std::string, std::shared_ptr<Array<Dtype>>> gradient_;
 
+  /** shared by all layers; NULL if they run in the calling thread */
+  std::unique_ptr<ThreadPool> thread_pool_;
+
   std::vector<std::shared_ptr<Layer<Dtype>>> layers_;
 
+  std::vector<Step> steps_;  //!< one per layer, see compile()
+  std::vector<Array<Dtype>*> gradients_;  //!< all arrays of gradient_
+
+  AllocationStats fprop_allocations_;
+  AllocationStats bprop_allocations_;
+  AllocationStats update_allocations_;
+
   std::function<void(const std::vector<Array<Dtype>*>& top)> data_callback_;
 
+  ConvolutionAlgorithmCache conv_algorithm_cache_;
+  bool conv_algorithm_cache_loaded_;
+
   Phase phase_;
 };
 
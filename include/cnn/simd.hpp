@@ -0,0 +1,94 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+namespace cnn {
+
+/**
+ * Instruction sets of the vectorized kernels, from the
+ * least to the most capable.
+ */
+enum class SimdIsa {
+  kGeneric,  //!< plain C++ with multiple accumulators
+  kSse2,
+  kAvx2,    //!< AVX2 and FMA
+  kAvx512,  //!< AVX-512F
+};
+
+/**
+ * The element-wise kernels behind array_math.hpp for one type.
+ *
+ * See the functions with the same name in array_math.hpp for
+ * the meaning of the arguments.
+ */
+template <typename Dtype>
+struct SimdKernels {
+  Dtype (*ax_sub_by_squared)(int n, Dtype alpha, const Dtype* x, Dtype beta,
+                             const Dtype* y);
+  Dtype (*dot)(int n, const Dtype* x, const Dtype* y);
+  void (*ax_plus_by)(int n, Dtype alpha, const Dtype* x, Dtype beta, Dtype* y);
+  void (*set_to)(int n, Dtype val, Dtype* dst);
+  void (*scale_arr)(int n, Dtype alpha, const Dtype* src, Dtype* dst);
+  Dtype (*sum_arr)(int n, const Dtype* src);
+  Dtype (*sum_squared_arr)(int n, const Dtype* src);
+  void (*sub_scalar)(int n, Dtype alpha, const Dtype* src, Dtype* dst);
+  Dtype (*max_arr)(int n, const Dtype* src);
+  void (*exp_arr)(int n, const Dtype* src, Dtype* dst);
+  void (*log_arr)(int n, const Dtype* src, Dtype* dst);
+  Dtype (*sub_exp_sum)(int n, Dtype alpha, const Dtype* src, Dtype* dst);
+};
+
+/**
+ * Return the kernels for the given instruction set, or nullptr
+ * if this binary was built without them or the CPU it runs on
+ * does not support them.
+ *
+ * Only float and double are provided.
+ */
+template <typename Dtype>
+const SimdKernels<Dtype>* simd_kernels(SimdIsa isa);
+
+/**
+ * Return the most capable instruction set that is usable on
+ * this CPU. It is detected once with CPUID, so a single binary
+ * runs on every x86 host; other architectures use kGeneric.
+ */
+SimdIsa simd_isa();
+
+/**
+ * The vectorized backend of array_math.hpp.
+ *
+ * For float and double, kEnabled is true and kernels() returns
+ * the kernels for simd_isa(). For other types, e.g., Jet,
+ * array_math.hpp uses its generic templates.
+ */
+template <typename Dtype>
+struct Simd {
+  static constexpr bool kEnabled = false;
+};
+
+template <>
+struct Simd<float> {
+  static constexpr bool kEnabled = true;
+  static const SimdKernels<float>& kernels();
+};
+
+template <>
+struct Simd<double> {
+  static constexpr bool kEnabled = true;
+  static const SimdKernels<double>& kernels();
+};
+
+}  // namespace cnn
@@ -0,0 +1,457 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#include "cnn/simd.hpp"
+
+namespace cnn {
+namespace internal {
+
+/**
+ * Layout of the IEEE 754 types and the constants of the exp and
+ * log approximations, which are those of Cephes.
+ */
+template <typename Dtype>
+struct FloatBits;
+
+template <>
+struct FloatBits<float> {
+  using UInt = uint32_t;
+  static constexpr int kMantissaBits = 23;
+  static constexpr int kBias = 127;
+
+  // exp(x) is 0 below kExpLow, i.e., for results below 2^-126,
+  // and x is clamped to kExpHigh so that 2^n is finite
+  static constexpr float kExpLow = -87.33654f;
+  static constexpr float kExpHigh = 88.37626f;
+};
+
+template <>
+struct FloatBits<double> {
+  using UInt = uint64_t;
+  static constexpr int kMantissaBits = 52;
+  static constexpr int kBias = 1023;
+
+  static constexpr double kExpLow = -708.3964185322641;
+  static constexpr double kExpHigh = 709.0;
+};
+
+template <typename Dtype>
+Dtype from_bits(typename FloatBits<Dtype>::UInt u) {
+  Dtype d;
+  memcpy(&d, &u, sizeof(d));
+  return d;
+}
+
+/**
+ * The kernels of SimdKernels written once for a vector type V.
+ *
+ * This header is only included by src/simd*.cpp, each of which is
+ * compiled for one instruction set and defines V in an anonymous
+ * namespace, so the instantiations of different translation units
+ * never get merged by the linker.
+ *
+ * V provides
+ *
+ *  - Scalar, the element type, and Reg, the register type
+ *  - kWidth, the number of elements in a register
+ *  - zero(), set1(s), load(p), store(p, r), which do not
+ *    require p to be aligned
+ *  - add(a, b), sub(a, b), mul(a, b) and fmadd(a, b, c) = a*b + c
+ *  - div(a, b), min(a, b), max(a, b) and select_gt(a, b, x, y),
+ *    which is x where a > b and y elsewhere
+ *  - bits_and(a, b) and bits_or(a, b) on the bit patterns, and
+ *    shl_mantissa(r) and shr_mantissa(r), which shift the bit
+ *    pattern of every element by the number of mantissa bits
+ *
+ * The reductions keep kAcc independent accumulators so that the
+ * adds of consecutive iterations do not wait for each other.
+ */
+template <typename V>
+struct VectorKernels {
+  using T = typename V::Scalar;
+  using R = typename V::Reg;
+
+  static constexpr int kW = V::kWidth;
+  static constexpr int kAcc = 4;
+
+  static T hsum(R r) {
+    T buf[kW];
+    V::store(buf, r);
+    T res = 0;
+    for (int i = 0; i < kW; i++) {
+      res += buf[i];
+    }
+    return res;
+  }
+
+  static T ax_sub_by_squared(int n, T alpha, const T* x, T beta, const T* y) {
+    R va = V::set1(alpha);
+    R vb = V::set1(beta);
+    R acc[kAcc];
+    for (int j = 0; j < kAcc; j++) {
+      acc[j] = V::zero();
+    }
+
+    int i = 0;
+    for (; i + kAcc * kW <= n; i += kAcc * kW) {
+      for (int j = 0; j < kAcc; j++) {
+        R d = V::sub(V::mul(va, V::load(x + i + j * kW)),
+                     V::mul(vb, V::load(y + i + j * kW)));
+        acc[j] = V::fmadd(d, d, acc[j]);
+      }
+    }
+    for (; i + kW <= n; i += kW) {
+      R d = V::sub(V::mul(va, V::load(x + i)), V::mul(vb, V::load(y + i)));
+      acc[0] = V::fmadd(d, d, acc[0]);
+    }
+
+    T res = hsum(V::add(V::add(acc[0], acc[1]), V::add(acc[2], acc[3])));
+    for (; i < n; i++) {
+      T d = alpha * x[i] - beta * y[i];
+      res += d * d;
+    }
+    return res;
+  }
+
+  static T dot(int n, const T* x, const T* y) {
+    R acc[kAcc];
+    for (int j = 0; j < kAcc; j++) {
+      acc[j] = V::zero();
+    }
+
+    int i = 0;
+    for (; i + kAcc * kW <= n; i += kAcc * kW) {
+      for (int j = 0; j < kAcc; j++) {
+        acc[j] =
+            V::fmadd(V::load(x + i + j * kW), V::load(y + i + j * kW), acc[j]);
+      }
+    }
+    for (; i + kW <= n; i += kW) {
+      acc[0] = V::fmadd(V::load(x + i), V::load(y + i), acc[0]);
+    }
+
+    T res = hsum(V::add(V::add(acc[0], acc[1]), V::add(acc[2], acc[3])));
+    for (; i < n; i++) {
+      res += x[i] * y[i];
+    }
+    return res;
+  }
+
+  static void ax_plus_by(int n, T alpha, const T* x, T beta, T* y) {
+    R va = V::set1(alpha);
+    R vb = V::set1(beta);
+    int i = 0;
+    for (; i + kW <= n; i += kW) {
+      V::store(y + i, V::fmadd(va, V::load(x + i), V::mul(vb, V::load(y + i))));
+    }
+    for (; i < n; i++) {
+      y[i] = alpha * x[i] + beta * y[i];
+    }
+  }
+
+  static void set_to(int n, T val, T* dst) {
+    R v = V::set1(val);
+    int i = 0;
+    for (; i + kW <= n; i += kW) {
+      V::store(dst + i, v);
+    }
+    for (; i < n; i++) {
+      dst[i] = val;
+    }
+  }
+
+  static void scale_arr(int n, T alpha, const T* src, T* dst) {
+    R va = V::set1(alpha);
+    int i = 0;
+    for (; i + kW <= n; i += kW) {
+      V::store(dst + i, V::mul(va, V::load(src + i)));
+    }
+    for (; i < n; i++) {
+      dst[i] = alpha * src[i];
+    }
+  }
+
+  static T sum_arr(int n, const T* src) {
+    R acc[kAcc];
+    for (int j = 0; j < kAcc; j++) {
+      acc[j] = V::zero();
+    }
+
+    int i = 0;
+    for (; i + kAcc * kW <= n; i += kAcc * kW) {
+      for (int j = 0; j < kAcc; j++) {
+        acc[j] = V::add(acc[j], V::load(src + i + j * kW));
+      }
+    }
+    for (; i + kW <= n; i += kW) {
+      acc[0] = V::add(acc[0], V::load(src + i));
+    }
+
+    T res = hsum(V::add(V::add(acc[0], acc[1]), V::add(acc[2], acc[3])));
+    for (; i < n; i++) {
+      res += src[i];
+    }
+    return res;
+  }
+
+  static T sum_squared_arr(int n, const T* src) { return dot(n, src, src); }
+
+  static void sub_scalar(int n, T alpha, const T* src, T* dst) {
+    R va = V::set1(alpha);
+    int i = 0;
+    for (; i + kW <= n; i += kW) {
+      V::store(dst + i, V::sub(V::load(src + i), va));
+    }
+    for (; i < n; i++) {
+      dst[i] = src[i] - alpha;
+    }
+  }
+
+  static T max_arr(int n, const T* src) {
+    T res = -std::numeric_limits<T>::infinity();
+    int i = 0;
+    if (n >= kW) {
+      R acc = V::load(src);
+      for (i = kW; i + kW <= n; i += kW) {
+        acc = V::max(acc, V::load(src + i));
+      }
+      T buf[kW];
+      V::store(buf, acc);
+      for (int j = 0; j < kW; j++) {
+        res = (buf[j] > res) ? buf[j] : res;
+      }
+    }
+    for (; i < n; i++) {
+      res = (src[i] > res) ? src[i] : res;
+    }
+    return res;
+  }
+
+  /** 2^kMantissaBits */
+  static T two_m() {
+    return T(typename FloatBits<T>::UInt(1) << FloatBits<T>::kMantissaBits);
+  }
+
+  /** round to the nearest integer, for |x| < 2^(kMantissaBits-1) */
+  static R round(R x) {
+    const R magic = V::set1(T(1.5) * two_m());
+    return V::sub(V::add(x, magic), magic);
+  }
+
+  /** 2^n for every integral n in [1 - kBias, kBias] */
+  static R pow2(R n) {
+    // n + kBias ends up in the low bits of the mantissa, from
+    // which it is shifted into the exponent
+    const R magic = V::set1(two_m() + T(FloatBits<T>::kBias));
+    return V::shl_mantissa(V::add(n, magic));
+  }
+
+  static R poly(R x, const T* c, int n) {
+    R p = V::set1(c[0]);
+    for (int i = 1; i < n; i++) {
+      p = V::fmadd(p, x, V::set1(c[i]));
+    }
+    return p;
+  }
+
+  /**
+   * exp(x) = 2^n * exp(r) with n = round(x / ln2), where exp(r) for
+   * |r| <= ln2/2 is a polynomial (float) or a rational function
+   * (double) fitted by Cephes.
+   */
+  static R exp(R x) {
+    const R low = V::set1(FloatBits<T>::kExpLow);
+    R xc = V::max(V::min(x, V::set1(FloatBits<T>::kExpHigh)), low);
+
+    R n = round(V::mul(xc, V::set1(T(1.44269504088896341))));
+    R r = V::sub(xc, V::mul(n, V::set1(kLn2Hi)));
+    r = V::sub(r, V::mul(n, V::set1(kLn2Lo)));
+
+    R e = exp_reduced(r, std::is_same<T, float>());
+    e = V::mul(e, pow2(n));
+    return V::select_gt(low, x, V::zero(), e);
+  }
+
+  static R exp_reduced(R r, std::true_type /*float*/) {
+    static const T p[] = {1.9875691500E-4, 1.3981999507E-3, 8.3334519073E-3,
+                          4.1665795894E-2, 1.6666665459E-1, 5.0000001201E-1};
+    R z = V::mul(r, r);
+    return V::add(V::fmadd(poly(r, p, 6), z, r), V::set1(T(1)));
+  }
+
+  static R exp_reduced(R r, std::false_type /*double*/) {
+    static const T p[] = {1.26177193074810590878E-4,
+                          3.02994407707441961300E-2,
+                          9.99999999999999999910E-1};
+    static const T q[] = {3.00198505138664455042E-6,
+                          2.52448340349684104192E-3,
+                          2.27265548208155028766E-1,
+                          2.00000000000000000009E0};
+    R z = V::mul(r, r);
+    R px = V::mul(r, poly(z, p, 3));
+    R res = V::div(px, V::sub(poly(z, q, 4), px));
+    return V::fmadd(V::set1(T(2)), res, V::set1(T(1)));
+  }
+
+  /**
+   * log(x) = e*ln2 + log(m) with x = m * 2^e and m in
+   * [sqrt(1/2), sqrt(2)), where log(m) is fitted by Cephes.
+   * x has to be positive, finite and normal.
+   */
+  static R log(R x) {
+    using Bits = FloatBits<T>;
+    const T two_m = VectorKernels::two_m();
+    const R mantissa_mask =
+        V::set1(from_bits<T>((typename Bits::UInt(1) << Bits::kMantissaBits) -
+                             1));
+
+    // the biased exponent is shifted into the low bits of the
+    // mantissa of 2^kMantissaBits
+    R e = V::bits_or(V::shr_mantissa(x), V::set1(two_m));
+    e = V::sub(e, V::set1(two_m + T(Bits::kBias)));
+    R m = V::bits_or(V::bits_and(x, mantissa_mask), V::set1(T(1)));
+
+    const R sqrt2 = V::set1(T(1.41421356237309504880));
+    e = V::select_gt(m, sqrt2, V::add(e, V::set1(T(1))), e);
+    m = V::select_gt(m, sqrt2, V::mul(m, V::set1(T(0.5))), m);
+
+    R f = V::sub(m, V::set1(T(1)));
+    R z = V::mul(f, f);
+    R y = log_reduced(f, z, std::is_same<T, float>());
+    y = V::sub(y, V::mul(e, V::set1(-kLn2Lo)));
+    y = V::sub(y, V::mul(z, V::set1(T(0.5))));
+    return V::fmadd(e, V::set1(kLn2Hi), V::add(f, y));
+  }
+
+  static R log_reduced(R f, R z, std::true_type /*float*/) {
+    static const T p[] = {7.0376836292E-2,  -1.1514610310E-1, 1.1676998740E-1,
+                          -1.2420140846E-1, 1.4249322787E-1,  -1.6668057665E-1,
+                          2.0000714765E-1,  -2.4999993993E-1, 3.3333331174E-1};
+    return V::mul(V::mul(f, z), poly(f, p, 9));
+  }
+
+  static R log_reduced(R f, R z, std::false_type /*double*/) {
+    static const T p[] = {1.01875663804580931796E-4, 4.97494994976747001425E-1,
+                          4.70579119878881725854E0,  1.44989225341610930846E1,
+                          1.79368678507819816313E1,  7.70838733755885391666E0};
+    static const T q[] = {1.0,
+                          1.12873587189167450590E1,
+                          4.52279145837532221105E1,
+                          8.29875266912776603211E1,
+                          7.11544750618563894466E1,
+                          2.31251620126765340583E1};
+    return V::mul(f, V::div(V::mul(z, poly(f, p, 6)), poly(f, q, 6)));
+  }
+
+  /**
+   * Apply op to n elements, kW at a time. The last partial
+   * register is padded with pad.
+   */
+  template <typename Op>
+  static void transform(int n, const T* src, T* dst, T pad, Op op) {
+    int i = 0;
+    for (; i + kW <= n; i += kW) {
+      V::store(dst + i, op(V::load(src + i)));
+    }
+    if (i < n) {
+      T buf[kW];
+      for (int j = 0; j < kW; j++) {
+        buf[j] = (i + j < n) ? src[i + j] : pad;
+      }
+      V::store(buf, op(V::load(buf)));
+      for (int j = 0; i + j < n; j++) {
+        dst[i + j] = buf[j];
+      }
+    }
+  }
+
+  static void exp_arr(int n, const T* src, T* dst) {
+    transform(n, src, dst, T(0), [](R x) { return exp(x); });
+  }
+
+  static void log_arr(int n, const T* src, T* dst) {
+    transform(n, src, dst, T(1), [](R x) { return log(x); });
+  }
+
+  static T sub_exp_sum(int n, T alpha, const T* src, T* dst) {
+    R va = V::set1(alpha);
+    R acc = V::zero();
+    int i = 0;
+    for (; i + kW <= n; i += kW) {
+      R e = exp(V::sub(V::load(src + i), va));
+      acc = V::add(acc, e);
+      if (dst) {
+        V::store(dst + i, e);
+      }
+    }
+    if (i < n) {
+      // exp() of the padding is 0
+      T buf[kW];
+      for (int j = 0; j < kW; j++) {
+        buf[j] = (i + j < n) ? src[i + j] - alpha
+                             : -std::numeric_limits<T>::infinity();
+      }
+      R e = exp(V::load(buf));
+      acc = V::add(acc, e);
+      V::store(buf, e);
+      for (int j = 0; dst && i + j < n; j++) {
+        dst[i + j] = buf[j];
+      }
+    }
+    return hsum(acc);
+  }
+
+  static const SimdKernels<T>* get() {
+    static const SimdKernels<T> kernels = {
+        &ax_sub_by_squared, &dot,     &ax_plus_by, &set_to,
+        &scale_arr,         &sum_arr, &sum_squared_arr,
+        &sub_scalar,        &max_arr, &exp_arr,    &log_arr,
+        &sub_exp_sum,
+    };
+    return &kernels;
+  }
+
+  // ln2 split into a part with few significant bits, so that
+  // n*kLn2Hi is exact, and the rest
+  static constexpr T kLn2Hi = 0.693359375;
+  static constexpr T kLn2Lo = -2.121944400546905827679e-4;
+};
+
+/**
+ * The kernels of src/simd_generic.cpp, src/simd_sse2.cpp,
+ * src/simd_avx2.cpp and src/simd_avx512.cpp. They return nullptr
+ * if the file was not compiled for its instruction set; whether
+ * the CPU supports it is checked by simd_kernels().
+ */
+template <typename Dtype>
+const SimdKernels<Dtype>* generic_kernels();
+
+template <typename Dtype>
+const SimdKernels<Dtype>* sse2_kernels();
+
+template <typename Dtype>
+const SimdKernels<Dtype>* avx2_kernels();
+
+template <typename Dtype>
+const SimdKernels<Dtype>* avx512_kernels();
+
+}  // namespace internal
+}  // namespace cnn
@@ -20,6 +20,38 @@
 
 namespace cnn {
 
+/**
+ * Softmax over the channels of one image in NCHW layout.
+ *
+ * @param channels number of channels C
+ * @param pixels number of pixels H*W; channel c of pixel p is at
+ *               c*pixels + p
+ * @param x the input with channels*pixels elements
+ * @param y the output, of the same size as x
+ * @param max_val on return, max_c(x_c) for every pixel
+ * @param sum_exp on return, sum_c(exp(x_c - max_val)) for every pixel,
+ *                so that log(y_c) = x_c - max_val - log(sum_exp)
+ *
+ * The pixels are processed in tiles, so that every loop reads
+ * contiguous elements of a channel and is vectorized across the
+ * pixels of the tile, while the C rows of a tile stay in cache
+ * between the passes. If pixels is 1, the channels are contiguous
+ * and they are vectorized instead.
+ */
+template <typename Dtype>
+void softmax_fprop(int channels, int pixels, const Dtype* x, Dtype* y,
+                   Dtype* max_val, Dtype* sum_exp);
+
+/**
+ * The gradient of softmax_fprop(), in the same layout,
+ * dx_c += y_c * (dy_c - <dy, y>).
+ *
+ * @param dot scratch space for pixels elements
+ */
+template <typename Dtype>
+void softmax_bprop(int channels, int pixels, const Dtype* y, const Dtype* dy,
+                   Dtype* dx, Dtype* dot);
+
 /**
  * Compute softmax over channels.
  *
@@ -33,6 +65,10 @@ namespace cnn {
  *
  * if a = max(a, b, c), then
  * softmax(a, b, c) = softmax(a-a, b-a, c-a) = softmax(0, b-a, c-a)
+ *
+ * The gradient of y = softmax(x) is
+ * dx_c = y_c * (dy_c - <dy, y>), which costs O(C) per pixel
+ * instead of building the C x C Jacobian.
  */
 template <typename Dtype>
 class SoftmaxLayer : public Layer<Dtype> {
@@ -53,7 +89,8 @@ class SoftmaxLayer : public Layer<Dtype> {
              const std::vector<const Array<Dtype>*>& top_gradient) override;
 
  private:
-  Array<Dtype> buffer_;
+  Array<Dtype> max_;  //!< max over the channels of every pixel
+  Array<Dtype> sum_;  //!< sum of the exponentials, or of dy*y in bprop
 };
 
 }  // namespace cnn
@@ -51,6 +51,12 @@ namespace cnn {
  * bottom[1] is the ground truth and has the shape (N, 1, H, W).
  * values of every element in bottom[1] have to be an integer
  * in the range [0, C-1].
+ *
+ * The loss is computed with log-sum-exp in the same pass as the
+ * softmax, i.e., log(y_k) = x_k - m - log(sum_c exp(x_c - m))
+ * with m = max_c(x_c), so it never takes the log of a probability
+ * that has underflowed to 0. See softmax_fprop() for how the
+ * pixels are traversed.
  */
 template <typename Dtype>
 class SoftmaxWithLogLossLayer : public Layer<Dtype> {
@@ -72,10 +78,10 @@ class SoftmaxWithLogLossLayer : public Layer<Dtype> {
 
  private:
   Dtype loss_;
-  std::shared_ptr<Layer<Dtype>> softmax_layer_;
+  Array<Dtype> max_;      //!< m = max_c(x_c) for every pixel
+  Array<Dtype> sum_exp_;  //!< sum_c exp(x_c - m) for every pixel
   Array<Dtype> softmax_top_;
-  Array<Dtype> softmax_top_gradient_;
-  Array<Dtype> softmax_bottom_gradient_;
+  Array<Dtype> shifted_;  //!< sum of x_k - m over the pixels of an image
 };
 
 }  // namespace cnn
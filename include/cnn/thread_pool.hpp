@@ -0,0 +1,180 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "cnn/allocation_tracker.hpp"
+
+namespace cnn {
+
+/**
+ * Number of elements of an element-wise loop below which waking up
+ * another thread costs more than it saves; see parallel_grain().
+ */
+constexpr int kParallelGrain = 1 << 14;
+
+/**
+ * The grain for parallel_for() over items that cost about `cost`
+ * element-wise operations each, e.g., the number of pixels of a
+ * channel, so that a chunk is at least kParallelGrain operations.
+ */
+inline int parallel_grain(int64_t cost) {
+  return std::max(1, static_cast<int>(kParallelGrain /
+                                      std::max<int64_t>(1, cost)));
+}
+
+/**
+ * A fixed set of threads that run the iterations of a loop.
+ *
+ * The thread that calls parallel_for() is one of them, so a pool
+ * of n threads starts n - 1 workers. The range of a loop is split
+ * into one contiguous part per thread, and every thread takes chunks
+ * of `grain` iterations from its own part first and then from the
+ * parts of the others, so that a thread that finishes early steals
+ * the remaining work instead of waiting.
+ *
+ * parallel_for() neither allocates memory nor copies the function,
+ * so it can run in every pass of a network. A parallel_for() inside
+ * a parallel_for() runs serially in the calling thread. Only one
+ * thread at a time may call parallel_for() of a pool.
+ */
+class ThreadPool {
+ public:
+  /**
+   * @param num_threads number of threads including the caller;
+   *                    0 for std::thread::hardware_concurrency()
+   * @param cpus if not empty, worker i (1 <= i < num_threads) is
+   *             pinned to cpus[(i - 1) % cpus.size()]; it is ignored
+   *             on systems other than Linux. The calling thread is
+   *             not pinned.
+   */
+  explicit ThreadPool(int num_threads,
+                      const std::vector<int>& cpus = std::vector<int>());
+  ~ThreadPool();
+
+  int num_threads() const { return num_threads_; }
+
+  /**
+   * The heap allocations of the workers, summed up to the end of
+   * their part of the last parallel_for(); the calling thread is not
+   * included, see thread_allocation_stats().
+   */
+  AllocationStats worker_allocation_stats();
+
+  /**
+   * Call func(b, e) for disjoint ranges [b, e) that cover
+   * [begin, end) and return when all of them are done.
+   *
+   * A range is at most `grain` iterations long except when the whole
+   * loop runs in the calling thread, which happens if it has at most
+   * `grain` iterations. func must not throw.
+   */
+  template <typename Func>
+  void parallel_for(int begin, int end, int grain, const Func& func) {
+    run(begin, end, grain, &ThreadPool::invoke<Func>, &func);
+  }
+
+  /**
+   * Call func(i) once in every thread i of the pool, 0 being the
+   * calling thread, e.g., to set up per-thread buffers before the
+   * first parallel_for(). It must not be called inside a
+   * parallel_for().
+   */
+  template <typename Func>
+  void for_each_thread(const Func& func) {
+    run_in_each(&ThreadPool::invoke_each<Func>, &func);
+  }
+
+ private:
+  using Task = void (*)(const void* func, int begin, int end);
+
+  template <typename Func>
+  static void invoke(const void* func, int begin, int end) {
+    (*static_cast<const Func*>(func))(begin, end);
+  }
+
+  template <typename Func>
+  static void invoke_each(const void* func, int id, int /*end*/) {
+    (*static_cast<const Func*>(func))(id);
+  }
+
+  void run(int begin, int end, int grain, Task task, const void* func);
+
+  /** call task(func, i, i + 1) in every thread i */
+  void run_in_each(Task task, const void* func);
+
+  /** run the chunks of part `id`, then steal from the other parts */
+  void work(int id);
+
+  void worker_loop(int id, int cpu);
+
+  /**
+   * The iterations [next, end) of a thread that are not taken yet.
+   * It fills a cache line, so that threads taking chunks from
+   * different parts do not invalidate each other's line.
+   */
+  struct Part {
+    std::atomic<int> next;
+    int end;
+    char padding[64 - sizeof(std::atomic<int>) - sizeof(int)];
+  };
+
+ private:
+  int num_threads_;
+  std::vector<std::thread> workers_;
+  std::unique_ptr<Part[]> parts_;
+
+  // the loop run by parallel_for()
+  Task task_;
+  const void* func_;
+  int grain_;
+  bool in_each_;  //!< true if the loop is one of for_each_thread()
+
+  std::mutex mutex_;
+  std::condition_variable start_;  //!< a new loop or stop_
+  std::condition_variable done_;   //!< pending_ reached 0
+  uint64_t generation_;            //!< number of loops started
+  int pending_;                    //!< workers still in the current loop
+  //! thread_allocation_stats() of worker i after its last loop
+  std::vector<AllocationStats> worker_stats_;
+  bool stop_;
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+};
+
+/**
+ * ThreadPool::parallel_for() of `pool`; the loop runs serially
+ * in the calling thread if `pool` is NULL.
+ */
+template <typename Func>
+void parallel_for(ThreadPool* pool, int begin, int end, int grain,
+                  const Func& func) {
+  if (pool) {
+    pool->parallel_for(begin, end, grain, func);
+  } else if (begin < end) {
+    func(begin, end);
+  }
+}
+
+}  // namespace cnn
@@ -0,0 +1,91 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#pragma once
+
+#include "cnn/array.hpp"
+
+namespace cnn {
+
+/**
+ * Winograd minimal filtering F(M x M, 3 x 3) for a 3 x 3 convolution
+ * with stride 1 and implicit zero padding, i.e., the output has the
+ * same size as the input.
+ *
+ * Refer to "Fast Algorithms for Convolutional Neural Networks"
+ * by Andrew Lavin and Scott Gray.
+ *
+ * The output is split into tiles of M x M pixels. Every tile is
+ * computed from an input tile d of (M+2) x (M+2) pixels as
+ *
+ *    Y = A^T [ (G g G^T) .* (B^T d B) ] A
+ *
+ * where g is the 3 x 3 kernel. The element-wise products are summed
+ * over the input channels with one gemm() per element of the
+ * (M+2) x (M+2) tile, with all tiles of all samples in the batch
+ * as the columns.
+ *
+ * It needs (M+2)^2 multiplications for M*M outputs in the gemm stage
+ * instead of 9*M*M, i.e., 2.25x fewer for M = 2 and 4x fewer for M = 4.
+ *
+ * Only M = 2 and M = 4 are supported.
+ */
+template <typename Dtype, int M>
+class Winograd {
+ public:
+  static constexpr int kAlpha = M + 2;  //!< size of an input tile
+  static constexpr int kNumElements = kAlpha * kAlpha;
+
+  /**
+   * Transform the kernels.
+   *
+   * @param weight kernels with shape (num_output, C, 3, 3)
+   * @param flip false to transform the kernels for the forward pass.
+   *             true to transform the kernels for the gradient of
+   *             the input, i.e., to swap the input and output
+   *             channels and rotate the kernels by 180 degrees.
+   * @param u on return it has shape (kNumElements, 1, num_output, C),
+   *          or (kNumElements, 1, C, num_output) if flip is true.
+   */
+  static void transform_weight(const Array<Dtype>& weight, bool flip,
+                               Array<Dtype>* u);
+
+  /**
+   * @return number of tiles of a batch with shape (n, *, h, w)
+   */
+  static int num_tiles(int n, int h, int w) {
+    return n * ((h + M - 1) / M) * ((w + M - 1) / M);
+  }
+
+  /**
+   * Convolve the input with the transformed kernels.
+   *
+   * @param in input with shape (N, C, H, W)
+   * @param u output of transform_weight() with shape
+   *          (kNumElements, 1, K, C)
+   * @param bias NULL or an array of K elements added to the output
+   * @param accumulate true to add the result to out;
+   *                   false to overwrite out
+   * @param v buffer with kNumElements * C * num_tiles() elements
+   * @param m buffer with kNumElements * K * num_tiles() elements
+   * @param out output with shape (N, K, H, W)
+   */
+  static void convolve(const Array<Dtype>& in, const Array<Dtype>& u,
+                       const Dtype* bias, bool accumulate, Dtype* v, Dtype* m,
+                       Array<Dtype>* out);
+};
+
+}  // namespace cnn
+
+#include "../../src/winograd.cpp"
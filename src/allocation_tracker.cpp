@@ -0,0 +1,96 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include <cstdlib>
+#include <new>
+
+#include "cnn/allocation_tracker.hpp"
+
+namespace cnn {
+
+#ifdef CNN_TRACK_ALLOCATIONS
+
+namespace {
+
+// plain integers, so that they need no constructor and can be
+// used by operator new at any time
+thread_local size_t g_num_allocations = 0;
+thread_local size_t g_bytes = 0;
+
+}  // namespace
+
+bool allocation_tracking_enabled() { return true; }
+
+AllocationStats thread_allocation_stats() {
+  return {g_num_allocations, g_bytes};
+}
+
+namespace internal {
+
+void record_allocation(size_t bytes) {
+  g_num_allocations++;
+  g_bytes += bytes;
+}
+
+}  // namespace internal
+
+#else
+
+bool allocation_tracking_enabled() { return false; }
+
+AllocationStats thread_allocation_stats() { return {0, 0}; }
+
+namespace internal {
+
+void record_allocation(size_t /*bytes*/) {}
+
+}  // namespace internal
+
+#endif
+
+}  // namespace cnn
+
+#ifdef CNN_TRACK_ALLOCATIONS
+
+void* operator new(size_t size) {
+  cnn::internal::record_allocation(size);
+  void* p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  cnn::internal::record_allocation(size);
+  return std::malloc(size ? size : 1);
+}
+
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+  return operator new(size, tag);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete[](void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  std::free(p);
+}
+
+#endif
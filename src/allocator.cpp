@@ -0,0 +1,165 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include <glog/logging.h>
+#include <stdlib.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include <atomic>
+
+#include "cnn/allocation_tracker.hpp"
+#include "cnn/allocator.hpp"
+
+namespace cnn {
+
+void* AlignedAllocator::allocate(size_t bytes) {
+  void* p = nullptr;
+  int ret = posix_memalign(&p, kArrayAlignment, bytes ? bytes : 1);
+  CHECK_EQ(ret, 0) << "failed to allocate " << bytes << " bytes";
+  internal::record_allocation(bytes);
+  return p;
+}
+
+void AlignedAllocator::deallocate(void* p, size_t /*bytes*/) { free(p); }
+
+constexpr size_t HugePageAllocator::kHugePageSize;
+
+bool HugePageAllocator::is_large(size_t bytes) const {
+#ifdef __linux__
+  return bytes >= threshold_;
+#else
+  (void)bytes;
+  return false;
+#endif
+}
+
+#ifdef __linux__
+
+namespace {
+
+size_t round_up(size_t bytes, size_t multiple) {
+  return (bytes + multiple - 1) / multiple * multiple;
+}
+
+}  // namespace
+
+void* HugePageAllocator::allocate(size_t bytes) {
+  if (!is_large(bytes)) {
+    return small_.allocate(bytes);
+  }
+
+  size_t size = round_up(bytes, kHugePageSize);
+  internal::record_allocation(size);
+  if (use_hugetlb_) {
+    void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) {
+      return p;
+    }
+    LOG_FIRST_N(WARNING, 1) << "failed to map " << size
+                            << " bytes from hugetlbfs, "
+                            << "use transparent huge pages instead";
+  }
+
+  // map one more huge page and trim both ends
+  // so that the block starts at a huge page boundary
+  size_t mapped = size + kHugePageSize;
+  void* p = mmap(nullptr, mapped, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  CHECK(p != MAP_FAILED) << "failed to allocate " << bytes << " bytes";
+
+  char* begin = static_cast<char*>(p);
+  char* aligned = reinterpret_cast<char*>(
+      round_up(reinterpret_cast<size_t>(begin), kHugePageSize));
+  size_t head = aligned - begin;
+  size_t tail = mapped - head - size;
+  if (head) munmap(begin, head);
+  if (tail) munmap(aligned + size, tail);
+
+  // only a hint; it fails if THP is disabled, which is not an error
+  madvise(aligned, size, MADV_HUGEPAGE);
+
+  return aligned;
+}
+
+void HugePageAllocator::deallocate(void* p, size_t bytes) {
+  if (!is_large(bytes)) {
+    small_.deallocate(p, bytes);
+    return;
+  }
+  // both hugetlbfs and THP blocks are whole huge pages
+  munmap(p, round_up(bytes, kHugePageSize));
+}
+
+#else
+
+void* HugePageAllocator::allocate(size_t bytes) {
+  return small_.allocate(bytes);
+}
+
+void HugePageAllocator::deallocate(void* p, size_t bytes) {
+  small_.deallocate(p, bytes);
+}
+
+#endif
+
+SharedBufferAllocator::SharedBufferAllocator(size_t bytes)
+    : owner_(default_allocator()), bytes_(bytes) {
+  d_ = owner_->allocate(bytes_);
+}
+
+SharedBufferAllocator::~SharedBufferAllocator() {
+  owner_->deallocate(d_, bytes_);
+}
+
+void* SharedBufferAllocator::allocate(size_t bytes) {
+  CHECK_LE(bytes, bytes_) << "the shared buffer is too small";
+  return d_;
+}
+
+ArenaAllocator::ArenaAllocator(size_t bytes)
+    : owner_(default_allocator()), bytes_(bytes), used_(0) {
+  d_ = static_cast<char*>(owner_->allocate(bytes_));
+}
+
+ArenaAllocator::~ArenaAllocator() { owner_->deallocate(d_, bytes_); }
+
+void* ArenaAllocator::allocate(size_t bytes) {
+  size_t size = block_size(bytes);
+  CHECK_LE(used_ + size, bytes_) << "the arena is full";
+  void* p = d_ + used_;
+  used_ += size;
+  return p;
+}
+
+namespace {
+
+AlignedAllocator g_aligned_allocator;
+std::atomic<Allocator*> g_default_allocator(&g_aligned_allocator);
+
+}  // namespace
+
+Allocator* default_allocator() { return g_default_allocator.load(); }
+
+Allocator* set_default_allocator(Allocator* allocator) {
+  if (!allocator) {
+    allocator = &g_aligned_allocator;
+  }
+  return g_default_allocator.exchange(allocator);
+}
+
+}  // namespace cnn
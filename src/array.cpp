@@ -14,6 +14,7 @@
   -----------------------------------------------------------------  */
 #include <glog/logging.h>
 
+#include <cstring>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -24,11 +25,23 @@
 namespace cnn {
 
 template <typename Dtype>
-Array<Dtype>::Array() : n_(0), c_(0), h_(0), w_(0), total_(0), d_(nullptr) {}
+constexpr int Array<Dtype>::kPadding;
+
+template <typename Dtype>
+Array<Dtype>::Array()
+    : n_(0),
+      c_(0),
+      h_(0),
+      w_(0),
+      total_(0),
+      d_(nullptr),
+      capacity_(0),
+      allocator_(nullptr),
+      owner_(nullptr) {}
 
 template <typename Dtype>
 Array<Dtype>::~Array() {
-  if (d_) delete[] d_;
+  release();
 }
 
 template <typename Dtype>
@@ -39,6 +52,9 @@ Array<Dtype>::Array(Array<Dtype>&& arr) {
   w_ = arr.w_;
   total_ = arr.total_;
   d_ = arr.d_;
+  capacity_ = arr.capacity_;
+  allocator_ = arr.allocator_;
+  owner_ = arr.owner_;
 
   arr.n_ = 0;
   arr.c_ = 0;
@@ -46,6 +62,8 @@ Array<Dtype>::Array(Array<Dtype>&& arr) {
   arr.w_ = 0;
   arr.total_ = 0;
   arr.d_ = nullptr;
+  arr.capacity_ = 0;
+  arr.owner_ = nullptr;
 }
 
 template <typename Dtype>
@@ -54,9 +72,7 @@ Array<Dtype>& Array<Dtype>::operator=(Array<Dtype>&& arr) {
     return *this;
   }
 
-  if (d_) {
-    delete[] d_;
-  }
+  release();
 
   n_ = arr.n_;
   c_ = arr.c_;
@@ -64,6 +80,9 @@ Array<Dtype>& Array<Dtype>::operator=(Array<Dtype>&& arr) {
   w_ = arr.w_;
   total_ = arr.total_;
   d_ = arr.d_;
+  capacity_ = arr.capacity_;
+  allocator_ = arr.allocator_;
+  owner_ = arr.owner_;
 
   arr.n_ = 0;
   arr.c_ = 0;
@@ -71,19 +90,22 @@ Array<Dtype>& Array<Dtype>::operator=(Array<Dtype>&& arr) {
   arr.w_ = 0;
   arr.total_ = 0;
   arr.d_ = nullptr;
+  arr.capacity_ = 0;
+  arr.owner_ = nullptr;
 
   return *this;
 }
 
 template <typename Dtype>
 template <typename U>
-void Array<Dtype>::init_like(const Array<U>& arr) {
+void Array<Dtype>::init_like(const Array<U>& arr, bool zero_fill /*= true*/) {
   if (this->has_same_shape(arr)) return;
-  init(arr.n_, arr.c_, arr.h_, arr.w_);
+  init(arr.n_, arr.c_, arr.h_, arr.w_, zero_fill);
 }
 
 template <typename Dtype>
-void Array<Dtype>::init(int n, int c, int h, int w) {
+void Array<Dtype>::init(int n, int c, int h, int w,
+                        bool zero_fill /*= true*/) {
   CHECK_GE(n, 0);
   CHECK_GE(c, 0);
   CHECK_GE(h, 0);
@@ -91,27 +113,51 @@ void Array<Dtype>::init(int n, int c, int h, int w) {
 
   int total = n * c * h * w;
   if (total == 0) {
-    if (d_) {
-      delete[] d_;
-      d_ = nullptr;
-    }
-    n_ = c_ = h_ = w_ = 0;
-    total_ = 0;
+    release();
     return;
   }
 
-  if (total != total_) {
-    if (d_) delete[] d_;
-
-    d_ = new Dtype[n * c * h * w];
+  int padded = (total + kPadding - 1) / kPadding * kPadding;
+  if (padded > capacity_) {
+    // free the old memory first, so that the peak usage does not
+    // include both
+    release();
+    owner_ = allocator_ ? allocator_ : default_allocator();
+    d_ = static_cast<Dtype*>(owner_->allocate(padded * sizeof(Dtype)));
+    capacity_ = padded;
   }
 
-  memset(d_, 0, total * sizeof(Dtype));
   n_ = n;
   c_ = c;
   h_ = h;
   w_ = w;
   total_ = total;
+
+  // all bits zero is 0 for float, double and Jet
+  if (zero_fill) {
+    memset(static_cast<void*>(d_), 0, padded * sizeof(Dtype));
+  } else  // NOLINT
+  {
+    memset(static_cast<void*>(d_ + total), 0, (padded - total) * sizeof(Dtype));
+  }
+}
+
+template <typename Dtype>
+void Array<Dtype>::set_allocator(Allocator* allocator) {
+  release();
+  allocator_ = allocator;
+}
+
+template <typename Dtype>
+void Array<Dtype>::release() {
+  if (d_) {
+    owner_->deallocate(d_, capacity_ * sizeof(Dtype));
+    d_ = nullptr;
+  }
+  owner_ = nullptr;
+  capacity_ = 0;
+  n_ = c_ = h_ = w_ = 0;
+  total_ = 0;
 }
 
 template <typename Dtype>
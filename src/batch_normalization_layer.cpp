@@ -16,6 +16,7 @@
 
 #include <vector>
 
+#include "cnn/array_expr.hpp"
 #include "cnn/batch_normalization_layer.hpp"
 #include "cnn/jet.hpp"
 #include "cnn/rng.hpp"
@@ -98,89 +99,90 @@ void BatchNormalizationLayer<Dtype>::fprop(
   auto& t = *top[0];
 
   auto num_elements = b.h_ * b.w_;
+  int grain = parallel_grain(num_elements * b.n_);
   if (this->proto_.phase() == TRAIN) {
     Dtype num_batch_elements = num_elements * b.n_;
-    for (int c = 0; c < b.c_; c++) {
-      Dtype total = 0;
-
-      // compute the sum across batches for the same channel
-      for (int n = 0; n < b.n_; n++) {
-        total += sum_arr(num_elements, &b(n, c, 0, 0));
-      }
-
-      // compute the mean
-      Dtype mean = total / num_batch_elements;
-      mu_[c] = mean;
-
-      auto& moving_mean = this->param_[2]->d_[c];
-      if (moving_mean == 0) {
-        moving_mean = mean;
-      } else  // NOLINT
-      {
-        moving_mean = moving_mean * momentum_ + mean * (Dtype(1) - momentum_);
-      }
+    // every channel is normalized independently
+    parallel_for(this->thread_pool_, 0, b.c_, grain, [&](int begin, int end) {
+      for (int c = begin; c < end; c++) {
+        Dtype total = 0;
+
+        // compute the sum across batches for the same channel
+        for (int n = 0; n < b.n_; n++) {
+          total += sum_arr(num_elements, &b(n, c, 0, 0));
+        }
 
-      // subtract the mean
-      for (int n = 0; n < b.n_; n++) {
-        sub_scalar(num_elements, mean, &b(n, c, 0, 0),
-                   &x_minus_mu_(n, c, 0, 0));
-      }
+        // compute the mean
+        Dtype mean = total / num_batch_elements;
+        mu_[c] = mean;
+
+        auto& moving_mean = this->param_[2]->d_[c];
+        if (moving_mean == 0) {
+          moving_mean = mean;
+        } else  // NOLINT
+        {
+          moving_mean =
+              moving_mean * momentum_ + mean * (Dtype(1) - momentum_);
+        }
 
-      // compute the sum of square (x - mu)*(x - mu)
-      total = 0;
-      for (int n = 0; n < b.n_; n++) {
-        total += sum_squared_arr(num_elements, &x_minus_mu_(n, c, 0, 0));
-      }
+        // subtract the mean
+        for (int n = 0; n < b.n_; n++) {
+          sub_scalar(num_elements, mean, &b(n, c, 0, 0),
+                     &x_minus_mu_(n, c, 0, 0));
+        }
 
-      total /= num_batch_elements;
+        // compute the sum of square (x - mu)*(x - mu)
+        total = 0;
+        for (int n = 0; n < b.n_; n++) {
+          total += sum_squared_arr(num_elements, &x_minus_mu_(n, c, 0, 0));
+        }
 
-      Dtype var = total + eps_;
-      var_[c] = var;
-      Dtype stddev = sqrt(var);
+        total /= num_batch_elements;
 
-      auto& moving_stddev = this->param_[3]->d_[c];
-      if (moving_stddev == 0) {
-        moving_stddev = stddev;
-      } else  // NOLINT
-      {
-        moving_stddev =
-            moving_stddev * momentum_ + stddev * (Dtype(1) - momentum_);
-      }
+        Dtype var = total + eps_;
+        var_[c] = var;
+        Dtype stddev = sqrt(var);
 
-      auto scale = this->param_[0]->d_[c] / stddev;
-      auto bias = this->param_[1]->d_[c];
+        auto& moving_stddev = this->param_[3]->d_[c];
+        if (moving_stddev == 0) {
+          moving_stddev = stddev;
+        } else  // NOLINT
+        {
+          moving_stddev =
+              moving_stddev * momentum_ + stddev * (Dtype(1) - momentum_);
+        }
 
-      for (int n = 0; n < b.n_; n++) {
-        scale_arr(num_elements, scale, &x_minus_mu_(n, c, 0, 0),
-                  &t(n, c, 0, 0));
+        auto scale = this->param_[0]->d_[c] / stddev;
+        auto bias = this->param_[1]->d_[c];
 
-        sub_scalar(num_elements, -bias, &t(n, c, 0, 0), &t(n, c, 0, 0));
+        for (int n = 0; n < b.n_; n++) {
+          assign(num_elements, &t(n, c, 0, 0),
+                 array_expr(num_elements, &x_minus_mu_(n, c, 0, 0)) * scale +
+                     bias);
+        }
       }
-    }
+    });
   }     // if (... == TRAIN)
   else  // NOLINT
   {
     // TEST
-    for (int c = 0; c < b.c_; c++) {
-      Dtype mean = this->param_[2]->d_[c];
-
-      // subtract the mean
-      for (int n = 0; n < b.n_; n++) {
-        sub_scalar(num_elements, mean, &b(n, c, 0, 0), &t(n, c, 0, 0));
-      }
-
-      // we have already added eps before
-      Dtype stddev = this->param_[3]->d_[c];
+    parallel_for(this->thread_pool_, 0, b.c_, grain, [&](int begin, int end) {
+      for (int c = begin; c < end; c++) {
+        Dtype mean = this->param_[2]->d_[c];
 
-      auto scale = this->param_[0]->d_[c] / stddev;
-      auto bias = this->param_[1]->d_[c];
+        // we have already added eps before
+        Dtype stddev = this->param_[3]->d_[c];
 
-      for (int n = 0; n < b.n_; n++) {
-        scale_arr(num_elements, scale, &t(n, c, 0, 0), &t(n, c, 0, 0));
+        auto scale = this->param_[0]->d_[c] / stddev;
+        auto bias = this->param_[1]->d_[c];
 
-        sub_scalar(num_elements, -bias, &t(n, c, 0, 0), &t(n, c, 0, 0));
+        for (int n = 0; n < b.n_; n++) {
+          assign(num_elements, &t(n, c, 0, 0),
+                 (array_expr(num_elements, &b(n, c, 0, 0)) - mean) * scale +
+                     bias);
+        }
       }
-    }
+    });
   }
 }
 
@@ -201,58 +203,62 @@ void BatchNormalizationLayer<Dtype>::bprop(
   auto& gamma_grad = *this->gradient_[0];
   auto& beta_grad = *this->gradient_[1];
 
-  for (int n = 0; n < t.n_; n++)
-    for (int c = 0; c < t.c_; c++)
-      for (int h = 0; h < t.h_; h++)
-        for (int w = 0; w < t.w_; w++) {
-          // gradient for gamma
-          gamma_grad[c] +=
-              tg(n, c, h, w) * (t(n, c, h, w) - beta[c]) / gamma[c];
-
-          // gradient for beta
-          beta_grad[c] += tg(n, c, h, w);
-        }
-
   auto num_elements = tg.h_ * tg.w_;
   Dtype num_batch_elements = num_elements * tg.n_;
-  for (int c = 0; c < t.c_; c++) {
-    // gradient for the variance
-    Dtype var = var_[c];
-    Dtype stddev = sqrt(var);
-    Dtype stddev3 = stddev * stddev * stddev;
-
-    Dtype var_grad = 0;
-    for (int n = 0; n < t.n_; n++) {
-      var_grad += ax_dot_by<Dtype>(num_elements, 1, &tg(n, c, 0, 0), 1,
-                                   &x_minus_mu_(n, c, 0, 0));
-    }
-    var_grad *= gamma[c] / Dtype(-2) / stddev3;
-
-    // gradient with respect to the mean
-    Dtype mu_grad = 0;
-    Dtype mu_grad1 = 0;
-    Dtype mu_grad2 = 0;
-    for (int n = 0; n < t.n_; n++) {
-      mu_grad1 += sum_arr(num_elements, &tg(n, c, 0, 0));
-      mu_grad2 += sum_arr(num_elements, &x_minus_mu_(n, c, 0, 0));
-    }
-    mu_grad1 *= gamma[c] / (-stddev);
-    mu_grad2 *= var_grad * Dtype(-2) / num_batch_elements;
-
-    mu_grad = mu_grad1 + mu_grad2;
-
-    // now for the bottom input
-    for (int n = 0; n < tg.n_; n++)
-      for (int h = 0; h < tg.h_; h++)
-        for (int w = 0; w < tg.w_; w++) {
-          Dtype part1 = gamma[c] * tg(n, c, h, w) / stddev;
-          Dtype part2 = var_grad * Dtype(2) / num_batch_elements *
-                        x_minus_mu_(n, c, h, w);
-          Dtype part3 = mu_grad / num_batch_elements;
+  // the reductions over a channel stay in one thread, so the
+  // result does not depend on the number of threads
+  int grain = parallel_grain(num_elements * tg.n_);
+  parallel_for(this->thread_pool_, 0, t.c_, grain, [&](int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      for (int n = 0; n < t.n_; n++)
+        for (int h = 0; h < t.h_; h++)
+          for (int w = 0; w < t.w_; w++) {
+            // gradient for gamma
+            gamma_grad[c] +=
+                tg(n, c, h, w) * (t(n, c, h, w) - beta[c]) / gamma[c];
+
+            // gradient for beta
+            beta_grad[c] += tg(n, c, h, w);
+          }
+
+      // gradient for the variance
+      Dtype var = var_[c];
+      Dtype stddev = sqrt(var);
+      Dtype stddev3 = stddev * stddev * stddev;
 
-          bg(n, c, h, w) = part1 + part2 + part3;
-        }
-  }
+      Dtype var_grad = 0;
+      for (int n = 0; n < t.n_; n++) {
+        var_grad += ax_dot_by<Dtype>(num_elements, 1, &tg(n, c, 0, 0), 1,
+                                     &x_minus_mu_(n, c, 0, 0));
+      }
+      var_grad *= gamma[c] / Dtype(-2) / stddev3;
+
+      // gradient with respect to the mean
+      Dtype mu_grad = 0;
+      Dtype mu_grad1 = 0;
+      Dtype mu_grad2 = 0;
+      for (int n = 0; n < t.n_; n++) {
+        mu_grad1 += sum_arr(num_elements, &tg(n, c, 0, 0));
+        mu_grad2 += sum_arr(num_elements, &x_minus_mu_(n, c, 0, 0));
+      }
+      mu_grad1 *= gamma[c] / (-stddev);
+      mu_grad2 *= var_grad * Dtype(-2) / num_batch_elements;
+
+      mu_grad = mu_grad1 + mu_grad2;
+
+      // now for the bottom input
+      for (int n = 0; n < tg.n_; n++)
+        for (int h = 0; h < tg.h_; h++)
+          for (int w = 0; w < tg.w_; w++) {
+            Dtype part1 = gamma[c] * tg(n, c, h, w) / stddev;
+            Dtype part2 = var_grad * Dtype(2) / num_batch_elements *
+                          x_minus_mu_(n, c, h, w);
+            Dtype part3 = mu_grad / num_batch_elements;
+
+            bg(n, c, h, w) = part1 + part2 + part3;
+          }
+    }
+  });
 }
 
 }  // namespace cnn
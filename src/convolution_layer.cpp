@@ -14,19 +14,46 @@
   -----------------------------------------------------------------  */
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 
 #include "cnn/convolution_layer.hpp"
 #include "cnn/rng.hpp"
 
 namespace {
-inline bool is_inside(int h, int w, int height, int width) {
-  return (h >= 0) && (h < height) && (w >= 0) && (w < width);
+// a / b rounded towards positive infinity for b > 0;
+// the result is only meaningful for a >= 0, it is at most 0 otherwise
+inline int ceil_div(int a, int b) { return (a + b - 1) / b; }
+
+// Output positions [begin, end) whose input position
+// p * stride + offset lies inside [0, size), for 0 <= p < out_size.
+inline void valid_range(int offset, int stride, int size, int out_size,
+                        int* begin, int* end) {
+  *begin = std::min(out_size, ceil_div(std::max(0, -offset), stride));
+  *end = std::max(*begin, std::min(out_size, ceil_div(size - offset, stride)));
+}
+
+// number of positions of a dilated kernel in a padded
+// input of the given size; 0 if it does not fit
+inline int output_size(int size, int pad, int kernel_size, int stride,
+                       int dilation) {
+  int extent = size + 2 * pad - dilation * (kernel_size - 1);
+  return (extent <= 0) ? 0 : (extent - 1) / stride + 1;
 }
 
 }  // namespace
 
 namespace cnn {
+template <typename Dtype>
+constexpr int ConvolutionLayer<Dtype>::kDirectOutputs;
+
+template <typename Dtype>
+constexpr int ConvolutionLayer<Dtype>::kDirectColumns;
+
+template <typename Dtype>
+constexpr int ConvolutionLayer<Dtype>::kWeightGradientParts;
+
 template <typename Dtype>
 ConvolutionLayer<Dtype>::ConvolutionLayer(const LayerProto& _proto)
     : Layer<Dtype>(_proto) {
@@ -34,9 +61,98 @@ ConvolutionLayer<Dtype>::ConvolutionLayer(const LayerProto& _proto)
   num_output_ = p.num_output();
   kernel_size_ = p.kernel_size();
 
+  stride_ = p.stride();
+  dilation_ = p.dilation();
+  group_ = p.group();
+
   CHECK_GE(num_output_, 1);
   CHECK_GE(kernel_size_, 1);
   CHECK(kernel_size_ & 1) << "the kernel size must be odd!";
+  CHECK_GE(stride_, 1);
+  CHECK_GE(dilation_, 1);
+  CHECK_GE(group_, 1);
+  CHECK_EQ(num_output_ % group_, 0)
+      << "num_output " << num_output_ << " is not divisible by group "
+      << group_;
+
+  // by default, the output has the same size as the input for stride 1
+  int pad = dilation_ * (kernel_size_ / 2);
+  pad_h_ = p.has_pad_h() ? p.pad_h() : pad;
+  pad_w_ = p.has_pad_w() ? p.pad_w() : pad;
+  CHECK_GE(pad_h_, 0);
+  CHECK_GE(pad_w_, 0);
+
+  use_fft_ = false;
+  use_depthwise_ = false;
+  use_pointwise_ = false;
+  weight_gradient_parts_ = 1;
+  set_algorithm(p.algorithm());
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::set_algorithm(
+    ConvolutionLayerProto::Algorithm algorithm) {
+  algorithm_ = algorithm;
+  if (algorithm_ == ConvolutionLayerProto::AUTO) {
+    // it is resolved by Network::reshape()
+    algorithm_ = ConvolutionLayerProto::IM2COL_GEMM;
+  } else if (!supports(algorithm_)) {
+    LOG(WARNING) << ConvolutionLayerProto::Algorithm_Name(algorithm_)
+                 << " does not support kernel size " << kernel_size_
+                 << ", stride " << stride_ << ", padding (" << pad_h_ << ", "
+                 << pad_w_ << "), dilation " << dilation_ << " and group "
+                 << group_
+                 << "; use IM2COL_GEMM instead";
+    algorithm_ = ConvolutionLayerProto::IM2COL_GEMM;
+  }
+
+  // WINOGRAD_2X2 and WINOGRAD_4X4 share the cache
+  winograd_weight_version_ = -1;
+  winograd_flipped_weight_version_ = -1;
+  fft_weight_version_ = -1;
+  fft_flipped_weight_version_ = -1;
+
+  if (uses_packed_weight() == this->packed_param_.empty()) {
+    // pack the weight, or release it, in the next update_packed_param()
+    this->packed_param_version_ = -1;
+  }
+}
+
+template <typename Dtype>
+bool ConvolutionLayer<Dtype>::supports(
+    ConvolutionLayerProto::Algorithm algorithm) const {
+  switch (algorithm) {
+    case ConvolutionLayerProto::DIRECT:
+    case ConvolutionLayerProto::IM2COL_GEMM:
+      return true;
+    case ConvolutionLayerProto::WINOGRAD_2X2:
+    case ConvolutionLayerProto::WINOGRAD_4X4:
+      return kernel_size_ == 3 && group_ == 1 && is_same_convolution();
+    case ConvolutionLayerProto::FFT:
+      return group_ == 1 && is_same_convolution();
+    case ConvolutionLayerProto::AUTO:
+      return false;
+    default:
+      LOG(FATAL) << "Unknown convolution algorithm: "
+                 << ConvolutionLayerProto::Algorithm_Name(algorithm);
+      return false;
+  }
+}
+
+template <typename Dtype>
+bool ConvolutionLayer<Dtype>::is_same_convolution() const {
+  int s = kernel_size_ / 2;
+  return stride_ == 1 && dilation_ == 1 && pad_h_ == s && pad_w_ == s;
+}
+
+template <typename Dtype>
+int ConvolutionLayer<Dtype>::output_height(int height) const {
+  return output_size(height, pad_h_, kernel_size_, stride_, dilation_);
+}
+
+template <typename Dtype>
+int ConvolutionLayer<Dtype>::output_width(int width) const {
+  return output_size(width, pad_w_, kernel_size_, stride_, dilation_);
 }
 
 template <typename Dtype>
@@ -48,7 +164,105 @@ void ConvolutionLayer<Dtype>::reshape(
   CHECK_EQ(bottom.size(), 1);
   CHECK_EQ(top.size(), 1);
 
-  top[0]->init(bottom[0]->n_, num_output_, bottom[0]->h_, bottom[0]->w_);
+  const auto& b = *bottom[0];
+  int out_h = output_height(b.h_);
+  int out_w = output_width(b.w_);
+  CHECK_GE(out_h, 1) << "the input is too small: " << b.shape_info();
+  CHECK_GE(out_w, 1) << "the input is too small: " << b.shape_info();
+
+  CHECK_EQ(b.c_ % group_, 0) << "the number of channels " << b.c_
+                             << " is not divisible by group " << group_;
+
+  top[0]->init(b.n_, num_output_, out_h, out_w);
+
+  switch (kernel_size_) {
+    case 1:
+      select_direct_kernels<1>();
+      break;
+    case 3:
+      select_direct_kernels<3>();
+      break;
+    case 5:
+      select_direct_kernels<5>();
+      break;
+    case 7:
+      select_direct_kernels<7>();
+      break;
+    default:
+      select_direct_kernels<0>();
+      break;
+  }
+
+  weight_gradient_parts_ = 1;
+
+  // every group has only one input channel, for which im2col + gemm
+  // is memory bound; see fprop_depthwise()
+  use_depthwise_ =
+      algorithm_ == ConvolutionLayerProto::IM2COL_GEMM && group_ == b.c_;
+
+  bool is_winograd = algorithm_ == ConvolutionLayerProto::WINOGRAD_2X2 ||
+                     algorithm_ == ConvolutionLayerProto::WINOGRAD_4X4;
+
+  use_fft_ = algorithm_ == ConvolutionLayerProto::FFT &&
+             FFTConvolution<Dtype>::is_faster_than_gemm(
+                 b.c_, b.h_, b.w_, num_output_, kernel_size_);
+
+  bool is_gemm = (algorithm_ == ConvolutionLayerProto::IM2COL_GEMM &&
+                  !use_depthwise_) ||
+                 (algorithm_ == ConvolutionLayerProto::FFT && !use_fft_);
+
+  // im2col() is the identity for 1x1 kernels without padding and stride
+  use_pointwise_ = is_gemm && kernel_size_ == 1 && stride_ == 1 &&
+                   pad_h_ == 0 && pad_w_ == 0;
+
+  // Winograd computes the weight gradient with gemm
+  if ((is_gemm && !use_pointwise_) ||
+      (is_winograd && this->proto().phase() == TRAIN)) {
+    // both are overwritten before they are read, so they are not zeroed
+    col_.init(1, 1, b.c_ * kernel_size_ * kernel_size_, b.n_ * out_h * out_w,
+              false);
+    if (b.n_ > 1) {
+      gemm_top_.init(1, 1, num_output_, b.n_ * out_h * out_w, false);
+    }
+
+    // see param_gradient()
+    int k = b.c_ / group_ * kernel_size_ * kernel_size_;
+    if (this->proto().phase() == TRAIN) {
+      weight_gradient_parts_ =
+          weight_gradient_parts(b.n_, b.n_ * out_h * out_w, k);
+    }
+    if (weight_gradient_parts_ > 1) {
+      partial_dw_.init(weight_gradient_parts_, 1, 1, num_output_ * k, false);
+    }
+  }
+
+  if (is_winograd) {
+    int size;
+    if (algorithm_ == ConvolutionLayerProto::WINOGRAD_2X2) {
+      using W = Winograd<Dtype, 2>;
+      size = W::kNumElements * W::num_tiles(b.n_, b.h_, b.w_);
+    } else  // NOLINT
+    {
+      using W = Winograd<Dtype, 4>;
+      size = W::kNumElements * W::num_tiles(b.n_, b.h_, b.w_);
+    }
+
+    // the input and output channels are swapped for the bottom gradient
+    size *= std::max(b.c_, num_output_);
+    winograd_v_.init(1, 1, 1, size);
+    winograd_m_.init(1, 1, 1, size);
+  }
+
+  if (use_fft_) {
+    fft_.init(b.h_, b.w_, kernel_size_);
+    int size = b.n_ * 2 * fft_.spectrum_size();
+    fft_x_.init(1, 1, 1, size * b.c_);
+    fft_y_.init(1, 1, 1, size * num_output_);
+
+    // the spectra depend on the padded size
+    fft_weight_version_ = -1;
+    fft_flipped_weight_version_ = -1;
+  }
 
   if (this->param_.empty()) {
     // param[0] is the kernel weight
@@ -56,7 +270,7 @@ void ConvolutionLayer<Dtype>::reshape(
     this->param_.resize(2);
 
     this->param_[0] = std::make_shared<Array<Dtype>>();
-    this->param_[0]->init(num_output_, bottom[0]->c_, kernel_size_,
+    this->param_[0]->init(num_output_, bottom[0]->c_ / group_, kernel_size_,
                           kernel_size_);
 
     // TODO(fangjun): use other strategies
@@ -67,12 +281,15 @@ void ConvolutionLayer<Dtype>::reshape(
 
     // TODO(fangjun): use other strategies
     gaussian<Dtype>(this->param_[1].get(), 0, 1);
+
+    // caches derived from the parameters are outdated
+    this->param_version_++;
   } else  // NOLINT
   {
     CHECK_EQ(this->param_.size(), 2);
 
     CHECK_EQ(this->param_[0]->n_, num_output_);
-    CHECK_EQ(this->param_[0]->c_, bottom[0]->c_);
+    CHECK_EQ(this->param_[0]->c_, bottom[0]->c_ / group_);
     CHECK_EQ(this->param_[0]->h_, kernel_size_);
     CHECK_EQ(this->param_[0]->w_, kernel_size_);
 
@@ -104,24 +321,389 @@ template <typename Dtype>
 void ConvolutionLayer<Dtype>::fprop(
     const std::vector<const Array<Dtype>*>& bottom,
     const std::vector<Array<Dtype>*>& top) {
-  const auto& b = *bottom[0];
-  auto& t = *top[0];
-  set_to<Dtype>(&t, 0);
+  switch (algorithm_) {
+    case ConvolutionLayerProto::DIRECT:
+      fprop_direct(*bottom[0], top[0]);
+      break;
+    case ConvolutionLayerProto::IM2COL_GEMM:
+      if (use_depthwise_) {
+        fprop_depthwise(*bottom[0], top[0]);
+      } else  // NOLINT
+      {
+        fprop_im2col_gemm(*bottom[0], top[0]);
+      }
+      break;
+    case ConvolutionLayerProto::WINOGRAD_2X2:
+      fprop_winograd<2>(*bottom[0], top[0]);
+      break;
+    case ConvolutionLayerProto::WINOGRAD_4X4:
+      fprop_winograd<4>(*bottom[0], top[0]);
+      break;
+    case ConvolutionLayerProto::FFT:
+      if (use_fft_) {
+        fprop_fft(*bottom[0], top[0]);
+      } else  // NOLINT
+      {
+        fprop_im2col_gemm(*bottom[0], top[0]);
+      }
+      break;
+    case ConvolutionLayerProto::AUTO:  // resolved by set_algorithm()
+    default:
+      LOG(FATAL) << "Unknown convolution algorithm: "
+                 << ConvolutionLayerProto::Algorithm_Name(algorithm_);
+      break;
+  }
+}
 
-  int h = b.h_;
-  int w = b.w_;
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::pack_param() {
+  if (this->param_.empty()) {
+    // it is initialized in reshape()
+    this->packed_param_.clear();
+    return;
+  }
+
+  if (!uses_packed_weight()) {
+    // cblas reads the weight as it is
+    this->packed_param_.clear();
+    return;
+  }
 
-  int num_pixels = h * w;
+  const auto& w = *this->param_[0];
+  int m = num_output_ / group_;
+  int k = w.c_ * w.h_ * w.w_;
+  int size = gemm_packed_size(m, k);
 
-  for (int n = 0; n < b.n_; n++)
-    for (int i = 0; i < num_output_; i++) {
-      // add the bias
-      set_to<Dtype>(num_pixels, &t(n, i, 0, 0), this->param_[1]->d_[i]);
-      for (int c = 0; c < b.c_; c++) {
-        one_channel_convolution(&this->param_[0]->operator()(i, c, 0, 0),
-                                &b(n, c, 0, 0), b.h_, b.w_, &t(n, i, 0, 0));
+  // reuse the memory, since it is packed after every update
+  if (this->packed_param_.size() != 1) {
+    this->packed_param_.assign(1, std::make_shared<Array<Dtype>>());
+  }
+  auto* packed = this->packed_param_[0].get();
+  packed->init(1, 1, group_, size);
+  for (int g = 0; g < group_; g++) {
+    gemm_pack<Dtype>(false, m, k, w.d_ + g * m * k, k, packed_kc(k),
+                     packed->d_ + g * size);
+  }
+}
+
+template <typename Dtype>
+const Dtype* ConvolutionLayer<Dtype>::packed_weight() {
+  const auto& w = *this->param_[0];
+  int size = gemm_packed_size(num_output_ / group_, w.c_ * w.h_ * w.w_);
+  return this->packed_param_data(group_ * size);
+}
+
+template <typename Dtype>
+bool ConvolutionLayer<Dtype>::uses_packed_weight() const {
+  return !Blas<Dtype>::kEnabled ||
+         algorithm_ == ConvolutionLayerProto::DIRECT;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::weight_gemm(int g, int n, const Dtype* b,
+                                          Dtype beta, Dtype* c) {
+  const auto& w = *this->param_[0];
+  int m = num_output_ / group_;
+  int k = w.c_ * w.h_ * w.w_;
+
+  if (!uses_packed_weight()) {
+    gemm<Dtype>(this->thread_pool_, false, false, m, n, k, 1,
+                w.d_ + g * m * k, k, b, n, beta, c, n);
+    return;
+  }
+
+  const Dtype* weight = packed_weight();
+  gemm_packed<Dtype>(this->thread_pool_, false, m, n, k, 1,
+                     weight + g * gemm_packed_size(m, k), packed_kc(k), b, n,
+                     beta, c, n);
+}
+
+template <typename Dtype>
+int ConvolutionLayer<Dtype>::packed_kc(int k) const {
+  int kernel_area = kernel_size_ * kernel_size_;
+
+  // as many blocks as gemm() would use, each one rounded up to
+  // whole kernels; one block more would cost one more pass over
+  // the output
+  static constexpr int kKC = internal::GemmBlocking::kKC;
+  int num_blocks = ceil_div(k, kKC);
+  int kc = ceil_div(ceil_div(k, num_blocks), kernel_area) * kernel_area;
+
+  // no wider than kKC, the most gemm_reserve_buffers() reserves
+  if (kc > kKC && kernel_area <= kKC) {
+    kc = kKC / kernel_area * kernel_area;
+  }
+  return kc;
+}
+
+template <typename Dtype>
+const Dtype* ConvolutionLayer<Dtype>::packed_kernel(const Dtype* weight,
+                                                    int group_channels,
+                                                    int panel, int c) const {
+  static constexpr int kMR = internal::GemmBlocking::kMR;
+
+  int kernel_area = kernel_size_ * kernel_size_;
+  int k = group_channels * kernel_area;
+  int padded_m = gemm_packed_size(num_output_ / group_, 1);
+
+  // channel c is in the block of columns [pc, pc + kc)
+  int block_size = packed_kc(k);
+  int block_channels = block_size / kernel_area;
+  int pc = c / block_channels * block_size;
+  int kc = std::min(block_size, k - pc);
+
+  return weight + pc * padded_m + panel * kMR * kc +
+         (c % block_channels) * kernel_area * kMR;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::fprop_direct(const Array<Dtype>& b,
+                                           Array<Dtype>* top) {
+  // the B scales of a tap are contiguous in the packed weight
+  static_assert(internal::GemmBlocking::kMR == kDirectOutputs,
+                "a block of outputs has to be a packed panel");
+
+  auto& t = *top;
+  int num_pixels = t.h_ * t.w_;
+
+  // output i reads the input channels of its group
+  int group_channels = b.c_ / group_;
+  int group_outputs = num_output_ / group_;
+
+  const Dtype* weight = packed_weight();
+  int k = group_channels * kernel_size_ * kernel_size_;
+  int packed_size = gemm_packed_size(group_outputs, k);
+
+  // a task is a block of outputs of a group of an image
+  int num_blocks = ceil_div(group_outputs, kDirectOutputs);
+  int num_tasks = b.n_ * group_ * num_blocks;
+  int grain = parallel_grain(int64_t(num_pixels) * kDirectOutputs * k);
+  auto run = [&](int begin, int end) {
+    for (int task = begin; task < end; task++) {
+      int n = task / (group_ * num_blocks);
+      int g = task / num_blocks % group_;
+      int first_channel = g * group_channels;
+      int o = g * group_outputs + task % num_blocks * kDirectOutputs;
+      int last = std::min(o + kDirectOutputs, (g + 1) * group_outputs);
+      for (int i = o; i < last; i++) {
+        set_to<Dtype>(num_pixels, &t(n, i, 0, 0), this->param_[1]->d_[i]);
+      }
+
+      (this->*direct_kernels_[last - o - 1])(b, n, first_channel, o,
+                                             weight + g * packed_size, top);
+    }
+  };
+  parallel_for(this->thread_pool_, 0, num_tasks, grain, run);
+}
+
+template <typename Dtype>
+template <int B, int K>
+void ConvolutionLayer<Dtype>::fprop_direct_block(const Array<Dtype>& b, int n,
+                                                 int first_channel,
+                                                 int first_output,
+                                                 const Dtype* weight,
+                                                 Array<Dtype>* top) {
+  static constexpr int kW = kDirectColumns;
+  static constexpr int kMR = kDirectOutputs;
+
+  // the outputs are a panel of the packed weight
+  int panel = first_output % (num_output_ / group_) / kMR;
+
+  // a compile time constant unless K is 0
+  const int kernel_size = (K > 0) ? K : kernel_size_;
+
+  auto& t = *top;
+  int group_channels = b.c_ / group_;
+
+  // the interior columns [x_begin, x_end) read only pixels inside
+  // the image for every tap
+  int x_begin;
+  int x_end;
+  valid_range(-pad_w_, stride_, b.w_ - dilation_ * (kernel_size - 1), t.w_,
+              &x_begin, &x_end);
+
+  Dtype* dst[B];
+  Dtype acc[B][kW];
+  Dtype scale[B];
+
+  for (int h = 0; h < t.h_; h++) {
+    for (int k = 0; k < B; k++) {
+      dst[k] = &t(n, first_output + k, h, 0);
+    }
+
+    // the kernel rows [i_begin, i_end) are inside the image
+    int y0 = h * stride_ - pad_h_;
+    int i_begin;
+    int i_end;
+    valid_range(y0, dilation_, b.h_, kernel_size, &i_begin, &i_end);
+
+    // interior: B outputs times kW columns are accumulated in
+    // registers over all taps without any bounds checks; the
+    // input patch of a block is only a few rows of kW pixels
+    // per channel, so it stays in the L1 cache
+    int x = x_begin;
+    while (x_end - x_begin >= kW && x < x_end) {
+      // the last block is moved left to end at x_end, overlapping
+      // the previous one; the overlapped columns are not stored again
+      int skip = std::max(0, x + kW - x_end);
+      x -= skip;
+
+      for (int k = 0; k < B; k++)
+        for (int v = 0; v < kW; v++) acc[k][v] = Dtype(0);
+
+      for (int c = 0; c < group_channels; c++) {
+        const Dtype* src = &b(n, first_channel + c, 0, 0);
+        const Dtype* w = packed_kernel(weight, group_channels, panel, c);
+        for (int i = i_begin; i < i_end; i++) {
+          const Dtype* src_row =
+              src + (y0 + i * dilation_) * b.w_ + x * stride_ - pad_w_;
+          for (int j = 0; j < kernel_size; j++) {
+            for (int k = 0; k < B; k++) {
+              scale[k] = w[(i * kernel_size + j) * kMR + k];
+            }
+            const Dtype* s = src_row + j * dilation_;
+            if (stride_ == 1) {
+              for (int k = 0; k < B; k++)
+                for (int v = 0; v < kW; v++) acc[k][v] += scale[k] * s[v];
+            } else  // NOLINT
+            {
+              for (int k = 0; k < B; k++)
+                for (int v = 0; v < kW; v++) {
+                  acc[k][v] += scale[k] * s[v * stride_];
+                }
+            }
+          }
+        }
       }
+
+      for (int k = 0; k < B; k++)
+        for (int v = skip; v < kW; v++) dst[k][x + v] += acc[k][v];
+      x += kW;
     }
+
+    // the border and narrow interiors, one column at a time;
+    // the valid taps are computed per column, not per tap
+    int columns[2][2] = {{0, x_begin}, {x, t.w_}};
+    for (const auto& range : columns)
+      for (x = range[0]; x < range[1]; x++) {
+        int x0 = x * stride_ - pad_w_;
+        int j_begin;
+        int j_end;
+        valid_range(x0, dilation_, b.w_, kernel_size, &j_begin, &j_end);
+
+        for (int k = 0; k < B; k++) acc[k][0] = Dtype(0);
+        for (int c = 0; c < group_channels; c++) {
+          const Dtype* src = &b(n, first_channel + c, 0, 0);
+          const Dtype* w = packed_kernel(weight, group_channels, panel, c);
+          for (int i = i_begin; i < i_end; i++) {
+            const Dtype* src_row = src + (y0 + i * dilation_) * b.w_;
+            for (int j = j_begin; j < j_end; j++) {
+              Dtype pixel = src_row[x0 + j * dilation_];
+              const Dtype* tap = w + (i * kernel_size + j) * kMR;
+              for (int k = 0; k < B; k++) {
+                acc[k][0] += tap[k] * pixel;
+              }
+            }
+          }
+        }
+        for (int k = 0; k < B; k++) dst[k][x] += acc[k][0];
+      }
+  }
+}
+
+template <typename Dtype>
+template <int K>
+void ConvolutionLayer<Dtype>::select_direct_kernels() {
+  direct_kernels_[0] = &ConvolutionLayer::fprop_direct_block<1, K>;
+  direct_kernels_[1] = &ConvolutionLayer::fprop_direct_block<2, K>;
+  direct_kernels_[2] = &ConvolutionLayer::fprop_direct_block<3, K>;
+  direct_kernels_[3] = &ConvolutionLayer::fprop_direct_block<4, K>;
+  static_assert(kDirectOutputs == 4, "update direct_kernels_");
+
+  direct_bprop_ = &ConvolutionLayer::one_channel_bprop<K>;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::fprop_im2col_gemm(const Array<Dtype>& b,
+                                                Array<Dtype>* top) {
+  if (use_pointwise_) {
+    fprop_pointwise(b, top);
+    return;
+  }
+
+  auto& t = *top;
+
+  int num_pixels = t.h_ * t.w_;
+  int num_cols = b.n_ * num_pixels;
+
+  // group g multiplies rows [g*m, (g+1)*m) of the weight
+  // with rows [g*k, (g+1)*k) of col
+  int m = num_output_ / group_;
+  int k = b.c_ / group_ * kernel_size_ * kernel_size_;
+
+  im2col(b, col_.d_);
+
+  const Dtype* bias = this->param_[1]->d_;
+
+  if (b.n_ == 1) {
+    // the gemm output has the same layout as the top,
+    // so we can write to it directly
+    for (int i = 0; i < num_output_; i++) {
+      set_to<Dtype>(num_pixels, &t(0, i, 0, 0), bias[i]);
+    }
+    for (int g = 0; g < group_; g++) {
+      weight_gemm(g, num_pixels, col_.d_ + g * k * num_pixels, 1,
+                  t.d_ + g * m * num_pixels);
+    }
+    return;
+  }
+
+  for (int g = 0; g < group_; g++) {
+    weight_gemm(g, num_cols, col_.d_ + g * k * num_cols, 0,
+                gemm_top_.d_ + g * m * num_cols);
+  }
+
+  // (num_output, N*H'*W') -> (N, num_output, H'*W'), where
+  // H' x W' is the size of the output
+  parallel_for(this->thread_pool_, 0, b.n_ * num_output_,
+               parallel_grain(num_pixels), [&](int begin, int end) {
+                 for (int j = begin; j < end; j++) {
+                   int n = j / num_output_;
+                   int i = j % num_output_;
+                   const Dtype* src =
+                       gemm_top_.d_ + i * num_cols + n * num_pixels;
+                   Dtype* dst = &t(n, i, 0, 0);
+                   for (int p = 0; p < num_pixels; p++) {
+                     dst[p] = src[p] + bias[i];
+                   }
+                 }
+               });
+}
+
+template <typename Dtype>
+template <int M>
+void ConvolutionLayer<Dtype>::fprop_winograd(const Array<Dtype>& b,
+                                             Array<Dtype>* top) {
+  if (winograd_weight_version_ != this->param_version()) {
+    Winograd<Dtype, M>::transform_weight(*this->param_[0], false,
+                                         &winograd_weight_);
+    winograd_weight_version_ = this->param_version();
+  }
+
+  Winograd<Dtype, M>::convolve(b, winograd_weight_, this->param_[1]->d_,
+                               false, winograd_v_.d_, winograd_m_.d_, top);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::fprop_fft(const Array<Dtype>& b,
+                                        Array<Dtype>* top) {
+  if (fft_weight_version_ != this->param_version()) {
+    fft_.transform_weight(*this->param_[0], false, &fft_weight_);
+    fft_weight_version_ = this->param_version();
+  }
+
+  fft_.convolve(b, fft_weight_, this->param_[1]->d_, false, fft_x_.d_,
+                fft_y_.d_, top);
 }
 
 template <typename Dtype>
@@ -130,70 +712,556 @@ void ConvolutionLayer<Dtype>::bprop(
     const std::vector<Array<Dtype>*>& bottom_gradient,
     const std::vector<const Array<Dtype>*>& /*top*/,
     const std::vector<const Array<Dtype>*>& top_gradient) {
-  const auto& b = *bottom[0];
-  auto& bg = *bottom_gradient[0];
+  switch (algorithm_) {
+    case ConvolutionLayerProto::DIRECT:
+      bprop_direct(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+      break;
+    case ConvolutionLayerProto::IM2COL_GEMM:
+      if (use_depthwise_) {
+        bprop_depthwise(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+      } else  // NOLINT
+      {
+        bprop_im2col_gemm(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+      }
+      break;
+    case ConvolutionLayerProto::WINOGRAD_2X2:
+      bprop_winograd<2>(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+      break;
+    case ConvolutionLayerProto::WINOGRAD_4X4:
+      bprop_winograd<4>(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+      break;
+    case ConvolutionLayerProto::FFT:
+      if (use_fft_) {
+        bprop_fft(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+      } else  // NOLINT
+      {
+        bprop_im2col_gemm(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+      }
+      break;
+    case ConvolutionLayerProto::AUTO:  // resolved by set_algorithm()
+    default:
+      LOG(FATAL) << "Unknown convolution algorithm: "
+                 << ConvolutionLayerProto::Algorithm_Name(algorithm_);
+      break;
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::bprop_direct(const Array<Dtype>& b,
+                                           const Array<Dtype>& tg,
+                                           Array<Dtype>* bottom_gradient) {
+  auto& bg = *bottom_gradient;
 
-  const auto& tg = *top_gradient[0];
+  int group_channels = b.c_ / group_;
+  int group_outputs = num_output_ / group_;
 
+  // an input channel is read only by the outputs of its group,
+  // so every thread writes its own planes of bg and its own
+  // kernels of the weight gradient
+  int64_t cost = int64_t(b.n_) * group_outputs * tg.h_ * tg.w_ *
+                 kernel_size_ * kernel_size_;
+  auto run = [&](int begin, int end) {
+    for (int channel = begin; channel < end; channel++) {
+      int g = channel / group_channels;
+      int c = channel % group_channels;
+      for (int n = 0; n < b.n_; n++)
+        for (int i = g * group_outputs; i < (g + 1) * group_outputs; i++) {
+          (this->*direct_bprop_)(&this->param_[0]->operator()(i, c, 0, 0),
+                                 &b(n, channel, 0, 0), b.h_, b.w_, tg.h_,
+                                 tg.w_, &tg(n, i, 0, 0), &bg(n, channel, 0, 0),
+                                 &this->gradient_[0]->operator()(i, c, 0, 0));
+        }
+    }
+  };
+  parallel_for(this->thread_pool_, 0, b.c_, parallel_grain(cost), run);
+
+  // gradient for the bias
+  for (int n = 0; n < b.n_; n++)
+    for (int i = 0; i < num_output_; i++) {
+      this->gradient_[1]->d_[i] += sum_arr(tg.h_ * tg.w_, &tg(n, i, 0, 0));
+    }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::bprop_im2col_gemm(const Array<Dtype>& b,
+                                                const Array<Dtype>& tg,
+                                                Array<Dtype>* bottom_gradient) {
+  if (use_pointwise_) {
+    bprop_pointwise(b, tg, bottom_gradient);
+    return;
+  }
+
+  int num_cols = tg.n_ * tg.h_ * tg.w_;
+  int m = num_output_ / group_;
+  int k = b.c_ / group_ * kernel_size_ * kernel_size_;
+
+  const Dtype* dy = param_gradient(b, tg);
+
+  // gradient for the bottom; col_ is no longer needed,
+  // so we reuse it to save dcol
+  const Dtype* weight = this->param_[0]->d_;
+  for (int g = 0; g < group_; g++) {
+    gemm<Dtype>(this->thread_pool_, true, false, k, num_cols, m, 1,
+                weight + g * m * k, k, dy + g * m * num_cols, num_cols, 0,
+                col_.d_ + g * k * num_cols, num_cols);
+  }
+  col2im(col_.d_, bottom_gradient);
+}
+
+template <typename Dtype>
+template <int M>
+void ConvolutionLayer<Dtype>::bprop_winograd(const Array<Dtype>& b,
+                                             const Array<Dtype>& tg,
+                                             Array<Dtype>* bottom_gradient) {
+  param_gradient(b, tg);
+
+  if (winograd_flipped_weight_version_ != this->param_version()) {
+    Winograd<Dtype, M>::transform_weight(*this->param_[0], true,
+                                         &winograd_flipped_weight_);
+    winograd_flipped_weight_version_ = this->param_version();
+  }
+
+  Winograd<Dtype, M>::convolve(tg, winograd_flipped_weight_, nullptr, true,
+                               winograd_v_.d_, winograd_m_.d_,
+                               bottom_gradient);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::bprop_fft(const Array<Dtype>& b,
+                                        const Array<Dtype>& tg,
+                                        Array<Dtype>* bottom_gradient) {
+  // gradient for the bias
   for (int n = 0; n < b.n_; n++)
     for (int i = 0; i < num_output_; i++) {
-      for (int c = 0; c < b.c_; c++) {
-        one_channel_bprop(&this->param_[0]->operator()(i, c, 0, 0),
-                          &b(n, c, 0, 0), b.h_, b.w_, &tg(n, i, 0, 0),
-                          &bg(n, c, 0, 0),
-                          &this->gradient_[0]->operator()(i, c, 0, 0));
-      }
-      // gradient for the bias
       this->gradient_[1]->d_[i] += sum_arr(b.h_ * b.w_, &tg(n, i, 0, 0));
     }
+
+  // gradient for the weight
+  fft_.forward(b, fft_x_.d_);
+  fft_.forward(tg, fft_y_.d_);
+  fft_.weight_gradient(fft_x_.d_, fft_y_.d_, b.n_, this->gradient_[0].get());
+
+  // gradient for the bottom; the spectra of the bottom
+  // are no longer needed, so we reuse fft_x_
+  if (fft_flipped_weight_version_ != this->param_version()) {
+    fft_.transform_weight(*this->param_[0], true, &fft_flipped_weight_);
+    fft_flipped_weight_version_ = this->param_version();
+  }
+
+  fft_.multiply(fft_y_.d_, b.n_, fft_flipped_weight_, fft_x_.d_);
+  fft_.inverse(fft_x_.d_, nullptr, true, bottom_gradient);
 }
 
 template <typename Dtype>
-void ConvolutionLayer<Dtype>::one_channel_convolution(const Dtype* weight,
-                                                      const Dtype* src,
-                                                      int height, int width,
-                                                      Dtype* dst) {
-  // we assume the anchor is at the center of the kernel
-  int s = kernel_size_ / 2;
-  for (int h = 0; h < height; h++)
-    for (int w = 0; w < width; w++) {
-      Dtype t = 0;
-      for (int i = -s; i <= s; i++)
-        for (int j = -s; j <= s; j++) {
-          if (!is_inside(h + i, w + j, height, width)) {
+void ConvolutionLayer<Dtype>::fprop_pointwise(const Array<Dtype>& b,
+                                              Array<Dtype>* top) {
+  auto& t = *top;
+  int num_pixels = b.h_ * b.w_;
+  int m = num_output_ / group_;
+  int k = b.c_ / group_;
+
+  const Dtype* bias = this->param_[1]->d_;
+
+  for (int n = 0; n < b.n_; n++) {
+    for (int i = 0; i < num_output_; i++) {
+      set_to<Dtype>(num_pixels, &t(n, i, 0, 0), bias[i]);
+    }
+
+    // sample n is a matrix of shape (C, H*W)
+    for (int g = 0; g < group_; g++) {
+      weight_gemm(g, num_pixels, &b(n, g * k, 0, 0), 1, &t(n, g * m, 0, 0));
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::bprop_pointwise(const Array<Dtype>& b,
+                                              const Array<Dtype>& tg,
+                                              Array<Dtype>* bottom_gradient) {
+  auto& bg = *bottom_gradient;
+  int num_pixels = b.h_ * b.w_;
+  int m = num_output_ / group_;
+  int k = b.c_ / group_;
+
+  const Dtype* weight = this->param_[0]->d_;
+  Dtype* dweight = this->gradient_[0]->d_;
+  Dtype* dbias = this->gradient_[1]->d_;
+
+  for (int n = 0; n < b.n_; n++) {
+    for (int i = 0; i < num_output_; i++) {
+      dbias[i] += sum_arr(num_pixels, &tg(n, i, 0, 0));
+    }
+
+    for (int g = 0; g < group_; g++) {
+      const Dtype* dy = &tg(n, g * m, 0, 0);
+
+      // dW += dY * X^T
+      gemm<Dtype>(this->thread_pool_, false, true, m, k, num_pixels, 1, dy,
+                  num_pixels, &b(n, g * k, 0, 0), num_pixels, 1,
+                  dweight + g * m * k, k);
+
+      // dX += W^T * dY
+      gemm<Dtype>(this->thread_pool_, true, false, k, num_pixels, m, 1,
+                  weight + g * m * k, k, dy, num_pixels, 1,
+                  &bg(n, g * k, 0, 0), num_pixels);
+    }
+  }
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::fprop_depthwise(const Array<Dtype>& b,
+                                              Array<Dtype>* top) {
+  auto& t = *top;
+  int kernel_area = kernel_size_ * kernel_size_;
+  int multiplier = num_output_ / b.c_;
+
+  const Dtype* weight = this->param_[0]->d_;
+  const Dtype* bias = this->param_[1]->d_;
+
+  // every output plane of every image is independent
+  auto run = [&](int begin, int end) {
+    for (int task = begin; task < end; task++) {
+      int n = task / num_output_;
+      int o = task % num_output_;
+      const Dtype* src = &b(n, o / multiplier, 0, 0);
+      const Dtype* w = weight + o * kernel_area;
+      Dtype* dst = &t(n, o, 0, 0);
+      set_to<Dtype>(t.h_ * t.w_, dst, bias[o]);
+
+      // one output row at a time, so that it stays in the cache
+      // while all taps are accumulated into it
+      for (int h = 0; h < t.h_; h++, dst += t.w_)
+        for (int i = 0; i < kernel_size_; i++) {
+          int y = h * stride_ + i * dilation_ - pad_h_;
+          if (y < 0 || y >= b.h_) {
             continue;
           }
+          const Dtype* src_row = src + y * b.w_;
+
+          for (int j = 0; j < kernel_size_; j++) {
+            int dj = j * dilation_ - pad_w_;
+            int w_begin;
+            int w_end;
+            valid_range(dj, stride_, b.w_, t.w_, &w_begin, &w_end);
+
+            Dtype scale = w[i * kernel_size_ + j];
+            const Dtype* s = src_row + dj;
+            if (stride_ == 1) {
+              for (int x = w_begin; x < w_end; x++) dst[x] += scale * s[x];
+            } else  // NOLINT
+            {
+              for (int x = w_begin; x < w_end; x++) {
+                dst[x] += scale * s[x * stride_];
+              }
+            }
+          }
+        }
+    }
+  };
+  parallel_for(this->thread_pool_, 0, b.n_ * num_output_,
+               parallel_grain(t.h_ * t.w_ * kernel_area), run);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::bprop_depthwise(const Array<Dtype>& b,
+                                              const Array<Dtype>& tg,
+                                              Array<Dtype>* bottom_gradient) {
+  auto& bg = *bottom_gradient;
+  int kernel_area = kernel_size_ * kernel_size_;
+  int multiplier = num_output_ / b.c_;
+
+  const Dtype* weight = this->param_[0]->d_;
+  Dtype* dweight = this->gradient_[0]->d_;
+  Dtype* dbias = this->gradient_[1]->d_;
+
+  // the outputs of an input channel are the only ones that write
+  // to its gradient, and they write to their own kernels
+  auto run = [&](int begin, int end) {
+    for (int c = begin; c < end; c++)
+      for (int n = 0; n < b.n_; n++)
+        for (int o = c * multiplier; o < (c + 1) * multiplier; o++) {
+          const Dtype* src = &b(n, o / multiplier, 0, 0);
+          Dtype* dsrc = &bg(n, o / multiplier, 0, 0);
+          const Dtype* w = weight + o * kernel_area;
+          Dtype* dw = dweight + o * kernel_area;
+          const Dtype* dy = &tg(n, o, 0, 0);
+
+          dbias[o] += sum_arr(tg.h_ * tg.w_, dy);
+
+          for (int h = 0; h < tg.h_; h++, dy += tg.w_)
+            for (int i = 0; i < kernel_size_; i++) {
+              int y = h * stride_ + i * dilation_ - pad_h_;
+              if (y < 0 || y >= b.h_) {
+                continue;
+              }
+
+              for (int j = 0; j < kernel_size_; j++) {
+                int dj = j * dilation_ - pad_w_;
+                int w_begin;
+                int w_end;
+                valid_range(dj, stride_, b.w_, tg.w_, &w_begin, &w_end);
+
+                Dtype scale = w[i * kernel_size_ + j];
+                const Dtype* s = src + y * b.w_ + dj;
+                Dtype* ds = dsrc + y * b.w_ + dj;
+                Dtype sum = 0;
+                for (int x = w_begin; x < w_end; x++) {
+                  ds[x * stride_] += scale * dy[x];
+                  sum += dy[x] * s[x * stride_];
+                }
+                dw[i * kernel_size_ + j] += sum;
+              }
+            }
+        }
+  };
+  parallel_for(this->thread_pool_, 0, b.c_,
+               parallel_grain(int64_t(b.n_) * multiplier * tg.h_ * tg.w_ *
+                              kernel_area),
+               run);
+}
+
+template <typename Dtype>
+const Dtype* ConvolutionLayer<Dtype>::param_gradient(const Array<Dtype>& b,
+                                                     const Array<Dtype>& tg) {
+  int num_pixels = tg.h_ * tg.w_;
+  int num_cols = b.n_ * num_pixels;
+
+  // (N, num_output, H'*W') -> (num_output, N*H'*W')
+  const Dtype* dy = tg.d_;
+  if (b.n_ > 1) {
+    parallel_for(this->thread_pool_, 0, b.n_ * num_output_,
+                 parallel_grain(num_pixels), [&](int begin, int end) {
+                   for (int j = begin; j < end; j++) {
+                     int n = j / num_output_;
+                     int i = j % num_output_;
+                     const Dtype* src = &tg(n, i, 0, 0);
+                     Dtype* dst =
+                         gemm_top_.d_ + i * num_cols + n * num_pixels;
+                     std::copy(src, src + num_pixels, dst);
+                   }
+                 });
+    dy = gemm_top_.d_;
+  }
+
+  // gradient for the bias
+  parallel_for(this->thread_pool_, 0, num_output_, parallel_grain(num_cols),
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   this->gradient_[1]->d_[i] +=
+                       sum_arr(num_cols, dy + i * num_cols);
+                 }
+               });
+
+  // gradient for the weight
+  im2col(b, col_.d_);
+  int parts = weight_gradient_parts_;
+  if (parts == 1) {
+    weight_gradient(dy, col_.d_, num_pixels, num_cols, 0, b.n_, 1,
+                    this->gradient_[0]->d_);
+    return dy;
+  }
+
+  parallel_for(this->thread_pool_, 0, parts, 1, [&](int begin, int end) {
+    for (int p = begin; p < end; p++) {
+      weight_gradient(dy, col_.d_, num_pixels, num_cols, p * b.n_ / parts,
+                      (p + 1) * b.n_ / parts, 0, &partial_dw_(p, 0, 0, 0));
+    }
+  });
 
-          Dtype pixel = src[(h + i) * width + (w + j)];
-          Dtype scale = weight[(i + s) * kernel_size_ + (j + s)];
-          t += pixel * scale;
+  int size = partial_dw_.w_;
+  Dtype* dw = this->gradient_[0]->d_;
+  parallel_for(this->thread_pool_, 0, size, parallel_grain(parts),
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   Dtype sum = partial_dw_(0, 0, 0, i);
+                   for (int p = 1; p < parts; p++) {
+                     sum += partial_dw_(p, 0, 0, i);
+                   }
+                   dw[i] += sum;
+                 }
+               });
+
+  return dy;
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::weight_gradient(const Dtype* dy,
+                                              const Dtype* col,
+                                              int num_pixels, int num_cols,
+                                              int n_begin, int n_end,
+                                              Dtype beta, Dtype* dw) {
+  int m = num_output_ / group_;
+  int k = col_.h_ / group_;
+  int offset = n_begin * num_pixels;
+  int len = (n_end - n_begin) * num_pixels;
+  for (int g = 0; g < group_; g++) {
+    gemm<Dtype>(this->thread_pool_, false, true, m, k, len, 1,
+                dy + g * m * num_cols + offset, num_cols,
+                col + g * k * num_cols + offset, num_cols, beta,
+                dw + g * m * k, k);
+  }
+}
+
+template <typename Dtype>
+int ConvolutionLayer<Dtype>::weight_gradient_parts(int n, int num_cols,
+                                                   int k) const {
+  // the column chunks of gemm(ThreadPool*, ...) for dW = dY * col^T
+  int m = num_output_ / group_;
+  int grain =
+      internal::gemm_grain(m, num_cols, 4 * internal::GemmBlocking::kNR);
+  if (k >= kWeightGradientParts * grain) {
+    return 1;
+  }
+
+  // a block has to be worth a task of its own
+  int64_t work = int64_t(num_output_) * k * num_cols;
+  int64_t parts = std::min<int64_t>(n, kWeightGradientParts);
+  return static_cast<int>(
+      std::max<int64_t>(1, std::min(parts, work / kParallelGrain)));
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::im2col(const Array<Dtype>& b, Dtype* col) {
+  int height = b.h_;
+  int width = b.w_;
+  int out_h = output_height(height);
+  int out_w = output_width(width);
+  int num_cols = b.n_ * out_h * out_w;
+
+  // the rows of a channel are written by one thread
+  auto run = [&](int begin, int end) {
+    for (int c = begin; c < end; c++)
+      for (int i = 0; i < kernel_size_; i++)
+        for (int j = 0; j < kernel_size_; j++) {
+          int row = (c * kernel_size_ + i) * kernel_size_ + j;
+          Dtype* dst = col + row * num_cols;
+
+          // output pixel (h, w) reads input pixel
+          // (h*stride + di, w*stride + dj)
+          int di = i * dilation_ - pad_h_;
+          int dj = j * dilation_ - pad_w_;
+
+          // only columns in [w_begin, w_end) read pixels inside the image
+          int w_begin;
+          int w_end;
+          valid_range(dj, stride_, width, out_w, &w_begin, &w_end);
+
+          for (int n = 0; n < b.n_; n++) {
+            const Dtype* src = &b(n, c, 0, 0);
+            for (int h = 0; h < out_h; h++, dst += out_w) {
+              int src_h = h * stride_ + di;
+              if (src_h < 0 || src_h >= height) {
+                set_to<Dtype>(out_w, dst, 0);
+                continue;
+              }
+
+              const Dtype* src_row = src + src_h * width;
+              int w = 0;
+              for (; w < w_begin; w++) dst[w] = 0;
+              if (stride_ == 1) {
+                for (; w < w_end; w++) dst[w] = src_row[w + dj];
+              } else  // NOLINT
+              {
+                for (; w < w_end; w++) dst[w] = src_row[w * stride_ + dj];
+              }
+              for (; w < out_w; w++) dst[w] = 0;
+            }
+          }
         }
+  };
+  parallel_for(this->thread_pool_, 0, b.c_,
+               parallel_grain(kernel_size_ * kernel_size_ * num_cols), run);
+}
+
+template <typename Dtype>
+void ConvolutionLayer<Dtype>::col2im(const Dtype* col,
+                                     Array<Dtype>* bottom_gradient) {
+  auto& bg = *bottom_gradient;
+  int height = bg.h_;
+  int width = bg.w_;
+  int out_h = output_height(height);
+  int out_w = output_width(width);
+  int num_pixels = out_h * out_w;
+  int num_cols = bg.n_ * num_pixels;
+
+  // a plane of bg is written by one thread
+  auto run = [&](int begin, int end) {
+    for (int task = begin; task < end; task++) {
+      int n = task / bg.c_;
+      int c = task % bg.c_;
+      Dtype* dst = &bg(n, c, 0, 0);
+      for (int i = 0; i < kernel_size_; i++)
+        for (int j = 0; j < kernel_size_; j++) {
+          int row = (c * kernel_size_ + i) * kernel_size_ + j;
+          const Dtype* src = col + row * num_cols + n * num_pixels;
+          int di = i * dilation_ - pad_h_;
+          int dj = j * dilation_ - pad_w_;
 
-      dst[h * width + w] += t;
+          int w_begin;
+          int w_end;
+          valid_range(dj, stride_, width, out_w, &w_begin, &w_end);
+
+          int h_begin;
+          int h_end;
+          valid_range(di, stride_, height, out_h, &h_begin, &h_end);
+          for (int h = h_begin; h < h_end; h++) {
+            const Dtype* src_row = src + h * out_w;
+            Dtype* dst_row = dst + (h * stride_ + di) * width + dj;
+            for (int w = w_begin; w < w_end; w++) {
+              dst_row[w * stride_] += src_row[w];
+            }
+          }
+        }
     }
+  };
+  parallel_for(this->thread_pool_, 0, bg.n_ * bg.c_,
+               parallel_grain(kernel_size_ * kernel_size_ * num_pixels), run);
 }
 
 template <typename Dtype>
+template <int K>
 void ConvolutionLayer<Dtype>::one_channel_bprop(
     const Dtype* weight, const Dtype* bottom, int height, int width,
-    const Dtype* top_gradient, Dtype* bottom_gradient, Dtype* param_gradient) {
-  int s = kernel_size_ / 2;
-  for (int h = 0; h < height; h++)
-    for (int w = 0; w < width; w++) {
-      Dtype tg = top_gradient[h * width + w];
-      for (int i = -s; i <= s; i++)
-        for (int j = -s; j <= s; j++) {
-          if (!is_inside(h + i, w + j, height, width)) {
-            continue;
-          }
+    int out_height, int out_width, const Dtype* top_gradient,
+    Dtype* bottom_gradient, Dtype* param_gradient) {
+  // a compile time constant unless K is 0
+  const int kernel_size = (K > 0) ? K : kernel_size_;
+
+  for (int h = 0; h < out_height; h++) {
+    int y0 = h * stride_ - pad_h_;
+    int i_begin;
+    int i_end;
+    valid_range(y0, dilation_, height, kernel_size, &i_begin, &i_end);
+
+    for (int w = 0; w < out_width; w++) {
+      int x0 = w * stride_ - pad_w_;
+      int j_begin;
+      int j_end;
+      valid_range(x0, dilation_, width, kernel_size, &j_begin, &j_end);
 
-          bottom_gradient[(h + i) * width + (w + j)] +=
-              tg * weight[(i + s) * kernel_size_ + (j + s)];
+      Dtype tg = top_gradient[h * out_width + w];
+      int base = y0 * width + x0;
 
-          param_gradient[(i + s) * kernel_size_ + (j + s)] +=
-              tg * bottom[(h + i) * width + (w + j)];
+      if (i_begin == 0 && i_end == kernel_size && j_begin == 0 &&
+          j_end == kernel_size) {
+        // all taps are inside the image
+        for (int i = 0; i < kernel_size; i++)
+          for (int j = 0; j < kernel_size; j++) {
+            int offset = base + (i * width + j) * dilation_;
+            bottom_gradient[offset] += tg * weight[i * kernel_size + j];
+            param_gradient[i * kernel_size + j] += tg * bottom[offset];
+          }
+        continue;
+      }
+
+      for (int i = i_begin; i < i_end; i++)
+        for (int j = j_begin; j < j_end; j++) {
+          int offset = base + (i * width + j) * dilation_;
+          bottom_gradient[offset] += tg * weight[i * kernel_size + j];
+          param_gradient[i * kernel_size + j] += tg * bottom[offset];
         }
     }
+  }
 }
 
 }  // namespace cnn
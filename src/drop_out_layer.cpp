@@ -14,6 +14,7 @@
   -----------------------------------------------------------------  */
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <vector>
 
 #include "cnn/drop_out_layer.hpp"
@@ -62,15 +63,21 @@ void DropoutLayer<Dtype>::fprop(const std::vector<const Array<Dtype>*>& bottom,
   auto& t = *top[0];
 
   if (this->proto_.phase() == TRAIN) {
+    // the mask is drawn in the calling thread, so that it
+    // does not depend on the number of threads
     bernoulli(&mask_, keep_prob_);
-    for (int i = 0; i < b.total_; i++) {
-      t[i] = b[i] * Dtype(mask_[i]) / keep_prob_;
-    }
+    parallel_for(this->thread_pool_, 0, b.total_, kParallelGrain,
+                 [&](int begin, int end) {
+                   for (int i = begin; i < end; i++) {
+                     t[i] = b[i] * Dtype(mask_[i]) / keep_prob_;
+                   }
+                 });
   } else  // NOLINT
   {
-    for (int i = 0; i < b.total_; i++) {
-      t[i] = b[i];
-    }
+    parallel_for(this->thread_pool_, 0, b.total_, kParallelGrain,
+                 [&](int begin, int end) {
+                   std::copy(b.d_ + begin, b.d_ + end, t.d_ + begin);
+                 });
   }
 }
 
@@ -84,14 +91,18 @@ void DropoutLayer<Dtype>::bprop(
   const auto& tg = *top_gradient[0];
 
   if (this->proto_.phase() == TRAIN) {
-    for (int i = 0; i < bg.total_; i++) {
-      bg[i] = tg[i] * Dtype(mask_[i]) / keep_prob_;
-    }
+    parallel_for(this->thread_pool_, 0, bg.total_, kParallelGrain,
+                 [&](int begin, int end) {
+                   for (int i = begin; i < end; i++) {
+                     bg[i] = tg[i] * Dtype(mask_[i]) / keep_prob_;
+                   }
+                 });
   } else  // NOLINT
   {
-    for (int i = 0; i < bg.total_; i++) {
-      bg[i] = tg[i];
-    }
+    parallel_for(this->thread_pool_, 0, bg.total_, kParallelGrain,
+                 [&](int begin, int end) {
+                   std::copy(tg.d_ + begin, tg.d_ + end, bg.d_ + begin);
+                 });
   }
 }
 
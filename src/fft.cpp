@@ -0,0 +1,473 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "cnn/array_math.hpp"
+#include "cnn/fft.hpp"
+
+namespace cnn {
+
+template <typename Dtype>
+void FFT<Dtype>::init(int n) {
+  CHECK_GE(n, 1);
+  CHECK_EQ(good_size(n), n) << n << " is not of the form 2^a * 3^b * 5^c";
+
+  n_ = n;
+
+  factors_.clear();
+  for (int p : {2, 3, 5}) {
+    while (n % p == 0) {
+      factors_.push_back(p);
+      n /= p;
+    }
+  }
+
+  cos_.resize(n_);
+  sin_.resize(n_);
+  for (int j = 0; j < n_; j++) {
+    double a = 2 * M_PI * j / n_;
+    cos_[j] = Dtype(std::cos(a));
+    sin_[j] = Dtype(std::sin(a));
+  }
+}
+
+template <typename Dtype>
+int FFT<Dtype>::good_size(int n) {
+  for (int i = std::max(n, 1);; i++) {
+    int k = i;
+    for (int p : {2, 3, 5}) {
+      while (k % p == 0) {
+        k /= p;
+      }
+    }
+    if (k == 1) {
+      return i;
+    }
+  }
+}
+
+template <typename Dtype>
+void FFT<Dtype>::transform(const Dtype* in_re, const Dtype* in_im, int stride,
+                           bool inverse, Dtype* out_re, Dtype* out_im) const {
+  CHECK_GT(n_, 0);
+  transform(n_, 0, in_re, in_im, stride, inverse, out_re, out_im);
+}
+
+/**
+ * Decimation in time: the n points are split into p interleaved
+ * sequences of m = n/p points, whose transforms are computed
+ * recursively and combined with p-point transforms.
+ */
+template <typename Dtype>
+void FFT<Dtype>::transform(int n, int level, const Dtype* in_re,
+                           const Dtype* in_im, int stride, bool inverse,
+                           Dtype* out_re, Dtype* out_im) const {
+  if (n == 1) {
+    out_re[0] = in_re[0];
+    out_im[0] = in_im ? in_im[0] : Dtype(0);
+    return;
+  }
+
+  int p = factors_[level];
+  int m = n / p;
+  for (int r = 0; r < p; r++) {
+    transform(m, level + 1, in_re + r * stride,
+              in_im ? in_im + r * stride : nullptr, stride * p, inverse,
+              out_re + r * m, out_im + r * m);
+  }
+
+  // exp(-2*pi*i*j/n) = cos_[j*step] - i*sin_[j*step]
+  int step = n_ / n;
+
+  if (p == 2) {
+    for (int k = 0; k < m; k++) {
+      int e = k * step;
+      Dtype c = cos_[e];
+      Dtype s = inverse ? sin_[e] : -sin_[e];
+      Dtype br = out_re[k + m] * c - out_im[k + m] * s;
+      Dtype bi = out_re[k + m] * s + out_im[k + m] * c;
+      Dtype ar = out_re[k];
+      Dtype ai = out_im[k];
+      out_re[k] = ar + br;
+      out_im[k] = ai + bi;
+      out_re[k + m] = ar - br;
+      out_im[k + m] = ai - bi;
+    }
+    return;
+  }
+
+  static constexpr int kMaxRadix = 5;
+  Dtype tr[kMaxRadix];
+  Dtype ti[kMaxRadix];
+  for (int k = 0; k < m; k++) {
+    // twiddle the k-th element of every sequence
+    for (int r = 0; r < p; r++) {
+      int e = (r * k * step) % n_;
+      Dtype c = cos_[e];
+      Dtype s = inverse ? sin_[e] : -sin_[e];
+      Dtype xr = out_re[r * m + k];
+      Dtype xi = out_im[r * m + k];
+      tr[r] = xr * c - xi * s;
+      ti[r] = xr * s + xi * c;
+    }
+
+    // p-point transform; it reads and writes the same p elements
+    for (int q = 0; q < p; q++) {
+      Dtype yr = tr[0];
+      Dtype yi = ti[0];
+      for (int r = 1; r < p; r++) {
+        int e = (r * q % p) * (n_ / p);
+        Dtype c = cos_[e];
+        Dtype s = inverse ? sin_[e] : -sin_[e];
+        yr += tr[r] * c - ti[r] * s;
+        yi += tr[r] * s + ti[r] * c;
+      }
+      out_re[q * m + k] = yr;
+      out_im[q * m + k] = yi;
+    }
+  }
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::init(int height, int width, int kernel_size) {
+  if (height == height_ && width == width_ && kernel_size == kernel_size_) {
+    return;
+  }
+
+  height_ = height;
+  width_ = width;
+  kernel_size_ = kernel_size;
+
+  // the output pixels do not overlap with the wrapped around
+  // pixels if the padded size is at least size + kernel_size/2;
+  // it also has to hold the kernel
+  int s = kernel_size / 2;
+  ph_ = FFT<Dtype>::good_size(std::max(height + s, kernel_size));
+  pw_ = FFT<Dtype>::good_size(std::max(width + s, kernel_size));
+  q_ = pw_ / 2 + 1;
+
+  row_fft_.init(pw_);
+  col_fft_.init(ph_);
+
+  output_rows_.resize(height);
+  for (int i = 0; i < height; i++) {
+    output_rows_[i] = i;
+  }
+
+  kernel_rows_.resize(kernel_size);
+  for (int i = 0; i < kernel_size; i++) {
+    kernel_rows_[i] = (i - s + ph_) % ph_;
+  }
+
+  int size = std::max(ph_, pw_);
+  in_re_.resize(size);
+  in_im_.resize(size);
+  out_re_.resize(size);
+  out_im_.resize(size);
+
+  rows_.resize(std::max(height, kernel_size) * pw_);
+  spectrum_.resize(2 * spectrum_size());
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::forward(const Dtype* src, int height, int width,
+                                    int src_stride, Dtype* dst) const {
+  int num = spectrum_size();
+  Dtype* re = dst;
+  Dtype* im = dst + num;
+  const Dtype half(0.5);
+
+  // transform rows r and r+1 as the real and imaginary parts
+  // of one complex sequence z and split the result with
+  //  X_r[k] = (Z[k] + conj(Z[-k])) / 2
+  //  X_{r+1}[k] = (Z[k] - conj(Z[-k])) / 2i
+  for (int r = 0; r < height; r += 2) {
+    bool has_next = r + 1 < height;
+    const Dtype* a = src + r * src_stride;
+    const Dtype* b = has_next ? a + src_stride : nullptr;
+    for (int j = 0; j < width; j++) {
+      in_re_[j] = a[j];
+      in_im_[j] = has_next ? b[j] : Dtype(0);
+    }
+    for (int j = width; j < pw_; j++) {
+      in_re_[j] = Dtype(0);
+      in_im_[j] = Dtype(0);
+    }
+
+    row_fft_.transform(in_re_.data(), in_im_.data(), 1, false,
+                       out_re_.data(), out_im_.data());
+
+    for (int k = 0; k < q_; k++) {
+      int neg = k ? pw_ - k : 0;
+      Dtype zr = out_re_[k];
+      Dtype zi = out_im_[k];
+      Dtype cr = out_re_[neg];
+      Dtype ci = out_im_[neg];
+      re[k * ph_ + r] = (zr + cr) * half;
+      im[k * ph_ + r] = (zi - ci) * half;
+      if (has_next) {
+        re[k * ph_ + r + 1] = (zi + ci) * half;
+        im[k * ph_ + r + 1] = (cr - zr) * half;
+      }
+    }
+  }
+
+  for (int k = 0; k < q_; k++) {
+    for (int r = height; r < ph_; r++) {
+      re[k * ph_ + r] = Dtype(0);
+      im[k * ph_ + r] = Dtype(0);
+    }
+
+    col_fft_.transform(re + k * ph_, im + k * ph_, 1, false, out_re_.data(),
+                       out_im_.data());
+    std::copy(out_re_.begin(), out_re_.begin() + ph_, re + k * ph_);
+    std::copy(out_im_.begin(), out_im_.begin() + ph_, im + k * ph_);
+  }
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::inverse(Dtype* src, const std::vector<int>& rows,
+                                    Dtype* dst) const {
+  int num = spectrum_size();
+  Dtype* re = src;
+  Dtype* im = src + num;
+
+  for (int k = 0; k < q_; k++) {
+    col_fft_.transform(re + k * ph_, im + k * ph_, 1, true, out_re_.data(),
+                       out_im_.data());
+    std::copy(out_re_.begin(), out_re_.begin() + ph_, re + k * ph_);
+    std::copy(out_im_.begin(), out_im_.begin() + ph_, im + k * ph_);
+  }
+
+  // rows a and b are the real and imaginary parts of the inverse
+  // transform of Z = X_a + i * X_b, where the missing columns
+  // follow from X[-k] = conj(X[k])
+  int num_rows = rows.size();
+  for (int i = 0; i < num_rows; i += 2) {
+    bool has_next = i + 1 < num_rows;
+    int a = rows[i];
+    int b = has_next ? rows[i + 1] : 0;
+    for (int k = 0; k < pw_; k++) {
+      int col = k < q_ ? k : pw_ - k;
+      Dtype sign(k < q_ ? 1 : -1);
+      Dtype ar = re[col * ph_ + a];
+      Dtype ai = im[col * ph_ + a] * sign;
+      Dtype br = has_next ? re[col * ph_ + b] : Dtype(0);
+      Dtype bi = has_next ? im[col * ph_ + b] * sign : Dtype(0);
+      in_re_[k] = ar - bi;
+      in_im_[k] = ai + br;
+    }
+
+    row_fft_.transform(in_re_.data(), in_im_.data(), 1, true,
+                       dst + i * pw_, out_im_.data());
+    if (has_next) {
+      std::copy(out_im_.begin(), out_im_.begin() + pw_, dst + (i + 1) * pw_);
+    }
+  }
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::transform_weight(const Array<Dtype>& weight,
+                                             bool flip,
+                                             Array<Dtype>* u) const {
+  CHECK_EQ(weight.h_, kernel_size_);
+  CHECK_EQ(weight.w_, kernel_size_);
+
+  int num_output = flip ? weight.c_ : weight.n_;
+  int num_input = flip ? weight.n_ : weight.c_;
+  u->init(num_output, num_input, 2, spectrum_size());
+
+  int k = kernel_size_;
+  int s = k / 2;
+
+  // the inverse transform is not normalized, so we do it here
+  const Dtype scale(1. / (ph_ * pw_));
+
+  // output pixel (h, w) is the sum of weight(i, j) * input(h+i-s, w+j-s),
+  // so weight(i, j) is placed at ((s-i) mod ph_, (s-j) mod pw_)
+  std::vector<Dtype> image(ph_ * pw_, Dtype(0));
+  for (int o = 0; o < weight.n_; o++)
+    for (int c = 0; c < weight.c_; c++) {
+      const Dtype* w = &weight(o, c, 0, 0);
+      for (int i = 0; i < k; i++) {
+        int h = (s - i + ph_) % ph_;
+        for (int j = 0; j < k; j++) {
+          int x = (s - j + pw_) % pw_;
+          Dtype g = flip ? w[(k - 1 - i) * k + (k - 1 - j)] : w[i * k + j];
+          image[h * pw_ + x] = g * scale;
+        }
+      }
+
+      int row = flip ? c : o;
+      int col = flip ? o : c;
+      forward(image.data(), ph_, pw_, pw_, &(*u)(row, col, 0, 0));
+    }
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::forward(const Array<Dtype>& in, Dtype* x) const {
+  CHECK_EQ(in.h_, height_);
+  CHECK_EQ(in.w_, width_);
+
+  int num = spectrum_size();
+  for (int n = 0; n < in.n_; n++)
+    for (int c = 0; c < in.c_; c++) {
+      forward(&in(n, c, 0, 0), height_, width_, width_,
+              x + (n * in.c_ + c) * 2 * num);
+    }
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::multiply(const Dtype* x, int num_samples,
+                                     const Array<Dtype>& u, Dtype* y) const {
+  int num_output = u.n_;
+  int num_input = u.c_;
+  int num = spectrum_size();
+  CHECK(u.has_same_shape({num_output, num_input, 2, num}));
+
+  set_to<Dtype>(num_samples * num_output * 2 * num, y, 0);
+
+  // y_k += x_c .* u_kc for a block of frequencies at a time, so that
+  // the spectra of the block stay in the cache for the whole batch
+  static constexpr int kBlock = 64;
+  for (int begin = 0; begin < num; begin += kBlock) {
+    int end = std::min(num, begin + kBlock);
+    for (int n = 0; n < num_samples; n++)
+      for (int k = 0; k < num_output; k++) {
+        Dtype* yr = y + (n * num_output + k) * 2 * num;
+        Dtype* yi = yr + num;
+        for (int c = 0; c < num_input; c++) {
+          const Dtype* xr = x + (n * num_input + c) * 2 * num;
+          const Dtype* xi = xr + num;
+          const Dtype* ur = &u(k, c, 0, 0);
+          const Dtype* ui = ur + num;
+          for (int q = begin; q < end; q++) {
+            yr[q] += xr[q] * ur[q] - xi[q] * ui[q];
+            yi[q] += xr[q] * ui[q] + xi[q] * ur[q];
+          }
+        }
+      }
+  }
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::inverse(Dtype* y, const Dtype* bias,
+                                    bool accumulate, Array<Dtype>* out) const {
+  CHECK_EQ(out->h_, height_);
+  CHECK_EQ(out->w_, width_);
+
+  int num = spectrum_size();
+  for (int n = 0; n < out->n_; n++)
+    for (int k = 0; k < out->c_; k++) {
+      inverse(y + (n * out->c_ + k) * 2 * num, output_rows_, rows_.data());
+
+      Dtype b = bias ? bias[k] : Dtype(0);
+      Dtype* dst = &(*out)(n, k, 0, 0);
+      for (int h = 0; h < height_; h++) {
+        const Dtype* src = rows_.data() + h * pw_;
+        Dtype* d = dst + h * width_;
+        for (int w = 0; w < width_; w++) {
+          if (accumulate) {
+            d[w] += src[w] + b;
+          } else  // NOLINT
+          {
+            d[w] = src[w] + b;
+          }
+        }
+      }
+    }
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::convolve(const Array<Dtype>& in,
+                                     const Array<Dtype>& u, const Dtype* bias,
+                                     bool accumulate, Dtype* x, Dtype* y,
+                                     Array<Dtype>* out) const {
+  CHECK_EQ(u.c_, in.c_);
+  CHECK(out->has_same_shape({in.n_, u.n_, height_, width_}));
+
+  forward(in, x);
+  multiply(x, in.n_, u, y);
+  inverse(y, bias, accumulate, out);
+}
+
+template <typename Dtype>
+void FFTConvolution<Dtype>::weight_gradient(const Dtype* x, const Dtype* dy,
+                                            int num_samples,
+                                            Array<Dtype>* dw) const {
+  int num_output = dw->n_;
+  int num_input = dw->c_;
+  int k = kernel_size_;
+  int s = k / 2;
+  int num = spectrum_size();
+
+  CHECK_EQ(dw->h_, k);
+  CHECK_EQ(dw->w_, k);
+
+  const Dtype scale(1. / (ph_ * pw_));
+
+  Dtype* gr = spectrum_.data();
+  Dtype* gi = gr + num;
+  for (int o = 0; o < num_output; o++)
+    for (int c = 0; c < num_input; c++) {
+      set_to<Dtype>(2 * num, gr, 0);
+      for (int n = 0; n < num_samples; n++) {
+        const Dtype* xr = x + (n * num_input + c) * 2 * num;
+        const Dtype* xi = xr + num;
+        const Dtype* dr = dy + (n * num_output + o) * 2 * num;
+        const Dtype* di = dr + num;
+        for (int q = 0; q < num; q++) {
+          gr[q] += xr[q] * dr[q] + xi[q] * di[q];
+          gi[q] += xi[q] * dr[q] - xr[q] * di[q];
+        }
+      }
+
+      // pixel (i, j) of the kernel is the correlation
+      // at the offset (i - s, j - s)
+      inverse(gr, kernel_rows_, rows_.data());
+      Dtype* g = &(*dw)(o, c, 0, 0);
+      for (int i = 0; i < k; i++) {
+        const Dtype* src = rows_.data() + i * pw_;
+        for (int j = 0; j < k; j++) {
+          g[i * k + j] += src[(j - s + pw_) % pw_] * scale;
+        }
+      }
+    }
+}
+
+template <typename Dtype>
+bool FFTConvolution<Dtype>::is_faster_than_gemm(int num_input, int height,
+                                                int width, int num_output,
+                                                int kernel_size) {
+  int s = kernel_size / 2;
+  double ph = FFT<Dtype>::good_size(std::max(height + s, kernel_size));
+  double pw = FFT<Dtype>::good_size(std::max(width + s, kernel_size));
+  double num = ph * (static_cast<int>(pw) / 2 + 1);
+
+  // a real FFT of n points takes about 2.5 * n * log2(n) flops
+  double fft = 2.5 * ph * pw * std::log2(ph * pw) * (num_input + num_output);
+  double product = 8. * num_input * num_output * num;
+
+  double direct = 2. * num_input * num_output * height * width *
+                  kernel_size * kernel_size;
+
+  return (fft + product) * kGemmSpeedup < direct;
+}
+
+}  // namespace cnn
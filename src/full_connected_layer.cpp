@@ -22,6 +22,10 @@
 #include "cnn/rng.hpp"
 
 namespace cnn {
+
+template <typename Dtype>
+constexpr int FullConnectedLayer<Dtype>::kGemmBatch;
+
 template <typename Dtype>
 FullConnectedLayer<Dtype>::FullConnectedLayer(const LayerProto& _proto)
     : Layer<Dtype>(_proto) {
@@ -41,6 +45,10 @@ void FullConnectedLayer<Dtype>::reshape(
   int n = bottom[0]->n_;
   top[0]->init(n, num_output_, 1, 1);
 
+  if (n >= kGemmBatch) {
+    gemm_top_.init(1, 1, num_output_, n, false);  // overwritten by gemm
+  }
+
   if (this->param_.empty()) {
     this->param_.resize(2);
     this->param_[0] = std::make_shared<Array<Dtype>>();
@@ -54,6 +62,9 @@ void FullConnectedLayer<Dtype>::reshape(
 
     // TODO(fangjun): use other strategies
     gaussian<Dtype>(this->param_[1].get(), 0, 1);
+
+    // caches derived from the parameters are outdated
+    this->param_version_++;
   } else  // NOLINT
   {
     CHECK_EQ(this->param_.size(), 2);
@@ -91,46 +102,166 @@ template <typename Dtype>
 void FullConnectedLayer<Dtype>::fprop(
     const std::vector<const Array<Dtype>*>& bottom,
     const std::vector<Array<Dtype>*>& top) {
-  int n = bottom[0]->n_;
-  for (int i = 0; i < n; i++) {
-    for (int j = 0; j < num_output_; j++) {
-      Dtype dot = ax_dot_by<Dtype>(this->param_[0]->w_, 1,
-                                   &this->param_[0]->operator()(0, 0, j, 0), 1,
-                                   &bottom[0]->operator()(i, 0, 0, 0));
-      top[0]->operator()(i, j, 0, 0) = dot + this->param_[1]->operator[](j);
-    }
+  if (bottom[0]->n_ < kGemmBatch) {
+    fprop_small_batch(*bottom[0], top[0]);
+  } else  // NOLINT
+  {
+    fprop_gemm(*bottom[0], top[0]);
   }
 }
 
+template <typename Dtype>
+void FullConnectedLayer<Dtype>::fprop_small_batch(const Array<Dtype>& x,
+                                                  Array<Dtype>* top) {
+  const auto& w = *this->param_[0];
+  const Dtype* bias = this->param_[1]->d_;
+  auto& y = *top;
+
+  // every thread reads its own rows of the weight
+  parallel_for(this->thread_pool_, 0, num_output_,
+               parallel_grain(x.n_ * w.w_), [&](int begin, int end) {
+                 for (int i = 0; i < x.n_; i++)
+                   for (int j = begin; j < end; j++) {
+                     Dtype dot = ax_dot_by<Dtype>(w.w_, 1, &w(0, 0, j, 0), 1,
+                                                  &x(i, 0, 0, 0));
+                     y(i, j, 0, 0) = dot + bias[j];
+                   }
+               });
+}
+
+template <typename Dtype>
+void FullConnectedLayer<Dtype>::fprop_gemm(const Array<Dtype>& x,
+                                           Array<Dtype>* top) {
+  const Dtype* bias = this->param_[1]->d_;
+  auto& y = *top;
+
+  int n = x.n_;
+  int k = this->param_[0]->w_;
+
+  // Y^T = W * X^T, where X is (N, K) and W is (M, K)
+  if (Blas<Dtype>::kEnabled) {
+    gemm<Dtype>(this->thread_pool_, false, true, num_output_, n, k, 1,
+                this->param_[0]->d_, k, x.d_, k, 0, gemm_top_.d_, n);
+  } else  // NOLINT
+  {
+    gemm_packed<Dtype>(this->thread_pool_, true, num_output_, n, k, 1,
+                       packed_weight(), internal::GemmBlocking::kKC, x.d_, k,
+                       0, gemm_top_.d_, n);
+  }
+
+  parallel_for(this->thread_pool_, 0, n, parallel_grain(num_output_),
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++)
+                   for (int j = 0; j < num_output_; j++) {
+                     y(i, j, 0, 0) = gemm_top_[j * n + i] + bias[j];
+                   }
+               });
+}
+
+template <typename Dtype>
+void FullConnectedLayer<Dtype>::pack_param() {
+  if (this->param_.empty()) {
+    // it is initialized in reshape()
+    this->packed_param_.clear();
+    return;
+  }
+
+  if (Blas<Dtype>::kEnabled) {
+    // cblas reads the weight as it is
+    this->packed_param_.clear();
+    return;
+  }
+
+  // reuse the memory, since it is packed after every update
+  if (this->packed_param_.size() != 1) {
+    this->packed_param_.assign(1, std::make_shared<Array<Dtype>>());
+  }
+  const auto& w = *this->param_[0];
+  auto* packed = this->packed_param_[0].get();
+  packed->init(1, 1, 1, gemm_packed_size(w.h_, w.w_));
+  gemm_pack<Dtype>(false, w.h_, w.w_, w.d_, w.w_, internal::GemmBlocking::kKC,
+                   packed->d_);
+}
+
+template <typename Dtype>
+const Dtype* FullConnectedLayer<Dtype>::packed_weight() {
+  const auto& w = *this->param_[0];
+  return this->packed_param_data(gemm_packed_size(w.h_, w.w_));
+}
+
 template <typename Dtype>
 void FullConnectedLayer<Dtype>::bprop(
     const std::vector<const Array<Dtype>*>& bottom,
     const std::vector<Array<Dtype>*>& bottom_gradient,
-    const std::vector<const Array<Dtype>*>& top,
+    const std::vector<const Array<Dtype>*>& /*top*/,
     const std::vector<const Array<Dtype>*>& top_gradient) {
-  // compute parameter gradient
-  auto& w = *this->param_[0];
-  auto& dw = *this->gradient_[0];
+  if (bottom[0]->n_ < kGemmBatch) {
+    bprop_small_batch(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+  } else  // NOLINT
+  {
+    bprop_gemm(*bottom[0], *top_gradient[0], bottom_gradient[0]);
+  }
+}
 
+template <typename Dtype>
+void FullConnectedLayer<Dtype>::bprop_small_batch(
+    const Array<Dtype>& x, const Array<Dtype>& dy,
+    Array<Dtype>* bottom_gradient) {
+  const auto& w = *this->param_[0];
+  auto& dw = *this->gradient_[0];
   auto& db = *this->gradient_[1];
+  auto& dx = *bottom_gradient;
 
-  auto& x = *bottom[0];
-  auto& dx = *bottom_gradient[0];
+  int k = w.w_;
+  int grain = parallel_grain(x.n_ * k);
 
-  auto& y = *top[0];
-  auto& dy = *top_gradient[0];
+  // the rows of dW and db, one output at a time
+  parallel_for(this->thread_pool_, 0, num_output_, grain,
+               [&](int begin, int end) {
+                 for (int i = 0; i < x.n_; i++)
+                   for (int j = begin; j < end; j++) {
+                     Dtype scale = dy(i, j, 0, 0);
+                     ax_plus_by<Dtype>(k, scale, &x(i, 0, 0, 0), 1,
+                                       &dw(0, 0, j, 0));
 
-  int stride = dw.w_;
-  for (int n = 0; n < y.n_; n++) {
-    for (int i = 0; i < num_output_; i++) {
-      Dtype scale = dy(n, i, 0, 0);
-      ax_plus_by<Dtype>(stride, scale, &x[n * stride], 1, &dw(0, 0, i, 0));
+                     db.d_[j] += scale;
+                   }
+               });
 
-      db.d_[i] += scale;
+  // the rows of dX, one sample at a time
+  parallel_for(this->thread_pool_, 0, x.n_, parallel_grain(num_output_ * k),
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++)
+                   for (int j = 0; j < num_output_; j++) {
+                     ax_plus_by<Dtype>(k, dy(i, j, 0, 0), &w(0, 0, j, 0), 1,
+                                       &dx(i, 0, 0, 0));
+                   }
+               });
+}
 
-      ax_plus_by<Dtype>(stride, scale, &w(0, 0, i, 0), 1, &dx[n * stride]);
-    }
+template <typename Dtype>
+void FullConnectedLayer<Dtype>::bprop_gemm(const Array<Dtype>& x,
+                                           const Array<Dtype>& dy,
+                                           Array<Dtype>* bottom_gradient) {
+  const auto& w = *this->param_[0];
+  auto& dw = *this->gradient_[0];
+  auto& db = *this->gradient_[1];
+  auto& dx = *bottom_gradient;
+
+  int n = x.n_;
+  int k = w.w_;
+
+  for (int i = 0; i < n; i++) {
+    ax_plus_by<Dtype>(num_output_, 1, &dy(i, 0, 0, 0), 1, db.d_);
   }
+
+  // dW += dY^T * X
+  gemm<Dtype>(this->thread_pool_, true, false, num_output_, k, n, 1, dy.d_,
+              num_output_, x.d_, k, 1, dw.d_, k);
+
+  // dX += dY * W
+  gemm<Dtype>(this->thread_pool_, false, false, n, k, num_output_, 1, dy.d_,
+              num_output_, w.d_, k, 1, dx.d_, k);
 }
 
 }  // namespace cnn
@@ -77,12 +77,15 @@ void L2LossLayer<Dtype>::bprop(
   scale /= bottom[0]->total_;
   scale *= 2;  // for the derivative of a squared loss
   // TODO(fangjun) it can be optimized, i.e., with lapack or blas.
-  for (int i = 0; i < bottom[0]->total_; i++) {
-    Dtype estimated_y = bottom[0]->d_[i];
-    Dtype true_y = bottom[1]->d_[i];
+  parallel_for(this->thread_pool_, 0, bottom[0]->total_, kParallelGrain,
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   Dtype estimated_y = bottom[0]->d_[i];
+                   Dtype true_y = bottom[1]->d_[i];
 
-    bottom_gradient[0]->d_[i] = scale * (estimated_y - true_y);
-  }
+                   bottom_gradient[0]->d_[i] = scale * (estimated_y - true_y);
+                 }
+               });
 }
 
 }  // namespace cnn
@@ -14,6 +14,7 @@
   -----------------------------------------------------------------  */
 #include <glog/logging.h>
 
+#include "cnn/array_expr.hpp"
 #include "cnn/batch_normalization_layer.hpp"
 #include "cnn/convolution_layer.hpp"
 #include "cnn/drop_out_layer.hpp"
@@ -30,8 +31,43 @@
 #include "cnn/softmax_with_log_loss_layer.hpp"
 
 namespace cnn {
+
+template <typename Dtype>
+void sgd_update(int n, Dtype learning_rate, Dtype* param, Dtype* gradient,
+                Dtype* history) {
+  // TODO(fangjun): move the following options to proto
+  static const Dtype decay = 0.0000;
+  static const Dtype momentum = 0.0;
+  // TODO(fangjun):
+  // gradient = gradient + decay*param;
+  // history = momentum*history + (1-momentum)*gradient
+  // param = param - learning_rate*history;
+  //
+  // it usually writes
+  // history = momentum*history + gradient
+  // param = param - learning_rate*history
+  //
+  // momentum is typically 0.9 or 0.99
+  // refer to lecture 7 of CS231N at stanford
+
+  // apply weight decay, update history and then update parameters,
+  // in a single pass over the three arrays
+  fused_assign(
+      n, gradient, array_expr(n, gradient) + decay * array_expr(n, param),
+      history,
+      learning_rate * array_expr(n, gradient) +
+          momentum * array_expr(n, history),
+      param, array_expr(n, param) - array_expr(n, history));
+}
+
 template <typename Dtype>
-Layer<Dtype>::Layer(const LayerProto& _proto) : param_(), proto_(_proto) {
+Layer<Dtype>::Layer(const LayerProto& _proto)
+    : param_(),
+      proto_(_proto),
+      param_version_(0),
+      packed_param_(),
+      packed_param_version_(-1),
+      thread_pool_(nullptr) {
   if (proto_.param_size()) {
     param_.clear();
     for (int i = 0; i < proto_.param_size(); i++) {
@@ -39,7 +75,34 @@ Layer<Dtype>::Layer(const LayerProto& _proto) : param_(), proto_(_proto) {
       arr->from_proto(proto_.param(i));
       param_.push_back(arr);
     }
+    load_packed_param(proto_);
+  }
+}
+
+template <typename Dtype>
+const Dtype* Layer<Dtype>::packed_param_data(int total) {
+  update_packed_param();
+
+  CHECK_EQ(packed_param_.size(), 1);
+  CHECK_EQ(packed_param_[0]->total_, total)
+      << "packed_param does not match the layer " << proto_.name();
+
+  return packed_param_[0]->d_;
+}
+
+template <typename Dtype>
+void Layer<Dtype>::load_packed_param(const LayerProto& p) {
+  if (!p.packed_param_size()) {
+    return;
+  }
+
+  packed_param_.clear();
+  for (int i = 0; i < p.packed_param_size(); i++) {
+    auto arr = std::make_shared<Array<Dtype>>();
+    arr->from_proto(p.packed_param(i));
+    packed_param_.push_back(arr);
   }
+  packed_param_version_ = param_version_;
 }
 
 template <typename Dtype>
@@ -92,6 +155,14 @@ void Layer<Dtype>::copy_trained_layer(const LayerProto& p) {
     arr->from_proto(p.param(i));
     param_.push_back(arr);
   }
+  param_version_++;
+
+  if (p.packed_param_size()) {
+    load_packed_param(p);
+  } else  // NOLINT
+  {
+    update_packed_param();
+  }
 }
 template <typename Dtype>
 void Layer<Dtype>::update_parameters(int /*current_iter*/,
@@ -109,34 +180,19 @@ void Layer<Dtype>::update_parameters(int /*current_iter*/,
     }
   }
 
-  // TODO(fangjun): move the following options to proto
-  static const Dtype decay = 0.0000;
-  static const Dtype momentum = 0.0;
-  // TODO(fangjun):
-  // gradient = gradient + decay*param;
-  // history = momentum*history + (1-momentum)*gradient
-  // param = param - learning_rate*history;
-  //
-  // it usually writes
-  // history = momentum*history + gradient
-  // param = param - learning_rate*history
-  //
-  // momentum is typically 0.9 or 0.99
-  // refer to lecture 7 of CS231N at stanford
+  Dtype learning_rate(current_learning_rate);
   for (int i = 0; i < gradient_.size(); i++) {
-    // apply weight decay
-    ax_plus_by<Dtype>(param_[i]->total_, decay, &param_[i]->d_[0], 1,
-                      &gradient_[i]->d_[0]);
-
-    // update history
-    ax_plus_by<Dtype>(param_[i]->total_, current_learning_rate,
-                      &gradient_[i]->d_[0], momentum,
-                      &history_gradient_[i]->d_[0]);
-
-    // update parameters
-    ax_plus_by<Dtype>(param_[i]->total_, -1, &history_gradient_[i]->d_[0], 1,
-                      &param_[i]->d_[0]);
+    Dtype* param = param_[i]->d_;
+    Dtype* gradient = gradient_[i]->d_;
+    Dtype* history = history_gradient_[i]->d_;
+    parallel_for(thread_pool_, 0, param_[i]->total_, kParallelGrain,
+                 [&](int begin, int end) {
+                   sgd_update<Dtype>(end - begin, learning_rate,
+                                     param + begin, gradient + begin,
+                                     history + begin);
+                 });
   }
+  param_changed();
 }
 
 }  // namespace cnn
@@ -57,9 +57,13 @@ void LeakyReLULayer<Dtype>::fprop(
     const std::vector<Array<Dtype>*>& top) {
   const auto& b = *bottom[0];
   auto& t = *top[0];
-  for (int i = 0; i < b.total_; i++) {
-    t[i] = ((b[i] >= Dtype(0)) + (b[i] < Dtype(0)) * alpha_) * b[i];
-  }
+  parallel_for(this->thread_pool_, 0, b.total_, kParallelGrain,
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   t[i] = ((b[i] >= Dtype(0)) + (b[i] < Dtype(0)) * alpha_) *
+                          b[i];
+                 }
+               });
 }
 
 template <typename Dtype>
@@ -73,9 +77,13 @@ void LeakyReLULayer<Dtype>::bprop(
 
   const auto& tg = *top_gradient[0];
 
-  for (int i = 0; i < b.total_; i++) {
-    bg[i] = tg[i] * ((b[i] >= Dtype(0)) + (b[i] < Dtype(0)) * alpha_);
-  }
+  parallel_for(this->thread_pool_, 0, b.total_, kParallelGrain,
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   bg[i] = tg[i] *
+                           ((b[i] >= Dtype(0)) + (b[i] < Dtype(0)) * alpha_);
+                 }
+               });
 }
 
 }  // namespace cnn
@@ -45,6 +45,8 @@ void LogLossLayer<Dtype>::reshape(
   CHECK_EQ(top.size(), 1);
   top[0]->init(1, 1, 1, 1);
 
+  buffer_.init_like(*bottom[1], false);  // overwritten by fprop()
+
   if (this->proto_.phase() == TRAIN) {
     CHECK_GE(bottom_gradient.size(), 1);
 
@@ -58,24 +60,33 @@ void LogLossLayer<Dtype>::reshape(
 template <typename Dtype>
 void LogLossLayer<Dtype>::fprop(const std::vector<const Array<Dtype>*>& bottom,
                                 const std::vector<Array<Dtype>*>& top) {
-  loss_ = 0;
-
   const auto& b0 = *bottom[0];
   const auto& b1 = *bottom[1];
 
-  for (int n = 0; n < b1.n_; n++)
-    for (int h = 0; h < b1.h_; h++)
-      for (int w = 0; w < b1.w_; w++) {
-        auto label = b1(n, 0, h, w);  // label for the ground truth
-        auto p = b0(n, label, h, w);  // probability for the predication
-        p = std::max(p, Dtype(g_log_threshold));
-        p = std::min(p, Dtype(1));
-
-        // use cnn::log() here for Jet, in unit test only.
-        loss_ += Dtype(-1) * log(p);
-      }
-
-  loss_ /= b1.total_;  // take the average
+  int pixels = b1.h_ * b1.w_;
+  parallel_for(
+      this->thread_pool_, 0, b1.n_, parallel_grain(pixels),
+      [&](int begin, int end) {
+        for (int n = begin; n < end; n++) {
+          Dtype* dst = buffer_.d_ + n * pixels;
+          int i = 0;
+          for (int h = 0; h < b1.h_; h++)
+            for (int w = 0; w < b1.w_; w++) {
+              auto label = b1(n, 0, h, w);  // label for the ground truth
+              auto p = b0(n, label, h, w);  // probability for the predication
+              p = std::max(p, Dtype(g_log_threshold));
+              p = std::min(p, Dtype(1));
+              dst[i++] = p;
+            }
+
+          // for float and double, the logarithms of an image are
+          // computed with SIMD; Jet (only in unit test) uses cnn::log()
+          log_arr(pixels, dst, dst);
+        }
+      });
+  loss_ = sum_arr(buffer_);
+
+  loss_ /= Dtype(-1) * b1.total_;  // take the average
 
   top[0]->d_[0] = loss_;
 }
@@ -93,16 +104,20 @@ void LogLossLayer<Dtype>::bprop(
   auto& bg = *bottom_gradient[0];
 
   scale /= Dtype(-1) * b1.total_;
-  for (int n = 0; n < b1.n_; n++)
-    for (int h = 0; h < b1.h_; h++)
-      for (int w = 0; w < b1.w_; w++) {
-        auto label = b1(n, 0, h, w);
-
-        auto p = b0(n, label, h, w);  // probability for the predication
-        p = std::max(p, Dtype(g_log_threshold));
-        p = std::min(p, Dtype(1));
-        bg(n, label, h, w) = scale / p;
-      }
+  parallel_for(
+      this->thread_pool_, 0, b1.n_, parallel_grain(b1.h_ * b1.w_),
+      [&](int begin, int end) {
+        for (int n = begin; n < end; n++)
+          for (int h = 0; h < b1.h_; h++)
+            for (int w = 0; w < b1.w_; w++) {
+              auto label = b1(n, 0, h, w);
+
+              auto p = b0(n, label, h, w);  // probability for the predication
+              p = std::max(p, Dtype(g_log_threshold));
+              p = std::min(p, Dtype(1));
+              bg(n, label, h, w) = scale / p;
+            }
+      });
 }
 
 }  // namespace cnn
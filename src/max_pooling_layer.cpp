@@ -67,16 +67,24 @@ void MaxPoolingLayer<Dtype>::fprop(
     const std::vector<Array<Dtype>*>& top) {
   const auto& b = *bottom[0];
   auto& t = *top[0];
-  for (int n = 0; n < t.n_; n++)
-    for (int c = 0; c < t.c_; c++)
-      for (int h = 0; h < t.h_; h++)
-        for (int w = 0; w < t.w_; w++) {
-          auto p =
-              find_max_index(&b(n, c, 0, 0), b.w_, h * stride_, w * stride_);
-
-          t(n, c, h, w) = b(n, c, p.first, p.second);
-          max_index_pair_(n, c, h, w) = p;
-        }
+
+  // one channel of one image at a time
+  int grain = parallel_grain(t.h_ * t.w_ * win_size_ * win_size_);
+  parallel_for(this->thread_pool_, 0, t.n_ * t.c_, grain,
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   int n = i / t.c_;
+                   int c = i % t.c_;
+                   for (int h = 0; h < t.h_; h++)
+                     for (int w = 0; w < t.w_; w++) {
+                       auto p = find_max_index(&b(n, c, 0, 0), b.w_,
+                                               h * stride_, w * stride_);
+
+                       t(n, c, h, w) = b(n, c, p.first, p.second);
+                       max_index_pair_(n, c, h, w) = p;
+                     }
+                 }
+               });
 }
 
 template <typename Dtype>
@@ -87,13 +95,21 @@ void MaxPoolingLayer<Dtype>::bprop(
     const std::vector<const Array<Dtype>*>& top_gradient) {
   auto& bg = *bottom_gradient[0];
   const auto& tg = *top_gradient[0];
-  for (int n = 0; n < tg.n_; n++)
-    for (int c = 0; c < tg.c_; c++)
-      for (int h = 0; h < tg.h_; h++)
-        for (int w = 0; w < tg.w_; w++) {
-          const auto& p = max_index_pair_(n, c, h, w);
-          bg(n, c, p.first, p.second) += tg(n, c, h, w);
-        }
+
+  // the windows of a channel overlap, but different channels
+  // write to different planes of bg
+  parallel_for(this->thread_pool_, 0, tg.n_ * tg.c_,
+               parallel_grain(tg.h_ * tg.w_), [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   int n = i / tg.c_;
+                   int c = i % tg.c_;
+                   for (int h = 0; h < tg.h_; h++)
+                     for (int w = 0; w < tg.w_; w++) {
+                       const auto& p = max_index_pair_(n, c, h, w);
+                       bg(n, c, p.first, p.second) += tg(n, c, h, w);
+                     }
+                 }
+               });
 }
 
 template <typename Dtype>
@@ -15,9 +15,15 @@
 
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <chrono>  // NOLINT
+#include <fstream>
+#include <limits>
 #include <string>
 #include <vector>
 
+#include "cnn/array_math.hpp"
+#include "cnn/convolution_layer.hpp"
 #include "cnn/io.hpp"
 #include "cnn/network.hpp"
 
@@ -51,6 +57,15 @@ void Network<Dtype>::init(const std::string& filename,
 template <typename Dtype>
 void Network<Dtype>::init(const NetworkProto& _proto) {
   proto_ = _proto;
+  conv_algorithm_cache_.Clear();
+  conv_algorithm_cache_loaded_ = false;
+  param_begin_ = nullptr;
+  gradient_begin_ = nullptr;
+  num_trainable_ = 0;
+  param_bytes_ = 0;
+  fprop_allocations_ = {0, 0};
+  bprop_allocations_ = {0, 0};
+  update_allocations_ = {0, 0};
   LOG(INFO) << "\n" << proto_.DebugString();
   // a network MUST have at least two
   // layers: an input layer and an output layer
@@ -98,6 +113,20 @@ void Network<Dtype>::init(const NetworkProto& _proto) {
 
     layers_.push_back(Layer<Dtype>::create(layer_proto));
   }
+
+  thread_pool_.reset();
+  if (proto_.num_threads() != 1) {
+    std::vector<int> cpus(proto_.cpu().begin(), proto_.cpu().end());
+    thread_pool_.reset(new ThreadPool(proto_.num_threads(), cpus));
+
+    // a worker may run its first product in any pass, so that its
+    // buffers have to be there before the first one
+    thread_pool_->for_each_thread(
+        [](int) { internal::gemm_reserve_buffers<Dtype>(); });
+  }
+  for (auto& _layer : layers_) {
+    _layer->set_thread_pool(thread_pool_.get());
+  }
 }
 
 template <typename Dtype>
@@ -111,6 +140,10 @@ void Network<Dtype>::copy_trained_network(const std::string& filename,
     read_proto_txt(filename, &network_proto);
   }
 
+  // the layers replace their parameters
+  bool has_arena = arena_ != nullptr;
+  undo_arena();
+
   for (int i = 0; i < network_proto.layer_proto_size(); i++) {
     const auto& p = network_proto.layer_proto(i);
     if (!p.param_size()) {
@@ -123,11 +156,16 @@ void Network<Dtype>::copy_trained_network(const std::string& filename,
       }
     }
   }
+
+  if (has_arena) {
+    build_arena();
+  }
 }
 
 template <typename Dtype>
 void Network<Dtype>::save_network(const std::string& filename,
-                                  bool is_binary /*= false*/) {
+                                  bool is_binary /*= false*/,
+                                  bool with_packed_param /*= false*/) {
   int num_layers = layers_.size();
   NetworkProto _proto;
   for (int i = 0; i < num_layers; i++) {
@@ -135,11 +173,19 @@ void Network<Dtype>::save_network(const std::string& filename,
     auto* target = _proto.add_layer_proto();
     target->CopyFrom(layer.proto());
     target->clear_param();
+    target->clear_packed_param();
 
     auto param = layer.param();
     for (int j = 0; j < param.size(); j++) {
       param[j]->to_proto(target->add_param());
     }
+
+    if (with_packed_param) {
+      auto packed_param = layer.packed_param();
+      for (int j = 0; j < packed_param.size(); j++) {
+        packed_param[j]->to_proto(target->add_packed_param());
+      }
+    }
   }
 
   if (is_binary) {
@@ -152,57 +198,485 @@ void Network<Dtype>::save_network(const std::string& filename,
 
 template <typename Dtype>
 void Network<Dtype>::reshape() {
-  layers_[0]->reshape({}, {}, get_data_top_mutable(0), {});
+  // the new shapes may not fit into the old buffers
+  undo_arena();
+  undo_memory_plan();
+
+  compile();
+
+  layers_[0]->reshape({}, {}, steps_[0].top, {});
   for (int i = 1; i < layers_.size(); i++) {
     LOG(INFO) << "layer " << layers_[i]->proto().name() << " reshape()";
-    layers_[i]->reshape(get_data_bottom(i), get_gradient_bottom_mutable(i),
-                        get_data_top_mutable(i), get_gradient_top_mutable(i));
-    for (const auto& b : get_data_bottom(i)) {
+    autotune(i);
+    const auto& s = steps_[i];
+    layers_[i]->reshape(s.bottom, s.bottom_gradient, s.top,
+                        get_gradient_top_mutable(i));
+    for (const auto& b : s.bottom) {
       LOG(INFO) << "  " << b->shape_info();
     }
   }
+
+  if (proto_.plan_memory()) {
+    bool is_test = true;
+    for (const auto& _layer : layers_) {
+      is_test = is_test && _layer->proto().phase() == TEST;
+    }
+
+    if (is_test) {
+      plan_memory();
+    } else  // NOLINT
+    {
+      LOG(INFO) << "skip plan_memory() since not all layers are in TEST phase";
+    }
+  }
+
+  if (proto_.use_arena()) {
+    build_arena();
+  }
+}
+
+template <typename Dtype>
+void Network<Dtype>::compile() {
+  steps_.clear();
+  for (int i = 0; i < layers_.size(); i++) {
+    Step s;
+    s.bottom = get_data_bottom(i);
+    s.bottom_gradient = get_gradient_bottom_mutable(i);
+    s.top = get_data_top_mutable(i);
+    s.const_top = get_data_top(i);
+    s.top_gradient = get_gradient_top(i);
+    steps_.push_back(s);
+  }
+
+  gradients_.clear();
+  for (auto& g : gradient_) {
+    gradients_.push_back(g.second.get());
+  }
+}
+
+template <typename Dtype>
+const MemoryPlan& Network<Dtype>::plan_memory() {
+  undo_memory_plan();
+
+  int num_layers = layers_.size();
+
+  // the index of the last layer that reads each activation
+  std::map<std::string, int> last_use;
+  for (int i = 1; i < num_layers; i++) {
+    const auto& p = layers_[i]->proto();
+    for (int j = 0; j < p.bottom_size(); j++) {
+      last_use[p.bottom(j)] = i;
+    }
+  }
+
+  MemoryPlan plan;
+
+  // for every buffer, its size in bytes and the last use of the
+  // activation in it; it is free for layer i if the last use is < i
+  std::vector<size_t> size;
+  std::vector<int> busy_until;
+  std::vector<std::pair<Array<Dtype>*, int>> assignment;
+
+  for (int i = 0; i < num_layers; i++) {
+    const auto& top = steps_[i].top;
+    const auto& p = layers_[i]->proto();
+    for (int j = 0; j < p.top_size(); j++) {
+      const auto& name = p.top(j);
+      auto* arr = top[j];
+      size_t bytes = arr->padded_total() * sizeof(Dtype);
+      plan.bytes_before += bytes;
+      if (i == 0 || !last_use.count(name) || !bytes) {
+        plan.bytes_after += bytes;
+        continue;
+      }
+
+      // the smallest free buffer that is large enough,
+      // otherwise the largest free buffer, which grows
+      int best = -1;
+      for (int k = 0; k < size.size(); k++) {
+        if (busy_until[k] >= i) continue;
+        if (best == -1) {
+          best = k;
+        } else if (size[best] < bytes) {
+          if (size[k] > size[best]) best = k;
+        } else if (size[k] >= bytes && size[k] < size[best]) {
+          best = k;
+        }
+      }
+
+      if (best == -1) {
+        best = size.size();
+        size.push_back(0);
+        busy_until.push_back(0);
+      }
+
+      size[best] = std::max(size[best], bytes);
+      busy_until[best] = last_use[name];
+      assignment.emplace_back(arr, best);
+    }
+  }
+
+  for (auto bytes : size) {
+    buffers_.emplace_back(new SharedBufferAllocator(bytes));
+    plan.bytes_after += bytes;
+  }
+
+  for (const auto& a : assignment) {
+    auto* arr = a.first;
+    int n = arr->n_;
+    int c = arr->c_;
+    int h = arr->h_;
+    int w = arr->w_;
+    // the old memory is released
+    arr->set_allocator(buffers_[a.second].get());
+    arr->init(n, c, h, w);
+    shared_.push_back(arr);
+  }
+
+  plan.num_shared = shared_.size();
+  plan.num_buffers = buffers_.size();
+  memory_plan_ = plan;
+
+  LOG(INFO) << "plan_memory(): " << plan.bytes_before << " bytes -> "
+            << plan.bytes_after << " bytes, " << plan.num_shared
+            << " activations in " << plan.num_buffers << " buffers";
+
+  return memory_plan_;
+}
+
+template <typename Dtype>
+void Network<Dtype>::undo_memory_plan() {
+  for (auto* arr : shared_) {
+    int n = arr->n_;
+    int c = arr->c_;
+    int h = arr->h_;
+    int w = arr->w_;
+    arr->set_allocator(nullptr);
+    arr->init(n, c, h, w);
+  }
+  shared_.clear();
+  buffers_.clear();
+  memory_plan_ = MemoryPlan();
+}
+
+template <typename Dtype>
+void Network<Dtype>::build_arena() {
+  undo_arena();
+
+  // moving the parameters does not change them,
+  // so param_version() is left as it is
+  std::vector<Array<Dtype>*> trainable;
+  std::vector<Array<Dtype>*> fixed;
+  std::vector<Array<Dtype>*> gradients;
+  for (const auto& _layer : layers_) {
+    auto param = _layer->param();
+    auto gradient = _layer->mutable_gradient();
+    for (int i = 0; i < param.size(); i++) {
+      auto* arr = const_cast<Array<Dtype>*>(param[i]);
+      if (i < gradient.size()) {
+        trainable.push_back(arr);
+        gradients.push_back(gradient[i]);
+      } else  // NOLINT
+      {
+        fixed.push_back(arr);
+      }
+    }
+  }
+
+  std::vector<Array<Dtype>*> arrays(trainable);
+  arrays.insert(arrays.end(), fixed.begin(), fixed.end());
+  arrays.insert(arrays.end(), gradients.begin(), gradients.end());
+  int num_params = trainable.size() + fixed.size();
+
+  size_t trainable_bytes = 0;
+  for (const auto* arr : trainable) {
+    trainable_bytes += ArenaAllocator::block_size(arr->padded_total() *
+                                                  sizeof(Dtype));
+  }
+  CHECK_EQ(trainable_bytes % sizeof(Dtype), 0);
+
+  // keep the history if the parameters are the same
+  if (history_.total_ != trainable_bytes / sizeof(Dtype)) {
+    history_.init(1, 1, 1, trainable_bytes / sizeof(Dtype));
+  }
+  arrays.push_back(&history_);
+
+  for (auto* m : {&data_, &gradient_}) {
+    for (auto& p : *m) {
+      auto* arr = p.second.get();
+      if (std::find(shared_.begin(), shared_.end(), arr) == shared_.end()) {
+        arrays.push_back(arr);
+      }
+    }
+  }
+
+  size_t bytes = 0;
+  for (const auto* arr : arrays) {
+    bytes += ArenaAllocator::block_size(arr->padded_total() * sizeof(Dtype));
+  }
+  arena_.reset(new ArenaAllocator(bytes));
+
+  for (auto* arr : arrays) {
+    if (arr->total_) {
+      relocate(arr, arena_.get());
+      arena_arrays_.push_back(arr);
+    }
+  }
+
+  // the blocks are consecutive and in the order of `arrays`
+  param_begin_ = reinterpret_cast<Dtype*>(const_cast<char*>(arena_->data()));
+  param_bytes_ = 0;
+  for (int i = 0; i < num_params; i++) {
+    param_bytes_ +=
+        ArenaAllocator::block_size(arrays[i]->padded_total() * sizeof(Dtype));
+  }
+  gradient_begin_ = param_begin_ + param_bytes_ / sizeof(Dtype);
+  num_trainable_ = history_.total_;
+  if (!gradients.empty()) {
+    CHECK_EQ(gradients[0]->d_, gradient_begin_);
+  }
+
+  LOG(INFO) << "arena: " << bytes << " bytes for " << arena_arrays_.size()
+            << " arrays, " << param_bytes_ << " bytes of parameters";
+}
+
+template <typename Dtype>
+void Network<Dtype>::undo_arena() {
+  for (auto* arr : arena_arrays_) {
+    relocate(arr, nullptr);
+  }
+  arena_arrays_.clear();
+  arena_.reset();
+  param_begin_ = nullptr;
+  gradient_begin_ = nullptr;
+  num_trainable_ = 0;
+  param_bytes_ = 0;
+}
+
+template <typename Dtype>
+void Network<Dtype>::relocate(Array<Dtype>* arr, Allocator* allocator) {
+  Array<Dtype> tmp;
+  tmp.set_allocator(allocator);
+  tmp.init(arr->n_, arr->c_, arr->h_, arr->w_, false);
+  std::copy(arr->d_, arr->d_ + arr->padded_total(), tmp.d_);
+  *arr = std::move(tmp);
+}
+
+template <typename Dtype>
+AllocationStats Network<Dtype>::allocation_stats() {
+  AllocationStats res = thread_allocation_stats();
+  if (thread_pool_) {
+    res = res + thread_pool_->worker_allocation_stats();
+  }
+  return res;
+}
+
+template <typename Dtype>
+void Network<Dtype>::update_parameters(int current_iter,
+                                       double learning_rate) {
+  auto start = allocation_stats();
+  if (!arena_) {
+    for (int i = 1; i < layers_.size(); i++) {
+      layers_[i]->update_parameters(current_iter, learning_rate);
+    }
+  } else  // NOLINT
+  {
+    // it runs also over the padding between the parameters,
+    // which nothing reads
+    parallel_for(thread_pool_.get(), 0, num_trainable_, kParallelGrain,
+                 [&](int begin, int end) {
+                   sgd_update<Dtype>(end - begin, Dtype(learning_rate),
+                                     param_begin_ + begin,
+                                     gradient_begin_ + begin,
+                                     history_.d_ + begin);
+                 });
+    for (const auto& _layer : layers_) {
+      _layer->param_changed();
+    }
+  }
+  update_allocations_ = allocation_stats() - start;
+}
+
+template <typename Dtype>
+void Network<Dtype>::save_param(const std::string& filename) const {
+  CHECK(arena_) << "save_param() requires use_arena";
+  std::ofstream of(filename, std::ios::binary);
+  CHECK(of) << "failed to open " << filename;
+  of.write(reinterpret_cast<const char*>(param_begin_), param_bytes_);
+  CHECK(of) << "failed to write " << filename;
+}
+
+template <typename Dtype>
+void Network<Dtype>::load_param(const std::string& filename) {
+  CHECK(arena_) << "load_param() requires use_arena";
+  std::ifstream is(filename, std::ios::binary | std::ios::ate);
+  CHECK(is) << "failed to open " << filename;
+  CHECK_EQ(static_cast<size_t>(is.tellg()), param_bytes_)
+      << filename << " is not from this network";
+  is.seekg(0);
+  is.read(reinterpret_cast<char*>(param_begin_), param_bytes_);
+  CHECK(is) << "failed to read " << filename;
+  for (const auto& _layer : layers_) {
+    _layer->param_changed();
+  }
+}
+
+template <typename Dtype>
+void Network<Dtype>::autotune(int i) {
+  auto* conv = dynamic_cast<ConvolutionLayer<Dtype>*>(layers_[i].get());
+  if (!conv ||
+      conv->proto().conv_proto().algorithm() != ConvolutionLayerProto::AUTO) {
+    return;
+  }
+
+  const std::string& filename = proto_.conv_algorithm_cache();
+  if (!conv_algorithm_cache_loaded_) {
+    if (!filename.empty() && std::ifstream(filename).good()) {
+      read_proto_txt(filename, &conv_algorithm_cache_);
+    }
+    conv_algorithm_cache_loaded_ = true;
+  }
+
+  const auto& b = *steps_[i].bottom[0];
+  const auto& p = conv->proto();
+
+  ConvolutionAlgorithmEntry key;
+  key.set_n(b.n_);
+  key.set_c(b.c_);
+  key.set_h(b.h_);
+  key.set_w(b.w_);
+  key.set_num_output(p.conv_proto().num_output());
+  key.set_kernel_size(p.conv_proto().kernel_size());
+  key.set_stride(conv->stride());
+  key.set_pad_h(conv->pad_h());
+  key.set_pad_w(conv->pad_w());
+  key.set_dilation(conv->dilation());
+  key.set_group(conv->group());
+  key.set_num_threads(num_threads());
+  key.set_phase(p.phase());
+  key.set_dtype_size(sizeof(Dtype));
+
+  for (const auto& e : conv_algorithm_cache_.entry()) {
+    if (e.n() == key.n() && e.c() == key.c() && e.h() == key.h() &&
+        e.w() == key.w() && e.num_output() == key.num_output() &&
+        e.kernel_size() == key.kernel_size() &&
+        e.stride() == key.stride() && e.pad_h() == key.pad_h() &&
+        e.pad_w() == key.pad_w() && e.dilation() == key.dilation() &&
+        e.group() == key.group() &&
+        e.num_threads() == key.num_threads() && e.phase() == key.phase() &&
+        e.dtype_size() == key.dtype_size()) {
+      conv->set_algorithm(e.algorithm());
+      LOG(INFO) << "  use cached algorithm "
+                << ConvolutionLayerProto::Algorithm_Name(conv->algorithm());
+      return;
+    }
+  }
+
+  auto best = ConvolutionLayerProto::IM2COL_GEMM;
+  double best_time = std::numeric_limits<double>::max();
+  for (auto algorithm :
+       {ConvolutionLayerProto::IM2COL_GEMM, ConvolutionLayerProto::DIRECT,
+        ConvolutionLayerProto::WINOGRAD_2X2,
+        ConvolutionLayerProto::WINOGRAD_4X4, ConvolutionLayerProto::FFT}) {
+    if (!conv->supports(algorithm)) {
+      continue;
+    }
+
+    conv->set_algorithm(algorithm);
+    double t = time_layer(i, best_time);
+    LOG(INFO) << "  " << ConvolutionLayerProto::Algorithm_Name(algorithm)
+              << ": " << t * 1000 << " ms";
+    if (t < best_time) {
+      best = algorithm;
+      best_time = t;
+    }
+  }
+
+  conv->set_algorithm(best);
+  LOG(INFO) << "  select " << ConvolutionLayerProto::Algorithm_Name(best);
+
+  key.set_algorithm(best);
+  *conv_algorithm_cache_.add_entry() = key;
+  if (!filename.empty()) {
+    write_proto_txt(filename, conv_algorithm_cache_);
+  }
+}
+
+template <typename Dtype>
+double Network<Dtype>::time_layer(int i, double limit) {
+  static constexpr int kNumRuns = 3;
+
+  auto& layer = *layers_[i];
+  const auto& s = steps_[i];
+  layer.reshape(s.bottom, s.bottom_gradient, s.top,
+                get_gradient_top_mutable(i));
+
+  bool is_train = layer.proto().phase() == TRAIN;
+
+  // the first run is a warm up
+  double res = std::numeric_limits<double>::max();
+  for (int k = 0; k <= kNumRuns; k++) {
+    if (is_train) {
+      // the parameters change in every iteration, so
+      // the kernels cached by the layer are invalidated
+      layer.mutable_param();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    layer.fprop(s.bottom, s.top);
+    if (is_train) {
+      layer.bprop(s.bottom, s.bottom_gradient, s.const_top, s.top_gradient);
+    }
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+
+    if (k > 0) {
+      res = std::min(res, t.count());
+    }
+
+    if (t.count() > limit) {
+      break;
+    }
+  }
+
+  // the gradients are garbage now, but they are cleared by bprop()
+  return res;
 }
 
 template <typename Dtype>
 void Network<Dtype>::fprop() {
+  auto start = allocation_stats();
   if (data_callback_) {
-    data_callback_(get_data_top_mutable(0));
+    data_callback_(steps_[0].top);
   } else  // NOLINT
   {
-    layers_[0]->fprop({}, get_data_top_mutable(0));
+    layers_[0]->fprop({}, steps_[0].top);
   }
   for (int i = 1; i < layers_.size(); i++) {
-    layers_[i]->fprop(get_data_bottom(i), get_data_top_mutable(i));
+    layers_[i]->fprop(steps_[i].bottom, steps_[i].top);
   }
+  fprop_allocations_ = allocation_stats() - start;
 }
 
 template <typename Dtype>
 void Network<Dtype>::bprop() {
+  auto start = allocation_stats();
   for (int i = 0; i < layers_.size(); i++) {
     layers_[i]->clear_gradient();
   }
 
-  for (auto& g : gradient_) {
-    set_to<Dtype>(g.second.get(), 0);
+  for (auto* g : gradients_) {
+    set_to<Dtype>(g, 0);
   }
 
-  layers_[layers_.size() - 1]->bprop(
-      get_data_bottom(layers_.size() - 1),
-      get_gradient_bottom_mutable(layers_.size() - 1),
-      get_data_top(layers_.size() - 1), {});
-  std::ostringstream ss;
-  ss << "gradient for the last layer:\n";
-  const auto* g = get_gradient_bottom(layers_.size() - 1)[0];
-  for (int i = 0; i < g->total_; i++) {
-    ss << g->d_[i] << " ";
-  }
-  ss << "\n";
-  // LOG(INFO) << ss.str();
+  const auto& last = steps_.back();
+  layers_.back()->bprop(last.bottom, last.bottom_gradient, last.const_top, {});
 
   for (int i = layers_.size() - 2; i >= 1; i--) {
-    layers_[i]->bprop(get_data_bottom(i), get_gradient_bottom_mutable(i),
-                      get_data_top(i), get_gradient_top(i));
+    const auto& s = steps_[i];
+    layers_[i]->bprop(s.bottom, s.bottom_gradient, s.const_top,
+                      s.top_gradient);
   }
+  bprop_allocations_ = allocation_stats() - start;
 }
 
 template <typename Dtype>
@@ -226,7 +700,7 @@ void Network<Dtype>::perform_predication() {
   // we assume that the user has already setup the input data
   // via get_data_top(0)
   for (int i = 1; i < layers_.size(); i++) {
-    layers_[i]->fprop(get_data_bottom(i), get_data_top_mutable(i));
+    layers_[i]->fprop(steps_[i].bottom, steps_[i].top);
   }
   set_phase(saved_phase);
 }
@@ -77,9 +77,6 @@ void Optimizer<Dtype>::start_training() {
 
 template <typename Dtype>
 void Optimizer<Dtype>::update_parameters(int current_iter) {
-  auto& layers = network_->layers();
-  int num_layers = layers.size();
-
   Dtype learning_rate = proto_.learning_rate();
 
   // TODO(fangjun): move the following options to proto
@@ -88,9 +85,7 @@ void Optimizer<Dtype>::update_parameters(int current_iter) {
   double exp = -0.75;
   learning_rate *= std::pow(base, exp);
 
-  for (int i = 1; i < num_layers; i++) {
-    layers[i]->update_parameters(current_iter, learning_rate);
-  }
+  network_->update_parameters(current_iter, learning_rate);
 }
 
 template <typename Dtype>
@@ -52,9 +52,12 @@ void ReLULayer<Dtype>::fprop(const std::vector<const Array<Dtype>*>& bottom,
                              const std::vector<Array<Dtype>*>& top) {
   const auto& b = *bottom[0];
   auto& t = *top[0];
-  for (int i = 0; i < b.total_; i++) {
-    t[i] = max(b[i], Dtype(0));  // NOLINT
-  }
+  parallel_for(this->thread_pool_, 0, b.total_, kParallelGrain,
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   t[i] = max(b[i], Dtype(0));  // NOLINT
+                 }
+               });
 }
 
 template <typename Dtype>
@@ -68,9 +71,12 @@ void ReLULayer<Dtype>::bprop(
 
   const auto& tg = *top_gradient[0];
 
-  for (int i = 0; i < b.total_; i++) {
-    bg[i] = tg[i] * (b[i] >= Dtype(0));
-  }
+  parallel_for(this->thread_pool_, 0, b.total_, kParallelGrain,
+               [&](int begin, int end) {
+                 for (int i = begin; i < end; i++) {
+                   bg[i] = tg[i] * (b[i] >= Dtype(0));
+                 }
+               });
 }
 
 }  // namespace cnn
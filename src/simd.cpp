@@ -0,0 +1,98 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include <initializer_list>
+
+#include "cnn/simd.hpp"
+#include "cnn/simd_kernels.hpp"
+
+namespace cnn {
+
+namespace {
+
+bool cpu_supports(SimdIsa isa) {
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+  // __builtin_cpu_supports also checks with XGETBV that the
+  // OS saves the AVX registers on context switches
+  switch (isa) {
+    case SimdIsa::kGeneric:
+      return true;
+    case SimdIsa::kSse2:
+      return __builtin_cpu_supports("sse2");
+    case SimdIsa::kAvx2:
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case SimdIsa::kAvx512:
+      return __builtin_cpu_supports("avx512f");
+    default:
+      return false;
+  }
+#else
+  return isa == SimdIsa::kGeneric;
+#endif
+}
+
+template <typename Dtype>
+const SimdKernels<Dtype>* compiled_kernels(SimdIsa isa) {
+  switch (isa) {
+    case SimdIsa::kGeneric:
+      return internal::generic_kernels<Dtype>();
+    case SimdIsa::kSse2:
+      return internal::sse2_kernels<Dtype>();
+    case SimdIsa::kAvx2:
+      return internal::avx2_kernels<Dtype>();
+    case SimdIsa::kAvx512:
+      return internal::avx512_kernels<Dtype>();
+    default:
+      return nullptr;
+  }
+}
+
+}  // namespace
+
+template <typename Dtype>
+const SimdKernels<Dtype>* simd_kernels(SimdIsa isa) {
+  if (!cpu_supports(isa)) {
+    return nullptr;
+  }
+  return compiled_kernels<Dtype>(isa);
+}
+
+template const SimdKernels<float>* simd_kernels<float>(SimdIsa isa);
+template const SimdKernels<double>* simd_kernels<double>(SimdIsa isa);
+
+SimdIsa simd_isa() {
+  static const SimdIsa isa = [] {
+    for (SimdIsa candidate :
+         {SimdIsa::kAvx512, SimdIsa::kAvx2, SimdIsa::kSse2}) {
+      if (simd_kernels<float>(candidate) && simd_kernels<double>(candidate)) {
+        return candidate;
+      }
+    }
+    return SimdIsa::kGeneric;
+  }();
+  return isa;
+}
+
+const SimdKernels<float>& Simd<float>::kernels() {
+  static const SimdKernels<float>& kernels = *simd_kernels<float>(simd_isa());
+  return kernels;
+}
+
+const SimdKernels<double>& Simd<double>::kernels() {
+  static const SimdKernels<double>& kernels =
+      *simd_kernels<double>(simd_isa());
+  return kernels;
+}
+
+}  // namespace cnn
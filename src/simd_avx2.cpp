@@ -0,0 +1,113 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include "cnn/simd_kernels.hpp"
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+namespace cnn {
+namespace internal {
+
+#if defined(__AVX2__) && defined(__FMA__)
+
+namespace {
+
+struct Avx2Float {
+  using Scalar = float;
+  using Reg = __m256;
+  static constexpr int kWidth = 8;
+
+  static Reg zero() { return _mm256_setzero_ps(); }
+  static Reg set1(Scalar s) { return _mm256_set1_ps(s); }
+  static Reg load(const Scalar* p) { return _mm256_loadu_ps(p); }
+  static void store(Scalar* p, Reg r) { _mm256_storeu_ps(p, r); }
+  static Reg add(Reg a, Reg b) { return _mm256_add_ps(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm256_sub_ps(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm256_mul_ps(a, b); }
+  static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_ps(a, b, c); }
+  static Reg div(Reg a, Reg b) { return _mm256_div_ps(a, b); }
+  static Reg min(Reg a, Reg b) { return _mm256_min_ps(a, b); }
+  static Reg max(Reg a, Reg b) { return _mm256_max_ps(a, b); }
+  static Reg select_gt(Reg a, Reg b, Reg x, Reg y) {
+    return _mm256_blendv_ps(y, x, _mm256_cmp_ps(a, b, _CMP_GT_OQ));
+  }
+  static Reg bits_and(Reg a, Reg b) { return _mm256_and_ps(a, b); }
+  static Reg bits_or(Reg a, Reg b) { return _mm256_or_ps(a, b); }
+  static Reg shl_mantissa(Reg a) {
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_castps_si256(a), 23));
+  }
+  static Reg shr_mantissa(Reg a) {
+    return _mm256_castsi256_ps(_mm256_srli_epi32(_mm256_castps_si256(a), 23));
+  }
+};
+
+struct Avx2Double {
+  using Scalar = double;
+  using Reg = __m256d;
+  static constexpr int kWidth = 4;
+
+  static Reg zero() { return _mm256_setzero_pd(); }
+  static Reg set1(Scalar s) { return _mm256_set1_pd(s); }
+  static Reg load(const Scalar* p) { return _mm256_loadu_pd(p); }
+  static void store(Scalar* p, Reg r) { _mm256_storeu_pd(p, r); }
+  static Reg add(Reg a, Reg b) { return _mm256_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm256_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm256_mul_pd(a, b); }
+  static Reg fmadd(Reg a, Reg b, Reg c) { return _mm256_fmadd_pd(a, b, c); }
+  static Reg div(Reg a, Reg b) { return _mm256_div_pd(a, b); }
+  static Reg min(Reg a, Reg b) { return _mm256_min_pd(a, b); }
+  static Reg max(Reg a, Reg b) { return _mm256_max_pd(a, b); }
+  static Reg select_gt(Reg a, Reg b, Reg x, Reg y) {
+    return _mm256_blendv_pd(y, x, _mm256_cmp_pd(a, b, _CMP_GT_OQ));
+  }
+  static Reg bits_and(Reg a, Reg b) { return _mm256_and_pd(a, b); }
+  static Reg bits_or(Reg a, Reg b) { return _mm256_or_pd(a, b); }
+  static Reg shl_mantissa(Reg a) {
+    return _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_castpd_si256(a), 52));
+  }
+  static Reg shr_mantissa(Reg a) {
+    return _mm256_castsi256_pd(_mm256_srli_epi64(_mm256_castpd_si256(a), 52));
+  }
+};
+
+}  // namespace
+
+template <>
+const SimdKernels<float>* avx2_kernels<float>() {
+  return VectorKernels<Avx2Float>::get();
+}
+
+template <>
+const SimdKernels<double>* avx2_kernels<double>() {
+  return VectorKernels<Avx2Double>::get();
+}
+
+#else
+
+template <>
+const SimdKernels<float>* avx2_kernels<float>() {
+  return nullptr;
+}
+
+template <>
+const SimdKernels<double>* avx2_kernels<double>() {
+  return nullptr;
+}
+
+#endif
+
+}  // namespace internal
+}  // namespace cnn
@@ -0,0 +1,132 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include "cnn/simd_kernels.hpp"
+
+#if defined(__AVX512F__)
+#include <immintrin.h>
+
+// GCC warns about the _mm512_undefined_*() used as the
+// pass-through operand inside several AVX-512 intrinsics
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#endif
+
+namespace cnn {
+namespace internal {
+
+#if defined(__AVX512F__)
+
+namespace {
+
+struct Avx512Float {
+  using Scalar = float;
+  using Reg = __m512;
+  static constexpr int kWidth = 16;
+
+  static Reg zero() { return _mm512_setzero_ps(); }
+  static Reg set1(Scalar s) { return _mm512_set1_ps(s); }
+  static Reg load(const Scalar* p) { return _mm512_loadu_ps(p); }
+  static void store(Scalar* p, Reg r) { _mm512_storeu_ps(p, r); }
+  static Reg add(Reg a, Reg b) { return _mm512_add_ps(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm512_sub_ps(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm512_mul_ps(a, b); }
+  static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_ps(a, b, c); }
+  static Reg div(Reg a, Reg b) { return _mm512_div_ps(a, b); }
+  static Reg min(Reg a, Reg b) { return _mm512_min_ps(a, b); }
+  static Reg max(Reg a, Reg b) { return _mm512_max_ps(a, b); }
+  static Reg select_gt(Reg a, Reg b, Reg x, Reg y) {
+    return _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a, b, _CMP_GT_OQ), y, x);
+  }
+  // _mm512_and_ps needs AVX-512DQ
+  static Reg bits_and(Reg a, Reg b) {
+    return _mm512_castsi512_ps(
+        _mm512_and_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+  }
+  static Reg bits_or(Reg a, Reg b) {
+    return _mm512_castsi512_ps(
+        _mm512_or_si512(_mm512_castps_si512(a), _mm512_castps_si512(b)));
+  }
+  static Reg shl_mantissa(Reg a) {
+    return _mm512_castsi512_ps(_mm512_slli_epi32(_mm512_castps_si512(a), 23));
+  }
+  static Reg shr_mantissa(Reg a) {
+    return _mm512_castsi512_ps(_mm512_srli_epi32(_mm512_castps_si512(a), 23));
+  }
+};
+
+struct Avx512Double {
+  using Scalar = double;
+  using Reg = __m512d;
+  static constexpr int kWidth = 8;
+
+  static Reg zero() { return _mm512_setzero_pd(); }
+  static Reg set1(Scalar s) { return _mm512_set1_pd(s); }
+  static Reg load(const Scalar* p) { return _mm512_loadu_pd(p); }
+  static void store(Scalar* p, Reg r) { _mm512_storeu_pd(p, r); }
+  static Reg add(Reg a, Reg b) { return _mm512_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm512_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm512_mul_pd(a, b); }
+  static Reg fmadd(Reg a, Reg b, Reg c) { return _mm512_fmadd_pd(a, b, c); }
+  static Reg div(Reg a, Reg b) { return _mm512_div_pd(a, b); }
+  static Reg min(Reg a, Reg b) { return _mm512_min_pd(a, b); }
+  static Reg max(Reg a, Reg b) { return _mm512_max_pd(a, b); }
+  static Reg select_gt(Reg a, Reg b, Reg x, Reg y) {
+    return _mm512_mask_blend_pd(_mm512_cmp_pd_mask(a, b, _CMP_GT_OQ), y, x);
+  }
+  static Reg bits_and(Reg a, Reg b) {
+    return _mm512_castsi512_pd(
+        _mm512_and_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+  }
+  static Reg bits_or(Reg a, Reg b) {
+    return _mm512_castsi512_pd(
+        _mm512_or_si512(_mm512_castpd_si512(a), _mm512_castpd_si512(b)));
+  }
+  static Reg shl_mantissa(Reg a) {
+    return _mm512_castsi512_pd(_mm512_slli_epi64(_mm512_castpd_si512(a), 52));
+  }
+  static Reg shr_mantissa(Reg a) {
+    return _mm512_castsi512_pd(_mm512_srli_epi64(_mm512_castpd_si512(a), 52));
+  }
+};
+
+}  // namespace
+
+template <>
+const SimdKernels<float>* avx512_kernels<float>() {
+  return VectorKernels<Avx512Float>::get();
+}
+
+template <>
+const SimdKernels<double>* avx512_kernels<double>() {
+  return VectorKernels<Avx512Double>::get();
+}
+
+#else
+
+template <>
+const SimdKernels<float>* avx512_kernels<float>() {
+  return nullptr;
+}
+
+template <>
+const SimdKernels<double>* avx512_kernels<double>() {
+  return nullptr;
+}
+
+#endif
+
+}  // namespace internal
+}  // namespace cnn
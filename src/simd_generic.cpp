@@ -0,0 +1,74 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include "cnn/simd_kernels.hpp"
+
+namespace cnn {
+namespace internal {
+
+namespace {
+
+template <typename Dtype>
+struct GenericVector {
+  using Scalar = Dtype;
+  using Reg = Dtype;
+  static constexpr int kWidth = 1;
+
+  static Reg zero() { return 0; }
+  static Reg set1(Scalar s) { return s; }
+  static Reg load(const Scalar* p) { return *p; }
+  static void store(Scalar* p, Reg r) { *p = r; }
+  static Reg add(Reg a, Reg b) { return a + b; }
+  static Reg sub(Reg a, Reg b) { return a - b; }
+  static Reg mul(Reg a, Reg b) { return a * b; }
+  static Reg fmadd(Reg a, Reg b, Reg c) { return a * b + c; }
+  static Reg div(Reg a, Reg b) { return a / b; }
+  static Reg min(Reg a, Reg b) { return (a < b) ? a : b; }
+  static Reg max(Reg a, Reg b) { return (a > b) ? a : b; }
+  static Reg select_gt(Reg a, Reg b, Reg x, Reg y) { return (a > b) ? x : y; }
+
+  static Reg bits_and(Reg a, Reg b) {
+    return from_bits<Dtype>(to_bits(a) & to_bits(b));
+  }
+  static Reg bits_or(Reg a, Reg b) {
+    return from_bits<Dtype>(to_bits(a) | to_bits(b));
+  }
+  static Reg shl_mantissa(Reg a) {
+    return from_bits<Dtype>(to_bits(a) << FloatBits<Dtype>::kMantissaBits);
+  }
+  static Reg shr_mantissa(Reg a) {
+    return from_bits<Dtype>(to_bits(a) >> FloatBits<Dtype>::kMantissaBits);
+  }
+
+  static typename FloatBits<Dtype>::UInt to_bits(Reg a) {
+    typename FloatBits<Dtype>::UInt u;
+    memcpy(&u, &a, sizeof(u));
+    return u;
+  }
+};
+
+}  // namespace
+
+template <>
+const SimdKernels<float>* generic_kernels<float>() {
+  return VectorKernels<GenericVector<float>>::get();
+}
+
+template <>
+const SimdKernels<double>* generic_kernels<double>() {
+  return VectorKernels<GenericVector<double>>::get();
+}
+
+}  // namespace internal
+}  // namespace cnn
@@ -0,0 +1,115 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include "cnn/simd_kernels.hpp"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace cnn {
+namespace internal {
+
+#if defined(__SSE2__)
+
+namespace {
+
+struct Sse2Float {
+  using Scalar = float;
+  using Reg = __m128;
+  static constexpr int kWidth = 4;
+
+  static Reg zero() { return _mm_setzero_ps(); }
+  static Reg set1(Scalar s) { return _mm_set1_ps(s); }
+  static Reg load(const Scalar* p) { return _mm_loadu_ps(p); }
+  static void store(Scalar* p, Reg r) { _mm_storeu_ps(p, r); }
+  static Reg add(Reg a, Reg b) { return _mm_add_ps(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm_sub_ps(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm_mul_ps(a, b); }
+  static Reg fmadd(Reg a, Reg b, Reg c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+  static Reg div(Reg a, Reg b) { return _mm_div_ps(a, b); }
+  static Reg min(Reg a, Reg b) { return _mm_min_ps(a, b); }
+  static Reg max(Reg a, Reg b) { return _mm_max_ps(a, b); }
+  static Reg select_gt(Reg a, Reg b, Reg x, Reg y) {
+    Reg mask = _mm_cmpgt_ps(a, b);
+    return _mm_or_ps(_mm_and_ps(mask, x), _mm_andnot_ps(mask, y));
+  }
+  static Reg bits_and(Reg a, Reg b) { return _mm_and_ps(a, b); }
+  static Reg bits_or(Reg a, Reg b) { return _mm_or_ps(a, b); }
+  static Reg shl_mantissa(Reg a) {
+    return _mm_castsi128_ps(_mm_slli_epi32(_mm_castps_si128(a), 23));
+  }
+  static Reg shr_mantissa(Reg a) {
+    return _mm_castsi128_ps(_mm_srli_epi32(_mm_castps_si128(a), 23));
+  }
+};
+
+struct Sse2Double {
+  using Scalar = double;
+  using Reg = __m128d;
+  static constexpr int kWidth = 2;
+
+  static Reg zero() { return _mm_setzero_pd(); }
+  static Reg set1(Scalar s) { return _mm_set1_pd(s); }
+  static Reg load(const Scalar* p) { return _mm_loadu_pd(p); }
+  static void store(Scalar* p, Reg r) { _mm_storeu_pd(p, r); }
+  static Reg add(Reg a, Reg b) { return _mm_add_pd(a, b); }
+  static Reg sub(Reg a, Reg b) { return _mm_sub_pd(a, b); }
+  static Reg mul(Reg a, Reg b) { return _mm_mul_pd(a, b); }
+  static Reg fmadd(Reg a, Reg b, Reg c) { return _mm_add_pd(_mm_mul_pd(a, b), c); }
+  static Reg div(Reg a, Reg b) { return _mm_div_pd(a, b); }
+  static Reg min(Reg a, Reg b) { return _mm_min_pd(a, b); }
+  static Reg max(Reg a, Reg b) { return _mm_max_pd(a, b); }
+  static Reg select_gt(Reg a, Reg b, Reg x, Reg y) {
+    Reg mask = _mm_cmpgt_pd(a, b);
+    return _mm_or_pd(_mm_and_pd(mask, x), _mm_andnot_pd(mask, y));
+  }
+  static Reg bits_and(Reg a, Reg b) { return _mm_and_pd(a, b); }
+  static Reg bits_or(Reg a, Reg b) { return _mm_or_pd(a, b); }
+  static Reg shl_mantissa(Reg a) {
+    return _mm_castsi128_pd(_mm_slli_epi64(_mm_castpd_si128(a), 52));
+  }
+  static Reg shr_mantissa(Reg a) {
+    return _mm_castsi128_pd(_mm_srli_epi64(_mm_castpd_si128(a), 52));
+  }
+};
+
+}  // namespace
+
+template <>
+const SimdKernels<float>* sse2_kernels<float>() {
+  return VectorKernels<Sse2Float>::get();
+}
+
+template <>
+const SimdKernels<double>* sse2_kernels<double>() {
+  return VectorKernels<Sse2Double>::get();
+}
+
+#else
+
+template <>
+const SimdKernels<float>* sse2_kernels<float>() {
+  return nullptr;
+}
+
+template <>
+const SimdKernels<double>* sse2_kernels<double>() {
+  return nullptr;
+}
+
+#endif
+
+}  // namespace internal
+}  // namespace cnn
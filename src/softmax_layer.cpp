@@ -14,13 +14,97 @@
   -----------------------------------------------------------------  */
 #include <glog/logging.h>
 
-#include <limits>
+#include <algorithm>
 #include <vector>
 
+#include "cnn/array_expr.hpp"
 #include "cnn/softmax_layer.hpp"
 
 namespace cnn {
 
+namespace internal {
+
+/**
+ * Number of pixels softmax_fprop() and softmax_bprop() process
+ * at a time, so that the C rows of a tile, e.g., 20 KB for 20
+ * channels of float, are still in cache in the next pass.
+ */
+constexpr int kSoftmaxTile = 256;
+
+}  // namespace internal
+
+template <typename Dtype>
+void softmax_fprop(int channels, int pixels, const Dtype* x, Dtype* y,
+                   Dtype* max_val, Dtype* sum_exp) {
+  if (pixels == 1) {
+    *max_val = max_arr(channels, x);
+    *sum_exp = sub_exp_sum(channels, *max_val, x, y);
+    scale_arr(channels, Dtype(1) / *sum_exp, y, y);
+    return;
+  }
+
+  // the loops are written with array_expr.hpp, which vectorizes
+  // them without knowing whether the rows alias
+  for (int p = 0; p < pixels; p += internal::kSoftmaxTile) {
+    int len = std::min(internal::kSoftmaxTile, pixels - p);
+    Dtype* m = max_val + p;
+    Dtype* s = sum_exp + p;
+
+    std::copy(x + p, x + p + len, m);
+    for (int c = 1; c < channels; c++) {
+      const Dtype* xc = x + c * pixels + p;
+      assign(len, m, maximum(array_expr(len, m), array_expr(len, xc)));
+    }
+
+    // for float and double, the exponentials are computed
+    // with SIMD; Jet (only in unit test) uses cnn::exp()
+    set_to(len, s, Dtype(0));
+    for (int c = 0; c < channels; c++) {
+      const Dtype* xc = x + c * pixels + p;
+      Dtype* yc = y + c * pixels + p;
+      assign(len, yc, array_expr(len, xc) - array_expr(len, m));
+      exp_arr(len, yc, yc);
+      assign(len, s, array_expr(len, s) + array_expr(len, yc));
+    }
+
+    for (int c = 0; c < channels; c++) {
+      Dtype* yc = y + c * pixels + p;
+      assign(len, yc, array_expr(len, yc) / array_expr(len, s));
+    }
+  }
+}
+
+template <typename Dtype>
+void softmax_bprop(int channels, int pixels, const Dtype* y, const Dtype* dy,
+                   Dtype* dx, Dtype* dot) {
+  if (pixels == 1) {
+    Dtype d = ax_dot_by(channels, Dtype(1), dy, Dtype(1), y);
+    for (int c = 0; c < channels; c++) {
+      dx[c] += y[c] * (dy[c] - d);
+    }
+    return;
+  }
+
+  for (int p = 0; p < pixels; p += internal::kSoftmaxTile) {
+    int len = std::min(internal::kSoftmaxTile, pixels - p);
+    Dtype* d = dot + p;
+
+    set_to(len, d, Dtype(0));
+    for (int c = 0; c < channels; c++) {
+      auto yc = array_expr(len, y + c * pixels + p);
+      auto dyc = array_expr(len, dy + c * pixels + p);
+      assign(len, d, array_expr(len, d) + dyc * yc);
+    }
+
+    for (int c = 0; c < channels; c++) {
+      auto yc = array_expr(len, y + c * pixels + p);
+      auto dyc = array_expr(len, dy + c * pixels + p);
+      Dtype* dxc = dx + c * pixels + p;
+      assign(len, dxc, array_expr(len, dxc) + yc * (dyc - array_expr(len, d)));
+    }
+  }
+}
+
 template <typename Dtype>
 SoftmaxLayer<Dtype>::SoftmaxLayer(const LayerProto& _proto)
     : Layer<Dtype>(_proto) {}
@@ -50,7 +134,10 @@ void SoftmaxLayer<Dtype>::reshape(
   CHECK_GE(bottom[0]->c_, 2)
       << "we need at least two numbers to compute softmax!";
 
-  buffer_.init(1, 1, 1, bottom[0]->c_);
+  // scratch space, overwritten in every call; one plane per
+  // image, since the images may be processed in parallel
+  max_.init(bottom[0]->n_, 1, bottom[0]->h_, bottom[0]->w_, false);
+  sum_.init(bottom[0]->n_, 1, bottom[0]->h_, bottom[0]->w_, false);
 }
 
 template <typename Dtype>
@@ -58,31 +145,20 @@ void SoftmaxLayer<Dtype>::fprop(const std::vector<const Array<Dtype>*>& bottom,
                                 const std::vector<Array<Dtype>*>& top) {
   const auto& b = *bottom[0];
   auto& target = *top[0];
-  for (int n = 0; n < b.n_; n++)
-    for (int h = 0; h < b.h_; h++)
-      for (int w = 0; w < b.w_; w++) {
-        Dtype max_val = b(n, 0, h, w);
-        for (int c = 1; c < b.c_; c++) {
-          max_val = (b(n, c, h, w) > max_val) ? b(n, c, h, w) : max_val;
-        }
-
-        for (int c = 0; c < b.c_; c++) {
-          // we use cnn::exp() here for Jet (only in unit test)
-          buffer_[c] = exp(b(n, c, h, w) - max_val);
-        }
-
-        Dtype den = sum_arr(buffer_);
-        Dtype scale = Dtype(1) / den;
-        scale_arr(scale, buffer_, &buffer_);
-        for (int c = 0; c < b.c_; c++) {
-          target(n, c, h, w) = buffer_[c];
-        }
-      }
+  int pixels = b.h_ * b.w_;
+  parallel_for(this->thread_pool_, 0, b.n_, parallel_grain(b.c_ * pixels),
+               [&](int begin, int end) {
+                 for (int n = begin; n < end; n++) {
+                   softmax_fprop(b.c_, pixels, &b(n, 0, 0, 0),
+                                 &target(n, 0, 0, 0), &max_(n, 0, 0, 0),
+                                 &sum_(n, 0, 0, 0));
+                 }
+               });
 }
 
 template <typename Dtype>
 void SoftmaxLayer<Dtype>::bprop(
-    const std::vector<const Array<Dtype>*>& bottom,
+    const std::vector<const Array<Dtype>*>& /*bottom*/,
     const std::vector<Array<Dtype>*>& bottom_gradient,
     const std::vector<const Array<Dtype>*>& top,
     const std::vector<const Array<Dtype>*>& top_gradient) {
@@ -90,29 +166,15 @@ void SoftmaxLayer<Dtype>::bprop(
   const auto& tg = *top_gradient[0];
   const auto& t = *top[0];
 
-  for (int n = 0; n < bottom[0]->n_; n++)
-    for (int h = 0; h < bottom[0]->h_; h++)
-      for (int w = 0; w < bottom[0]->w_; w++)
-        for (int c = 0; c < bottom[0]->c_; c++) {
-          Dtype yc = t(n, c, h, w);
-          // TODO(fangjun) optimize it, i.e., eliminate the inner else condition
-          // TODO(fangjun) implement copy_arr() to copy an array
-          for (int i = 0; i < bottom[0]->c_; i++) {
-            Dtype scale = tg(n, i, h, w);
-            Dtype yi = t(n, i, h, w);
-            bg(n, c, h, w) += scale * yi * ((i == c) - yc);
-#if 0
-            if (i == c)
-            {
-                bg(n, c, h, w) += scale * (yi - yi*yc);
-            }
-            else    // NOLINT
-            {
-                bg(n, c, h, w) += scale * (-yi * yc);
-            }
-#endif
-          }
-        }
+  int pixels = t.h_ * t.w_;
+  parallel_for(this->thread_pool_, 0, t.n_, parallel_grain(t.c_ * pixels),
+               [&](int begin, int end) {
+                 for (int n = begin; n < end; n++) {
+                   softmax_bprop(t.c_, pixels, &t(n, 0, 0, 0),
+                                 &tg(n, 0, 0, 0), &bg(n, 0, 0, 0),
+                                 &sum_(n, 0, 0, 0));
+                 }
+               });
 }
 
 }  // namespace cnn
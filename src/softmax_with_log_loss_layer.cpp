@@ -13,11 +13,9 @@
   along with this program. If not, see <http://www.gnu.org/licenses/>
   -----------------------------------------------------------------  */
 
-#include <algorithm>
 #include <vector>
 
 #include "cnn/array_math.hpp"
-#include "cnn/common.hpp"
 #include "cnn/softmax_with_log_loss_layer.hpp"
 
 namespace cnn {
@@ -25,11 +23,7 @@ namespace cnn {
 template <typename Dtype>
 SoftmaxWithLogLossLayer<Dtype>::SoftmaxWithLogLossLayer(
     const LayerProto& _proto)
-    : Layer<Dtype>(_proto), loss_(0) {
-  LayerProto p;
-  p.set_type(SOFTMAX);
-  softmax_layer_ = Layer<Dtype>::create(p);
-}
+    : Layer<Dtype>(_proto), loss_(0) {}
 
 template <typename Dtype>
 void SoftmaxWithLogLossLayer<Dtype>::reshape(
@@ -50,8 +44,14 @@ void SoftmaxWithLogLossLayer<Dtype>::reshape(
   CHECK_EQ(top.size(), 1);
   top[0]->init(1, 1, 1, 1);
 
-  softmax_layer_->reshape({bottom[0]}, {&softmax_bottom_gradient_},
-                          {&softmax_top_}, {&softmax_top_gradient_});
+  CHECK_GE(bottom[0]->c_, 2)
+      << "we need at least two numbers to compute softmax!";
+
+  // all of them are overwritten by fprop()
+  max_.init_like(*bottom[1], false);
+  sum_exp_.init_like(*bottom[1], false);
+  softmax_top_.init_like(*bottom[0], false);
+  shifted_.init(bottom[0]->n_, 1, 1, 1, false);
 
   if (this->proto_.phase() == TRAIN) {
     CHECK_GE(bottom_gradient.size(), 1);
@@ -67,26 +67,42 @@ template <typename Dtype>
 void SoftmaxWithLogLossLayer<Dtype>::fprop(
     const std::vector<const Array<Dtype>*>& bottom,
     const std::vector<Array<Dtype>*>& top) {
-  softmax_layer_->fprop({bottom[0]}, {&softmax_top_});
-
-  loss_ = 0;
-
-  const auto& b0 = softmax_top_;
+  const auto& b0 = *bottom[0];
   const auto& b1 = *bottom[1];
 
-  for (int n = 0; n < b1.n_; n++)
-    for (int h = 0; h < b1.h_; h++)
-      for (int w = 0; w < b1.w_; w++) {
-        auto label = b1(n, 0, h, w);  // label for the ground truth
-        auto p = b0(n, label, h, w);  // probability for the predication
-        p = std::max(p, Dtype(g_log_threshold));
-        p = std::min(p, Dtype(1));
+  // the images are independent; their sums are added up
+  // afterwards in a fixed order
+  int pixels = b0.h_ * b0.w_;
+  parallel_for(
+      this->thread_pool_, 0, b0.n_, parallel_grain(b0.c_ * pixels),
+      [&](int begin, int end) {
+        for (int n = begin; n < end; n++) {
+          const Dtype* x = &b0(n, 0, 0, 0);
+          const Dtype* label = &b1(n, 0, 0, 0);  // label for the ground truth
+          const Dtype* m = &max_(n, 0, 0, 0);
+          Dtype* s = &sum_exp_(n, 0, 0, 0);
+
+          softmax_fprop(b0.c_, pixels, x, &softmax_top_(n, 0, 0, 0),
+                        &max_(n, 0, 0, 0), s);
+
+          // sum of x_k - m over all pixels, where k is the label
+          Dtype shifted = 0;
+          for (int p = 0; p < pixels; p++) {
+            int k = label[p];
+            shifted += x[k * pixels + p] - m[p];
+          }
+          shifted_[n] = shifted;
+
+          // all of the logarithms of an image are computed at once,
+          // with SIMD for float and double; Jet (only in unit test)
+          // uses cnn::log()
+          log_arr(pixels, s, s);
+        }
+      });
 
-        // use cnn::log() here for Jet in the unit test.
-        loss_ += log(p);
-      }
+  loss_ = sum_arr(sum_exp_) - sum_arr(shifted_);
 
-  loss_ /= Dtype(-1) * b1.total_;  // take the average
+  loss_ /= b1.total_;  // take the average
 
   top[0]->d_[0] = loss_;
 }
@@ -104,14 +120,21 @@ void SoftmaxWithLogLossLayer<Dtype>::bprop(
   Dtype scale = -1;
   scale /= b1.total_;
 
-  for (int n = 0; n < b0.n_; n++)
-    for (int h = 0; h < b0.h_; h++)
-      for (int w = 0; w < b0.w_; w++) {
-        auto label = b1(n, 0, h, w);
-        for (int c = 0; c < b0.c_; c++) {
-          bg(n, c, h, w) = scale * ((label == c) - softmax_top_(n, c, h, w));
-        }
-      }
+  // scale * ((label == c) - y_c), one image at a time
+  int pixels = b0.h_ * b0.w_;
+  int size = b0.c_ * pixels;
+  parallel_for(this->thread_pool_, 0, b0.n_, parallel_grain(size),
+               [&](int begin, int end) {
+                 for (int n = begin; n < end; n++) {
+                   const Dtype* label = &b1(n, 0, 0, 0);
+                   Dtype* g = &bg(n, 0, 0, 0);
+                   scale_arr(size, -scale, &softmax_top_(n, 0, 0, 0), g);
+                   for (int p = 0; p < pixels; p++) {
+                     int k = label[p];
+                     g[k * pixels + p] += scale;
+                   }
+                 }
+               });
 }
 
 }  // namespace cnn
@@ -0,0 +1,229 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include <glog/logging.h>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "cnn/thread_pool.hpp"
+
+namespace cnn {
+
+namespace {
+
+// true in the workers and in a thread running its part of a loop,
+// so that a nested parallel_for() runs serially
+thread_local bool g_in_parallel_for = false;
+
+void pin_to_cpu(int cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (ret != 0) {
+    LOG(WARNING) << "failed to pin a thread to cpu " << cpu;
+  }
+#else
+  (void)cpu;
+#endif
+}
+
+// the first iteration of chunk i of [begin, end), or end
+int chunk_begin(int begin, int end, int grain, int i) {
+  return static_cast<int>(std::min<int64_t>(end, begin + int64_t(i) * grain));
+}
+
+}  // namespace
+
+ThreadPool::ThreadPool(int num_threads, const std::vector<int>& cpus)
+    : num_threads_(num_threads),
+      task_(nullptr),
+      func_(nullptr),
+      grain_(1),
+      in_each_(false),
+      generation_(0),
+      pending_(0),
+      stop_(false) {
+  CHECK_GE(num_threads_, 0);
+  if (num_threads_ == 0) {
+    num_threads_ = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  parts_.reset(new Part[num_threads_]);
+  worker_stats_.assign(num_threads_, AllocationStats{0, 0});
+  for (int i = 0; i < num_threads_; i++) {
+    parts_[i].next = 0;
+    parts_[i].end = 0;
+  }
+
+  for (int i = 1; i < num_threads_; i++) {
+    int cpu = cpus.empty() ? -1 : cpus[(i - 1) % cpus.size()];
+    workers_.emplace_back(&ThreadPool::worker_loop, this, i, cpu);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  start_.notify_all();
+  for (auto& w : workers_) {
+    w.join();
+  }
+}
+
+AllocationStats ThreadPool::worker_allocation_stats() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  AllocationStats res{0, 0};
+  for (const auto& s : worker_stats_) {
+    res = res + s;
+  }
+  return res;
+}
+
+void ThreadPool::run(int begin, int end, int grain, Task task,
+                     const void* func) {
+  if (begin >= end) {
+    return;
+  }
+
+  grain = std::max(grain, 1);
+  int n = end - begin;
+  if (num_threads_ == 1 || n <= grain || g_in_parallel_for) {
+    task(func, begin, end);
+    return;
+  }
+
+  // every part is a whole number of chunks; the threads without
+  // a part only steal
+  int num_chunks = static_cast<int>((int64_t(n) + grain - 1) / grain);
+  int num_parts = std::min(num_threads_, num_chunks);
+  for (int i = 0; i < num_threads_; i++) {
+    int first = static_cast<int>(int64_t(num_chunks) * i / num_parts);
+    int last = static_cast<int>(int64_t(num_chunks) * (i + 1) / num_parts);
+    if (i >= num_parts) {
+      first = last = num_chunks;
+    }
+    parts_[i].next.store(chunk_begin(begin, end, grain, first),
+                         std::memory_order_relaxed);
+    parts_[i].end = chunk_begin(begin, end, grain, last);
+  }
+
+  task_ = task;
+  func_ = func;
+  grain_ = grain;
+
+  // the mutex publishes the parts and the task to the workers
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ = static_cast<int>(workers_.size());
+    generation_++;
+  }
+  start_.notify_all();
+
+  g_in_parallel_for = true;
+  work(0);
+  g_in_parallel_for = false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void ThreadPool::run_in_each(Task task, const void* func) {
+  if (num_threads_ == 1) {
+    task(func, 0, 1);
+    return;
+  }
+
+  task_ = task;
+  func_ = func;
+  in_each_ = true;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ = static_cast<int>(workers_.size());
+    generation_++;
+  }
+  start_.notify_all();
+
+  g_in_parallel_for = true;
+  task(func, 0, 1);
+  g_in_parallel_for = false;
+
+  std::unique_lock<std::mutex> lock(mutex_);
+  done_.wait(lock, [this] { return pending_ == 0; });
+  in_each_ = false;
+}
+
+void ThreadPool::work(int id) {
+  for (int k = 0; k < num_threads_; k++) {
+    Part& part = parts_[(id + k) % num_threads_];
+    while (part.next.load(std::memory_order_relaxed) < part.end) {
+      int b = part.next.fetch_add(grain_, std::memory_order_relaxed);
+      if (b >= part.end) {
+        break;
+      }
+      task_(func_, b, chunk_begin(b, part.end, grain_, 1));
+    }
+  }
+}
+
+void ThreadPool::worker_loop(int id, int cpu) {
+  if (cpu >= 0) {
+    pin_to_cpu(cpu);
+  }
+
+  // a worker never starts a loop of its own
+  g_in_parallel_for = true;
+
+  uint64_t seen = 0;
+  for (;;) {
+    bool in_each;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      start_.wait(lock, [this, seen] { return stop_ || generation_ != seen; });
+      if (stop_) {
+        return;
+      }
+      seen = generation_;
+      in_each = in_each_;
+    }
+
+    if (in_each) {
+      task_(func_, id, id + 1);
+    } else  // NOLINT
+    {
+      work(id);
+    }
+    AllocationStats stats = thread_allocation_stats();
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      worker_stats_[id] = stats;
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+}
+
+}  // namespace cnn
@@ -0,0 +1,268 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include <glog/logging.h>
+
+#include <algorithm>
+
+#include "cnn/array_math.hpp"
+#include "cnn/winograd.hpp"
+
+namespace cnn {
+namespace internal {
+
+/**
+ * One dimensional transforms for F(M, 3).
+ *
+ *  - input():  r = B^T d, with M+2 inputs and M+2 outputs
+ *  - weight(): r = G g, with 3 inputs and M+2 outputs
+ *  - output(): r = A^T m, with M+2 inputs and M outputs
+ *
+ * The two dimensional transforms are computed by applying them
+ * to the columns and then to the rows of a tile. The elements
+ * of a vector are x[0], x[s], x[2*s], ...
+ *
+ * Constants are converted to Dtype explicitly so that a Jet
+ * does not lose its derivatives.
+ */
+template <int M>
+struct WinogradTransform;
+
+template <>
+struct WinogradTransform<2> {
+  template <typename Dtype>
+  static void input(const Dtype* d, int s, Dtype* r, int t) {
+    r[0 * t] = d[0] - d[2 * s];
+    r[1 * t] = d[s] + d[2 * s];
+    r[2 * t] = d[2 * s] - d[s];
+    r[3 * t] = d[s] - d[3 * s];
+  }
+
+  template <typename Dtype>
+  static void weight(const Dtype* g, int s, Dtype* r, int t) {
+    const Dtype half(0.5);
+    r[0 * t] = g[0];
+    r[1 * t] = (g[0] + g[s] + g[2 * s]) * half;
+    r[2 * t] = (g[0] - g[s] + g[2 * s]) * half;
+    r[3 * t] = g[2 * s];
+  }
+
+  template <typename Dtype>
+  static void output(const Dtype* m, int s, Dtype* r, int t) {
+    r[0 * t] = m[0] + m[s] + m[2 * s];
+    r[1 * t] = m[s] - m[2 * s] - m[3 * s];
+  }
+};
+
+template <>
+struct WinogradTransform<4> {
+  template <typename Dtype>
+  static void input(const Dtype* d, int s, Dtype* r, int t) {
+    const Dtype two(2);
+    const Dtype four(4);
+    const Dtype five(5);
+    Dtype d0 = d[0];
+    Dtype d1 = d[s];
+    Dtype d2 = d[2 * s];
+    Dtype d3 = d[3 * s];
+    Dtype d4 = d[4 * s];
+    Dtype d5 = d[5 * s];
+
+    r[0 * t] = four * d0 - five * d2 + d4;
+    r[1 * t] = d4 + d3 - four * (d1 + d2);
+    r[2 * t] = d4 - d3 + four * (d1 - d2);
+    r[3 * t] = d4 - d2 + two * (d3 - d1);
+    r[4 * t] = d4 - d2 - two * (d3 - d1);
+    r[5 * t] = four * d1 - five * d3 + d5;
+  }
+
+  template <typename Dtype>
+  static void weight(const Dtype* g, int s, Dtype* r, int t) {
+    const Dtype quarter(0.25);
+    const Dtype half(0.5);
+    const Dtype sixth(1. / 6);
+    Dtype g0 = g[0];
+    Dtype g1 = g[s];
+    Dtype g2 = g[2 * s];
+
+    r[0 * t] = g0 * quarter;
+    r[1 * t] = -(g0 + g1 + g2) * sixth;
+    r[2 * t] = -(g0 - g1 + g2) * sixth;
+    r[3 * t] = (g0 * quarter + g1 * half + g2) * sixth;
+    r[4 * t] = (g0 * quarter - g1 * half + g2) * sixth;
+    r[5 * t] = g2;
+  }
+
+  template <typename Dtype>
+  static void output(const Dtype* m, int s, Dtype* r, int t) {
+    const Dtype two(2);
+    const Dtype four(4);
+    const Dtype eight(8);
+    Dtype m1_plus_m2 = m[s] + m[2 * s];
+    Dtype m1_minus_m2 = m[s] - m[2 * s];
+    Dtype m3_plus_m4 = m[3 * s] + m[4 * s];
+    Dtype m3_minus_m4 = m[3 * s] - m[4 * s];
+
+    r[0 * t] = m[0] + m1_plus_m2 + m3_plus_m4;
+    r[1 * t] = m1_minus_m2 + two * m3_minus_m4;
+    r[2 * t] = m1_plus_m2 + four * m3_plus_m4;
+    r[3 * t] = m1_minus_m2 + eight * m3_minus_m4 + m[5 * s];
+  }
+};
+
+}  // namespace internal
+
+template <typename Dtype, int M>
+void Winograd<Dtype, M>::transform_weight(const Array<Dtype>& weight,
+                                          bool flip, Array<Dtype>* u) {
+  using Transform = internal::WinogradTransform<M>;
+  static constexpr int A = kAlpha;
+
+  CHECK_EQ(weight.h_, 3);
+  CHECK_EQ(weight.w_, 3);
+
+  int num_output = flip ? weight.c_ : weight.n_;
+  int num_input = flip ? weight.n_ : weight.c_;
+  u->init(kNumElements, 1, num_output, num_input);
+
+  Dtype g[9];
+  Dtype t[A * 3];
+  Dtype r[A * A];
+  for (int o = 0; o < weight.n_; o++)
+    for (int c = 0; c < weight.c_; c++) {
+      const Dtype* w = &weight(o, c, 0, 0);
+      for (int i = 0; i < 9; i++) {
+        g[i] = flip ? w[8 - i] : w[i];
+      }
+
+      // t = G g, then r = t G^T
+      for (int j = 0; j < 3; j++) {
+        Transform::weight(g + j, 3, t + j, 3);
+      }
+      for (int i = 0; i < A; i++) {
+        Transform::weight(t + i * 3, 1, r + i * A, 1);
+      }
+
+      int row = flip ? c : o;
+      int col = flip ? o : c;
+      for (int e = 0; e < kNumElements; e++) {
+        (*u)(e, 0, row, col) = r[e];
+      }
+    }
+}
+
+template <typename Dtype, int M>
+void Winograd<Dtype, M>::convolve(const Array<Dtype>& in,
+                                  const Array<Dtype>& u, const Dtype* bias,
+                                  bool accumulate, Dtype* v, Dtype* m,
+                                  Array<Dtype>* out) {
+  using Transform = internal::WinogradTransform<M>;
+  static constexpr int A = kAlpha;
+
+  int height = in.h_;
+  int width = in.w_;
+  int num_input = in.c_;
+  int num_output = u.h_;
+
+  CHECK_EQ(u.n_, kNumElements);
+  CHECK_EQ(u.w_, num_input);
+  CHECK(out->has_same_shape({in.n_, num_output, height, width}));
+
+  int tiles_h = (height + M - 1) / M;
+  int tiles_w = (width + M - 1) / M;
+  int num_tiles = in.n_ * tiles_h * tiles_w;
+
+  Dtype d[A * A];
+  Dtype t[A * A];
+  Dtype r[A * A];
+
+  // input transform: v[e][c][p] = (B^T d B)[e] of tile p in channel c
+  for (int n = 0; n < in.n_; n++)
+    for (int c = 0; c < num_input; c++) {
+      const Dtype* src = &in(n, c, 0, 0);
+      for (int ty = 0; ty < tiles_h; ty++)
+        for (int tx = 0; tx < tiles_w; tx++) {
+          int p = (n * tiles_h + ty) * tiles_w + tx;
+
+          // the tile starts one pixel above and to the left
+          // of its output tile due to the padding
+          int h0 = ty * M - 1;
+          int w0 = tx * M - 1;
+          for (int i = 0; i < A; i++) {
+            int h = h0 + i;
+            for (int j = 0; j < A; j++) {
+              int w = w0 + j;
+              bool inside = h >= 0 && h < height && w >= 0 && w < width;
+              d[i * A + j] = inside ? src[h * width + w] : Dtype(0);
+            }
+          }
+
+          for (int j = 0; j < A; j++) {
+            Transform::input(d + j, A, t + j, A);
+          }
+          for (int i = 0; i < A; i++) {
+            Transform::input(t + i * A, 1, r + i * A, 1);
+          }
+
+          for (int e = 0; e < kNumElements; e++) {
+            v[(e * num_input + c) * num_tiles + p] = r[e];
+          }
+        }
+    }
+
+  // m[e] = u[e] * v[e] for every element of a tile
+  for (int e = 0; e < kNumElements; e++) {
+    gemm<Dtype>(false, false, num_output, num_tiles, num_input, 1,
+                &u(e, 0, 0, 0), num_input, v + e * num_input * num_tiles,
+                num_tiles, 0, m + e * num_output * num_tiles, num_tiles);
+  }
+
+  // output transform: y = A^T m A
+  for (int n = 0; n < in.n_; n++)
+    for (int k = 0; k < num_output; k++) {
+      Dtype* dst = &(*out)(n, k, 0, 0);
+      Dtype b = bias ? bias[k] : Dtype(0);
+      for (int ty = 0; ty < tiles_h; ty++)
+        for (int tx = 0; tx < tiles_w; tx++) {
+          int p = (n * tiles_h + ty) * tiles_w + tx;
+          for (int e = 0; e < kNumElements; e++) {
+            d[e] = m[(e * num_output + k) * num_tiles + p];
+          }
+
+          for (int j = 0; j < A; j++) {
+            Transform::output(d + j, A, t + j, A);
+          }
+          for (int i = 0; i < M; i++) {
+            Transform::output(t + i * A, 1, r + i * M, 1);
+          }
+
+          // the last tiles may be partially outside the image
+          int rows = std::min(M, height - ty * M);
+          int cols = std::min(M, width - tx * M);
+          for (int i = 0; i < rows; i++) {
+            Dtype* y = dst + (ty * M + i) * width + tx * M;
+            for (int j = 0; j < cols; j++) {
+              if (accumulate) {
+                y[j] += r[i * M + j] + b;
+              } else  // NOLINT
+              {
+                y[j] = r[i * M + j] + b;
+              }
+            }
+          }
+        }
+    }
+}
+
+}  // namespace cnn
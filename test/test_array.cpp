@@ -15,6 +15,8 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <cstdint>
+
 #include "cnn/array.hpp"
 
 namespace cnn {
@@ -59,8 +61,10 @@ TYPED_TEST(ArrayTest, init) {
   EXPECT_EQ(isAllZeros(arr), true);
 
   TypeParam* d = arr.d_;
+  int capacity = arr.capacity_;
   arr.init(1, 1, 2, 1);
   EXPECT_EQ(arr.d_, d);  // no memory is re-allocated
+  EXPECT_EQ(arr.capacity_, capacity);
   EXPECT_EQ(arr.n_, 1);
   EXPECT_EQ(arr.c_, 1);
   EXPECT_EQ(arr.h_, 2);
@@ -68,8 +72,10 @@ TYPED_TEST(ArrayTest, init) {
   EXPECT_EQ(arr.total_, 2);
   EXPECT_EQ(isAllZeros(arr), true);
 
+  // memory is re-allocated; the old block is freed first, so that
+  // the new one may well start at the same address
   arr.init(2, 3, 4, 5);
-  EXPECT_NE(arr.d_, d);  // memory is re-allocated
+  EXPECT_GE(arr.capacity_, 120);
   EXPECT_EQ(arr.n_, 2);
   EXPECT_EQ(arr.c_, 3);
   EXPECT_EQ(arr.h_, 4);
@@ -246,4 +252,121 @@ TYPED_TEST(ArrayTest, move_assignment) {
   }
 }
 
+TYPED_TEST(ArrayTest, alignment_and_padding) {
+  Array<TypeParam> arr;
+  for (int w : {1, 3, 16, 17, 100}) {
+    arr.init(1, 1, 1, w);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(arr.d_) % kArrayAlignment, 0);
+    EXPECT_EQ(arr.padded_total() % Array<TypeParam>::kPadding, 0);
+    EXPECT_GE(arr.padded_total(), arr.total_);
+    EXPECT_LT(arr.padded_total() - arr.total_, Array<TypeParam>::kPadding);
+    EXPECT_GE(arr.capacity_, arr.padded_total());
+    for (int i = arr.total_; i < arr.padded_total(); i++) {
+      EXPECT_EQ(arr.d_[i], 0);
+    }
+  }
+}
+
+TYPED_TEST(ArrayTest, init_without_zero_fill) {
+  Array<TypeParam> arr;
+  arr.init(1, 1, 2, 3);
+  for (int i = 0; i < arr.total_; i++) {
+    arr[i] = i + 1;
+  }
+
+  // the memory is reused and the values are kept
+  TypeParam* d = arr.d_;
+  arr.init(1, 1, 3, 2, false);
+  EXPECT_EQ(arr.d_, d);
+  for (int i = 0; i < arr.total_; i++) {
+    EXPECT_EQ(arr[i], i + 1);
+  }
+
+  // a smaller array reuses the memory too
+  arr.init(1, 1, 1, 1);
+  EXPECT_EQ(arr.d_, d);
+  EXPECT_EQ(arr[0], 0);
+}
+
+namespace {
+
+class CountingAllocator : public Allocator {
+ public:
+  void* allocate(size_t bytes) override {
+    num_allocations_++;
+    bytes_ += bytes;
+    return AlignedAllocator().allocate(bytes);
+  }
+  void deallocate(void* p, size_t bytes) override {
+    num_allocations_--;
+    bytes_ -= bytes;
+    AlignedAllocator().deallocate(p, bytes);
+  }
+
+  int num_allocations_ = 0;
+  size_t bytes_ = 0;
+};
+
+}  // namespace
+
+TYPED_TEST(ArrayTest, allocator) {
+  CountingAllocator allocator;
+  {
+    Array<TypeParam> a;
+    a.set_allocator(&allocator);
+    a.init(2, 3, 4, 5);
+    EXPECT_EQ(allocator.num_allocations_, 1);
+    EXPECT_EQ(allocator.bytes_, a.capacity_ * sizeof(TypeParam));
+
+    // the default allocator is used only for arrays without one
+    Allocator* old = set_default_allocator(&allocator);
+    Array<TypeParam> b;
+    b.init(1, 1, 1, 1);
+    set_default_allocator(old);
+    EXPECT_EQ(allocator.num_allocations_, 2);
+
+    // the memory moves with its allocator
+    Array<TypeParam> c = std::move(a);
+    EXPECT_EQ(allocator.num_allocations_, 2);
+
+    c.release();
+    EXPECT_EQ(c.d_, nullptr);
+    EXPECT_EQ(c.total_, 0);
+    EXPECT_EQ(allocator.num_allocations_, 1);
+  }
+  EXPECT_EQ(allocator.num_allocations_, 0);
+  EXPECT_EQ(allocator.bytes_, 0);
+}
+
+TYPED_TEST(ArrayTest, huge_page_allocator) {
+  for (bool use_hugetlb : {false, true}) {
+    HugePageAllocator allocator(1 << 20, use_hugetlb);
+
+    Array<TypeParam> small;
+    small.set_allocator(&allocator);
+    small.init(1, 1, 10, 10);
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(small.d_) % kArrayAlignment, 0);
+
+    // 3 MiB, rounded up to two huge pages
+    Array<TypeParam> large;
+    large.set_allocator(&allocator);
+    large.init(1, 3, 1 << 10, (1 << 10) / sizeof(TypeParam));
+#ifdef __linux__
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(large.d_) %
+                  HugePageAllocator::kHugePageSize,
+              0);
+#endif
+    int num_nonzeros = 0;
+    for (int i = 0; i < large.padded_total(); i++) {
+      num_nonzeros += large[i] != 0;
+    }
+    EXPECT_EQ(num_nonzeros, 0);
+    large[large.total_ - 1] = 1;
+    EXPECT_EQ(large[large.total_ - 1], 1);
+
+    large.release();
+    small.release();
+  }
+}
+
 }  // namespace cnn
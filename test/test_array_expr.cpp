@@ -0,0 +1,122 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include <glog/logging.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+
+#include "cnn/array_expr.hpp"
+#include "cnn/jet.hpp"
+#include "cnn/rng.hpp"
+
+namespace cnn {
+
+template <typename Dtype>
+class ArrayExprTest : public ::testing::Test {};
+
+using MyTypes = ::testing::Types<float, double>;
+TYPED_TEST_CASE(ArrayExprTest, MyTypes);
+
+TYPED_TEST(ArrayExprTest, assign) {
+  // the sizes cover full blocks and a partial block
+  for (int n : {1, 16, 37}) {
+    Array<TypeParam> x;
+    Array<TypeParam> y;
+    Array<TypeParam> t;
+    x.init(1, 1, 1, n);
+    y.init(1, 1, 1, n);
+    t.init(1, 1, 1, n);
+    uniform<TypeParam>(&x, -10, 10);
+    uniform<TypeParam>(&y, -10, 10);
+
+    assign(&t, (array_expr(x) - 2) * 3 + array_expr(y) / 2);
+    for (int i = 0; i < n; i++) {
+      EXPECT_EQ(t[i], (x[i] - 2) * 3 + y[i] / 2);
+    }
+
+    assign(&t, 1 - array_expr(x) * array_expr(y));
+    for (int i = 0; i < n; i++) {
+      EXPECT_EQ(t[i], 1 - x[i] * y[i]);
+    }
+
+    assign(&t, maximum(array_expr(x), array_expr(y) + 1));
+    for (int i = 0; i < n; i++) {
+      EXPECT_EQ(t[i], std::max(x[i], y[i] + 1));
+    }
+
+    // in place
+    for (int i = 0; i < n; i++) {
+      t[i] = x[i] * 2 - y[i];
+    }
+    assign(n, x.d_, array_expr(n, x.d_) * 2 - array_expr(y));
+    for (int i = 0; i < n; i++) {
+      EXPECT_EQ(x[i], t[i]);
+    }
+  }
+}
+
+TYPED_TEST(ArrayExprTest, fused_assign) {
+  for (int n : {1, 16, 37}) {
+    Array<TypeParam> a;
+    Array<TypeParam> b;
+    Array<TypeParam> expected_a;
+    Array<TypeParam> expected_b;
+    a.init(1, 1, 1, n);
+    b.init(1, 1, 1, n);
+    expected_a.init(1, 1, 1, n);
+    expected_b.init(1, 1, 1, n);
+    uniform<TypeParam>(&a, -10, 10);
+    uniform<TypeParam>(&b, -10, 10);
+
+    for (int i = 0; i < n; i++) {
+      expected_a[i] = a[i] + 2 * b[i];
+      expected_b[i] = b[i] - expected_a[i];  // sees the new a
+    }
+
+    fused_assign(n, a.d_, array_expr(a) + 2 * array_expr(b), b.d_,
+                 array_expr(b) - array_expr(a));
+    for (int i = 0; i < n; i++) {
+      EXPECT_EQ(a[i], expected_a[i]);
+      EXPECT_EQ(b[i], expected_b[i]);
+    }
+  }
+}
+
+TYPED_TEST(ArrayExprTest, jet) {
+  using Type = Jet<TypeParam, 2>;
+  Array<Type> x;
+  Array<Type> t;
+  x.init(1, 1, 1, 20);
+  t.init(1, 1, 1, 20);
+  for (int i = 0; i < x.total_; i++) {
+    x[i] = Type(i, i % 2);
+  }
+
+  assign(&t, array_expr(x) * Type(3) + Type(1));
+  for (int i = 0; i < x.total_; i++) {
+    EXPECT_EQ(t[i].a_, 3 * i + 1);
+    EXPECT_EQ(t[i].v_[i % 2], 3);
+  }
+}
+
+TEST(ArrayExprDeathTest, size_mismatch) {
+  Array<float> x;
+  Array<float> y;
+  x.init(1, 1, 1, 2);
+  y.init(1, 1, 1, 3);
+  EXPECT_DEATH(array_expr(x) + array_expr(y), "");
+}
+
+}  // namespace cnn
@@ -15,13 +15,37 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
+#include <initializer_list>
+#include <limits>
+#include <vector>
+
 #include "cnn/array_math.hpp"
+#include "cnn/rng.hpp"
 
 namespace cnn {
 
 template <typename Dtype>
 class ArrayMathTest : public ::testing::Test {};
 
+// the distance of y from the exact value in units in the last
+// place of T; the exact value is computed in long double
+template <typename T>
+double ulp_error(T y, long double exact) {
+  if (exact == 0) {
+    return (y == 0) ? 0 : std::numeric_limits<double>::infinity();
+  }
+  int e = std::ilogb(static_cast<T>(exact));
+  long double ulp = std::ldexp(1.0L, e - std::numeric_limits<T>::digits + 1);
+  return static_cast<double>(std::fabs(y - exact) / ulp);
+}
+
+// the error bounds of exp_arr() and log_arr() in array_math.hpp
+inline double max_exp_ulp(float) { return 1.1; }
+inline double max_exp_ulp(double) { return 2; }
+constexpr double kMaxLogUlp = 1;
+
 using MyTypes = ::testing::Types<float, double>;
 TYPED_TEST_CASE(ArrayMathTest, MyTypes);
 
@@ -169,4 +193,293 @@ TYPED_TEST(ArrayMathTest, sub_scalar2) {
   EXPECT_EQ(d[1], 2);
 }
 
+TYPED_TEST(ArrayMathTest, gemm) {
+  // the sizes are chosen to cover partial register tiles
+  // and more than one cache block along every dimension
+  const int sizes[][3] = {{1, 1, 1}, {5, 7, 3}, {70, 300, 270}, {130, 2100, 9}};
+  for (const auto& size : sizes) {
+    int m = size[0];
+    int n = size[1];
+    int k = size[2];
+    for (int trans_a = 0; trans_a < 2; trans_a++)
+      for (int trans_b = 0; trans_b < 2; trans_b++) {
+        Array<TypeParam> a;
+        Array<TypeParam> b;
+        Array<TypeParam> c;
+        Array<TypeParam> product;  // op(a) * op(b)
+        Array<TypeParam> expected;
+        a.init(1, 1, m, k);
+        b.init(1, 1, k, n);
+        c.init(1, 1, m, n);
+        product.init(1, 1, m, n);
+        expected.init(1, 1, m, n);
+
+        uniform<TypeParam>(&a, -3, 3);
+        uniform<TypeParam>(&b, -3, 3);
+        uniform<TypeParam>(&c, -3, 3);
+
+        int lda = trans_a ? m : k;
+        int ldb = trans_b ? k : n;
+        for (int i = 0; i < m; i++)
+          for (int j = 0; j < n; j++) {
+            TypeParam s = 0;
+            for (int p = 0; p < k; p++) {
+              TypeParam x = trans_a ? a[p * lda + i] : a[i * lda + p];
+              TypeParam y = trans_b ? b[j * ldb + p] : b[p * ldb + j];
+              s += x * y;
+            }
+            product[i * n + j] = s;
+            expected[i * n + j] = 2 * s + 3 * c[i * n + j];
+          }
+
+        gemm<TypeParam>(trans_a, trans_b, m, n, k, 2, a.d_, lda, b.d_, ldb, 3,
+                        c.d_, n);
+        for (int i = 0; i < m * n; i++) {
+          EXPECT_EQ(c[i], expected[i]);
+        }
+
+        // with beta == 0, c is overwritten
+        set_to<TypeParam>(&c, 100);
+        gemm<TypeParam>(trans_a, trans_b, m, n, k, 1, a.d_, lda, b.d_, ldb, 0,
+                        c.d_, n);
+        for (int i = 0; i < m * n; i++) {
+          EXPECT_EQ(c[i], product[i]);
+        }
+
+        // op(a) packed once, with the default and a narrower block
+        for (int kc : {internal::GemmBlocking::kKC, 9}) {
+          std::vector<TypeParam> packed(gemm_packed_size(m, k), 100);
+          gemm_pack<TypeParam>(trans_a, m, k, a.d_, lda, kc, &packed[0]);
+          set_to<TypeParam>(&c, 100);
+          gemm_packed<TypeParam>(trans_b, m, n, k, 1, &packed[0], kc, b.d_,
+                                 ldb, 0, c.d_, n);
+          for (int i = 0; i < m * n; i++) {
+            EXPECT_EQ(c[i], product[i]);
+          }
+        }
+      }
+  }
+}
+
+TYPED_TEST(ArrayMathTest, gemv) {
+  const int sizes[][2] = {{1, 1}, {5, 7}, {70, 300}};
+  for (const auto& size : sizes) {
+    int m = size[0];
+    int n = size[1];
+    for (int trans_a = 0; trans_a < 2; trans_a++) {
+      int nx = trans_a ? m : n;
+      int ny = trans_a ? n : m;
+
+      Array<TypeParam> a;
+      Array<TypeParam> x;
+      Array<TypeParam> y;
+      Array<TypeParam> product;  // op(a) * x
+      Array<TypeParam> expected;
+      a.init(1, 1, m, n);
+      x.init(1, 1, 1, nx);
+      y.init(1, 1, 1, ny);
+      product.init(1, 1, 1, ny);
+      expected.init(1, 1, 1, ny);
+
+      uniform<TypeParam>(&a, -3, 3);
+      uniform<TypeParam>(&x, -3, 3);
+      uniform<TypeParam>(&y, -3, 3);
+
+      for (int i = 0; i < ny; i++) {
+        TypeParam s = 0;
+        for (int j = 0; j < nx; j++) {
+          s += (trans_a ? a[j * n + i] : a[i * n + j]) * x[j];
+        }
+        product[i] = s;
+        expected[i] = 2 * s + 3 * y[i];
+      }
+
+      gemv<TypeParam>(trans_a, m, n, 2, a.d_, n, x.d_, 3, y.d_);
+      for (int i = 0; i < ny; i++) {
+        EXPECT_NEAR(y[i], expected[i], 1e-3);
+      }
+
+      // with beta == 0, y is overwritten
+      set_to<TypeParam>(&y, 100);
+      gemv<TypeParam>(trans_a, m, n, 1, a.d_, n, x.d_, 0, y.d_);
+      for (int i = 0; i < ny; i++) {
+        EXPECT_NEAR(y[i], product[i], 1e-3);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ArrayMathTest, simd_kernels) {
+  using T = TypeParam;
+  std::false_type generic;
+  // the sizes cover the unrolled loop, the single register
+  // loop and the scalar tail
+  for (SimdIsa isa : {SimdIsa::kGeneric, SimdIsa::kSse2, SimdIsa::kAvx2,
+                      SimdIsa::kAvx512}) {
+    const SimdKernels<T>* kernels = simd_kernels<T>(isa);
+    if (!kernels) {
+      continue;
+    }
+    for (int n : {0, 1, 7, 33, 100, 1001}) {
+      Array<T> x;
+      Array<T> y;
+      Array<T> dst;
+      Array<T> expected;
+      x.init(1, 1, 1, n + 1);
+      y.init(1, 1, 1, n + 1);
+      dst.init(1, 1, 1, n + 1);
+      expected.init(1, 1, 1, n + 1);
+      uniform<T>(&x, -3, 3);
+      uniform<T>(&y, -3, 3);
+
+      // start at an odd offset so that the loads are unaligned
+      const T* px = x.d_ + 1;
+      const T* py = y.d_ + 1;
+      T* pd = dst.d_ + 1;
+      T* pe = expected.d_ + 1;
+
+      T tol = 1e-3 * (n + 1);
+      EXPECT_NEAR(kernels->ax_sub_by_squared(n, 2, px, 3, py),
+                  internal::ax_sub_by_squared(generic, n, T(2), px, T(3), py),
+                  tol);
+      EXPECT_NEAR(kernels->dot(n, px, py),
+                  internal::ax_dot_by(internal::GenericBackend(), n, T(1), px,
+                                      T(1), py),
+                  tol);
+      EXPECT_NEAR(kernels->sum_arr(n, px), internal::sum_arr(generic, n, px),
+                  tol);
+      EXPECT_NEAR(kernels->sum_squared_arr(n, px),
+                  internal::sum_squared_arr(generic, n, px), tol);
+
+      std::copy(py, py + n, pd);
+      std::copy(py, py + n, pe);
+      kernels->ax_plus_by(n, 2, px, 3, pd);
+      internal::ax_plus_by(internal::GenericBackend(), n, T(2), px, T(3), pe);
+      for (int i = 0; i < n; i++) {
+        EXPECT_NEAR(pd[i], pe[i], 1e-4);
+      }
+
+      kernels->set_to(n, 5, pd);
+      for (int i = 0; i < n; i++) {
+        EXPECT_EQ(pd[i], 5);
+      }
+
+      kernels->scale_arr(n, 3, px, pd);
+      internal::scale_arr(generic, n, T(3), px, pe);
+      for (int i = 0; i < n; i++) {
+        EXPECT_EQ(pd[i], pe[i]);
+      }
+
+      kernels->sub_scalar(n, 3, px, pd);
+      internal::sub_scalar(generic, n, T(3), px, pe);
+      for (int i = 0; i < n; i++) {
+        EXPECT_EQ(pd[i], pe[i]);
+      }
+
+      EXPECT_EQ(kernels->max_arr(n, px), internal::max_arr(generic, n, px));
+
+      // exp() and log() are approximated within the documented ulp
+      kernels->exp_arr(n, px, pd);
+      for (int i = 0; i < n; i++) {
+        EXPECT_LE(ulp_error(pd[i], std::exp(static_cast<long double>(px[i]))),
+                  max_exp_ulp(T()))
+            << px[i];
+      }
+
+      T eps = 4 * std::numeric_limits<T>::epsilon();
+      T sum = kernels->sub_exp_sum(n, 1, px, pd);
+      T expected_sum = internal::sub_exp_sum(generic, n, T(1), px, pe);
+      EXPECT_NEAR(sum, expected_sum, eps * expected_sum * (n + 1));
+      for (int i = 0; i < n; i++) {
+        long double exact = std::exp(static_cast<long double>(px[i]) - 1);
+        EXPECT_LE(ulp_error(pd[i], exact), max_exp_ulp(T())) << px[i];
+      }
+      EXPECT_EQ(kernels->sub_exp_sum(n, 1, px, nullptr), sum);
+
+      for (int i = 0; i < n; i++) {
+        pe[i] = std::exp(px[i]);
+      }
+      kernels->log_arr(n, pe, pd);
+      for (int i = 0; i < n; i++) {
+        EXPECT_LE(ulp_error(pd[i], std::log(static_cast<long double>(pe[i]))),
+                  kMaxLogUlp)
+            << pe[i];
+      }
+    }
+  }
+
+  // the generic kernels are always available
+  EXPECT_NE(simd_kernels<T>(SimdIsa::kGeneric), nullptr);
+  EXPECT_NE(simd_kernels<T>(simd_isa()), nullptr);
+}
+
+TYPED_TEST(ArrayMathTest, exp_log) {
+  using T = TypeParam;
+  T eps = 4 * std::numeric_limits<T>::epsilon();
+
+  // the range where exp() is normal and does not saturate
+  T lo = std::log(std::numeric_limits<T>::min()) + 1;
+  T hi = std::log(std::numeric_limits<T>::max()) - 1;
+  int n = 100001;
+  std::vector<T> x(n);
+  std::vector<T> y(n);
+  for (int i = 0; i < n; i++) {
+    x[i] = lo + (hi - lo) * i / (n - 1);
+  }
+  x[n / 2] = 0;
+
+  // every instruction set is within the documented bounds
+  std::vector<T> z(n);
+  for (SimdIsa isa : {SimdIsa::kGeneric, SimdIsa::kSse2, SimdIsa::kAvx2,
+                      SimdIsa::kAvx512}) {
+    const SimdKernels<T>* kernels = simd_kernels<T>(isa);
+    if (!kernels) {
+      continue;
+    }
+
+    kernels->exp_arr(n, x.data(), y.data());
+    for (int i = 0; i < n; i++) {
+      EXPECT_LE(ulp_error(y[i], std::exp(static_cast<long double>(x[i]))),
+                max_exp_ulp(T()))
+          << x[i];
+    }
+    EXPECT_EQ(y[n / 2], 1);
+
+    kernels->log_arr(n, y.data(), z.data());
+    for (int i = 0; i < n; i++) {
+      EXPECT_LE(ulp_error(z[i], std::log(static_cast<long double>(y[i]))),
+                kMaxLogUlp)
+          << y[i];
+    }
+    EXPECT_EQ(z[n / 2], 0);
+  }
+
+  // log() of exp() gives back x
+  exp_arr(n, x.data(), y.data());
+  log_arr(n, y.data(), y.data());
+  for (int i = 0; i < n; i++) {
+    EXPECT_NEAR(y[i], std::log(std::exp(x[i])),
+                eps * std::max(std::abs(x[i]), T(1)))
+        << x[i];
+  }
+  EXPECT_EQ(y[n / 2], 0);
+
+  // outside of it, the results are 0 or finite
+  T out[] = {-1000, 1000};
+  exp_arr(2, out, out);
+  EXPECT_EQ(out[0], 0);
+  EXPECT_GT(out[1], std::exp(hi));
+  EXPECT_LE(out[1], std::numeric_limits<T>::max());
+
+  // log_sum_exp() does not overflow for large inputs
+  T big[] = {1000, 1000, 999};
+  T expected = 1000 + std::log(2 + std::exp(T(-1)));
+  EXPECT_NEAR(log_sum_exp(3, big), expected, eps * expected);
+
+  T small[] = {-3, 2, 0.5};
+  expected = std::log(std::exp(T(-3)) + std::exp(T(2)) + std::exp(T(0.5)));
+  EXPECT_NEAR(log_sum_exp(3, small), expected, eps * 4);
+  EXPECT_EQ(max_arr(3, small), 2);
+}
+
 }  // namespace cnn
@@ -15,6 +15,12 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
 #include "cnn/layer.hpp"
 
 namespace cnn {
@@ -397,6 +403,620 @@ TYPED_TEST(ConvolutionLayerTest, fprop5) {
   }
 }
 
+TYPED_TEST(ConvolutionLayerTest, im2col_gemm_same_as_direct) {
+  static constexpr int N = 3;
+  static constexpr int C = 4;
+  static constexpr int H = 7;
+  static constexpr int W = 6;
+
+  for (int kernel_size : {1, 3, 5, 9}) {
+    LayerProto proto;
+    proto.set_phase(TEST);
+    proto.set_type(CONVOLUTION);
+    proto.mutable_conv_proto()->set_num_output(5);
+    proto.mutable_conv_proto()->set_kernel_size(kernel_size);
+
+    proto.mutable_conv_proto()->set_algorithm(ConvolutionLayerProto::DIRECT);
+    auto direct = Layer<TypeParam>::create(proto);
+
+    proto.mutable_conv_proto()->set_algorithm(
+        ConvolutionLayerProto::IM2COL_GEMM);
+    auto gemm = Layer<TypeParam>::create(proto);
+
+    for (int n : {1, N}) {
+      Array<TypeParam> bottom;
+      Array<TypeParam> top_direct;
+      Array<TypeParam> top_gemm;
+      bottom.init(n, C, H, W);
+      uniform<TypeParam>(&bottom, -10, 10);
+
+      direct->reshape({&bottom}, {}, {&top_direct}, {});
+      gemm->reshape({&bottom}, {}, {&top_gemm}, {});
+
+      for (int i = 0; i < 2; i++) {
+        auto& p = *gemm->mutable_param()[i];
+        auto& q = *direct->mutable_param()[i];
+        uniform<TypeParam>(&p, -5, 5);
+        for (int j = 0; j < p.total_; j++) {
+          q[j] = p[j];
+        }
+      }
+
+      direct->fprop({&bottom}, {&top_direct});
+      gemm->fprop({&bottom}, {&top_gemm});
+
+      ASSERT_TRUE(top_gemm.has_same_shape(top_direct));
+      for (int i = 0; i < top_direct.total_; i++) {
+        EXPECT_EQ(top_direct[i], top_gemm[i]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, im2col_gemm_bprop_same_as_direct) {
+  static constexpr int N = 3;
+  static constexpr int C = 4;
+  static constexpr int H = 7;
+  static constexpr int W = 6;
+
+  for (int kernel_size : {1, 3, 5, 9}) {
+    LayerProto proto;
+    proto.set_phase(TRAIN);
+    proto.set_type(CONVOLUTION);
+    proto.mutable_conv_proto()->set_num_output(5);
+    proto.mutable_conv_proto()->set_kernel_size(kernel_size);
+
+    proto.mutable_conv_proto()->set_algorithm(ConvolutionLayerProto::DIRECT);
+    auto direct = Layer<TypeParam>::create(proto);
+
+    proto.mutable_conv_proto()->set_algorithm(
+        ConvolutionLayerProto::IM2COL_GEMM);
+    auto gemm = Layer<TypeParam>::create(proto);
+
+    for (int n : {1, N}) {
+      Array<TypeParam> bottom;
+      Array<TypeParam> bottom_gradient[2];
+      Array<TypeParam> top[2];
+      Array<TypeParam> top_gradient[2];
+      bottom.init(n, C, H, W);
+      uniform<TypeParam>(&bottom, -10, 10);
+
+      direct->reshape({&bottom}, {&bottom_gradient[0]}, {&top[0]},
+                      {&top_gradient[0]});
+      gemm->reshape({&bottom}, {&bottom_gradient[1]}, {&top[1]},
+                    {&top_gradient[1]});
+
+      for (int i = 0; i < 2; i++) {
+        auto& p = *gemm->mutable_param()[i];
+        auto& q = *direct->mutable_param()[i];
+        uniform<TypeParam>(&p, -5, 5);
+        for (int j = 0; j < p.total_; j++) {
+          q[j] = p[j];
+        }
+      }
+
+      uniform<TypeParam>(&top_gradient[0], -5, 5);
+      for (int i = 0; i < top_gradient[0].total_; i++) {
+        top_gradient[1][i] = top_gradient[0][i];
+      }
+
+      // the gradients are accumulated
+      set_to<TypeParam>(&bottom_gradient[0], 1);
+      set_to<TypeParam>(&bottom_gradient[1], 1);
+      direct->clear_gradient();
+      gemm->clear_gradient();
+
+      direct->fprop({&bottom}, {&top[0]});
+      direct->bprop({&bottom}, {&bottom_gradient[0]}, {&top[0]},
+                    {&top_gradient[0]});
+
+      gemm->fprop({&bottom}, {&top[1]});
+      gemm->bprop({&bottom}, {&bottom_gradient[1]}, {&top[1]},
+                  {&top_gradient[1]});
+
+      for (int i = 0; i < bottom_gradient[0].total_; i++) {
+        EXPECT_EQ(bottom_gradient[0][i], bottom_gradient[1][i]);
+      }
+
+      for (int i = 0; i < 2; i++) {
+        const auto& expected = *direct->gradient()[i];
+        const auto& actual = *gemm->gradient()[i];
+        for (int j = 0; j < expected.total_; j++) {
+          EXPECT_EQ(expected[j], actual[j]);
+        }
+      }
+    }
+  }
+}
+
+// Compare the given algorithm with DIRECT for fprop and bprop.
+// The tolerance is relative to the largest magnitude of the expected values.
+template <typename Dtype>
+void expect_same_as_direct(const ConvolutionLayerProto& conv_proto, int n,
+                           int c, int h, int w, double tol) {
+  LayerProto proto;
+  proto.set_phase(TRAIN);
+  proto.set_type(CONVOLUTION);
+  *proto.mutable_conv_proto() = conv_proto;
+
+  proto.mutable_conv_proto()->set_algorithm(ConvolutionLayerProto::DIRECT);
+  auto direct = Layer<Dtype>::create(proto);
+
+  proto.mutable_conv_proto()->set_algorithm(conv_proto.algorithm());
+  auto layer = Layer<Dtype>::create(proto);
+
+  Array<Dtype> bottom;
+  Array<Dtype> bottom_gradient[2];
+  Array<Dtype> top[2];
+  Array<Dtype> top_gradient[2];
+  bottom.init(n, c, h, w);
+  uniform<Dtype>(&bottom, -10, 10);
+
+  direct->reshape({&bottom}, {&bottom_gradient[0]}, {&top[0]},
+                  {&top_gradient[0]});
+  layer->reshape({&bottom}, {&bottom_gradient[1]}, {&top[1]},
+                 {&top_gradient[1]});
+
+  uniform<Dtype>(&top_gradient[0], -5, 5);
+  for (int i = 0; i < top_gradient[0].total_; i++) {
+    top_gradient[1][i] = top_gradient[0][i];
+  }
+
+  auto expect_near = [tol](const Array<Dtype>& expected,
+                           const Array<Dtype>& actual) {
+    double scale = 1;
+    for (int i = 0; i < expected.total_; i++) {
+      scale = std::max<double>(scale, std::abs(expected[i]));
+    }
+    for (int i = 0; i < expected.total_; i++) {
+      EXPECT_NEAR(expected[i], actual[i], tol * scale);
+    }
+  };
+
+  // run twice; the second run changes the parameters
+  // to check that the cached kernels are updated
+  for (int iter = 0; iter < 2; iter++) {
+    if (iter == 0) {
+      for (int i = 0; i < 2; i++) {
+        auto& p = *layer->mutable_param()[i];
+        auto& q = *direct->mutable_param()[i];
+        uniform<Dtype>(&p, -5, 5);
+        for (int j = 0; j < p.total_; j++) {
+          q[j] = p[j];
+        }
+      }
+    } else  // NOLINT
+    {
+      direct->update_parameters(0, 0.5);
+      layer->update_parameters(0, 0.5);
+    }
+
+    set_to<Dtype>(&bottom_gradient[0], 0);
+    set_to<Dtype>(&bottom_gradient[1], 0);
+    direct->clear_gradient();
+    layer->clear_gradient();
+
+    direct->fprop({&bottom}, {&top[0]});
+    direct->bprop({&bottom}, {&bottom_gradient[0]}, {&top[0]},
+                  {&top_gradient[0]});
+
+    layer->fprop({&bottom}, {&top[1]});
+    layer->bprop({&bottom}, {&bottom_gradient[1]}, {&top[1]},
+                 {&top_gradient[1]});
+
+    expect_near(top[0], top[1]);
+    expect_near(bottom_gradient[0], bottom_gradient[1]);
+    for (int i = 0; i < 2; i++) {
+      expect_near(*direct->gradient()[i], *layer->gradient()[i]);
+    }
+  }
+}
+
+template <typename Dtype>
+void expect_same_as_direct(ConvolutionLayerProto::Algorithm algorithm,
+                           int kernel_size, int n, int c, int h, int w,
+                           int num_output, double tol) {
+  ConvolutionLayerProto conv_proto;
+  conv_proto.set_num_output(num_output);
+  conv_proto.set_kernel_size(kernel_size);
+  conv_proto.set_algorithm(algorithm);
+  expect_same_as_direct<Dtype>(conv_proto, n, c, h, w, tol);
+}
+
+TYPED_TEST(ConvolutionLayerTest, im2col_gemm_weight_gradient_blocks) {
+  // the weight gradient has only 9 columns, so the samples are split
+  // into blocks whose gradients are added
+  static constexpr int N = 8;
+  static constexpr int C = 1;
+  static constexpr int H = 12;
+  static constexpr int W = 12;
+
+  LayerProto proto;
+  proto.set_phase(TRAIN);
+  proto.set_type(CONVOLUTION);
+  proto.mutable_conv_proto()->set_num_output(4);
+  proto.mutable_conv_proto()->set_kernel_size(3);
+
+  proto.mutable_conv_proto()->set_algorithm(ConvolutionLayerProto::DIRECT);
+  auto direct = Layer<TypeParam>::create(proto);
+
+  proto.mutable_conv_proto()->set_algorithm(
+      ConvolutionLayerProto::IM2COL_GEMM);
+  auto gemm = Layer<TypeParam>::create(proto);
+
+  Array<TypeParam> bottom;
+  Array<TypeParam> bottom_gradient;
+  Array<TypeParam> top;
+  Array<TypeParam> top_gradient;
+  bottom.init(N, C, H, W);
+  uniform<TypeParam>(&bottom, -10, 10);
+
+  direct->reshape({&bottom}, {&bottom_gradient}, {&top}, {&top_gradient});
+  gemm->reshape({&bottom}, {&bottom_gradient}, {&top}, {&top_gradient});
+  for (int i = 0; i < 2; i++) {
+    auto& p = *gemm->mutable_param()[i];
+    auto& q = *direct->mutable_param()[i];
+    uniform<TypeParam>(&p, -5, 5);
+    for (int j = 0; j < p.total_; j++) {
+      q[j] = p[j];
+    }
+  }
+  uniform<TypeParam>(&top_gradient, -5, 5);
+
+  direct->clear_gradient();
+  direct->bprop({&bottom}, {&bottom_gradient}, {&top}, {&top_gradient});
+
+  // the result does not depend on the number of threads
+  ThreadPool pool(3);
+  for (ThreadPool* p : {static_cast<ThreadPool*>(nullptr), &pool}) {
+    gemm->set_thread_pool(p);
+    for (int i = 0; i < 2; i++) {
+      set_to<TypeParam>(gemm->mutable_gradient()[i], 1);
+    }
+    gemm->bprop({&bottom}, {&bottom_gradient}, {&top}, {&top_gradient});
+
+    for (int i = 0; i < 2; i++) {
+      const auto& expected = *direct->gradient()[i];
+      const auto& actual = *gemm->gradient()[i];
+      for (int j = 0; j < expected.total_; j++) {
+        EXPECT_EQ(expected[j] + 1, actual[j]);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, winograd_same_as_direct) {
+  // Winograd has larger rounding errors
+  double tol = std::is_same<TypeParam, float>::value ? 1e-5 : 1e-12;
+
+  for (auto algorithm : {ConvolutionLayerProto::WINOGRAD_2X2,
+                         ConvolutionLayerProto::WINOGRAD_4X4}) {
+    // kernel size 5 falls back to im2col + gemm
+    for (int kernel_size : {3, 5}) {
+      for (int n : {1, 3}) {
+        expect_same_as_direct<TypeParam>(algorithm, kernel_size, n, 4, 7, 6,
+                                         3, tol);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, fft_same_as_direct) {
+  double tol = std::is_same<TypeParam, float>::value ? 1e-5 : 1e-12;
+
+  // FFT is expected to be faster for this shape
+  EXPECT_TRUE(FFTConvolution<TypeParam>::is_faster_than_gemm(8, 12, 11, 8, 9));
+  for (int n : {1, 2}) {
+    expect_same_as_direct<TypeParam>(ConvolutionLayerProto::FFT, 9, n, 8, 12,
+                                     11, 8, tol);
+  }
+
+  // but not for this one, so it falls back to im2col + gemm
+  EXPECT_FALSE(FFTConvolution<TypeParam>::is_faster_than_gemm(1, 5, 6, 2, 7));
+  expect_same_as_direct<TypeParam>(ConvolutionLayerProto::FFT, 7, 2, 1, 5, 6,
+                                   2, tol);
+}
+
+TYPED_TEST(ConvolutionLayerTest, stride_pad_dilation) {
+  struct Geometry {
+    int kernel_size;
+    int stride;
+    int pad_h;  // -1 for the default padding
+    int pad_w;
+    int dilation;
+    int out_h;  // for an input of 9 x 8 pixels
+    int out_w;
+  };
+
+  std::vector<Geometry> geometries = {
+      {3, 2, -1, -1, 1, 5, 4},  // strided
+      {3, 1, 0, 2, 1, 7, 10},   // asymmetric padding
+      {3, 1, -1, -1, 2, 9, 8},  // dilated, padding defaults to 2
+      {5, 3, 3, 2, 2, 3, 2},    // all of them
+      {1, 2, 0, 0, 1, 5, 4},    // 1x1 with stride
+  };
+
+  for (const auto& g : geometries) {
+    ConvolutionLayerProto conv_proto;
+    conv_proto.set_num_output(3);
+    conv_proto.set_kernel_size(g.kernel_size);
+    conv_proto.set_stride(g.stride);
+    if (g.pad_h >= 0) conv_proto.set_pad_h(g.pad_h);
+    if (g.pad_w >= 0) conv_proto.set_pad_w(g.pad_w);
+    conv_proto.set_dilation(g.dilation);
+
+    LayerProto proto;
+    proto.set_phase(TEST);
+    proto.set_type(CONVOLUTION);
+    *proto.mutable_conv_proto() = conv_proto;
+
+    ConvolutionLayer<TypeParam> layer(proto);
+    Array<TypeParam> bottom;
+    Array<TypeParam> top;
+    bottom.init(2, 4, 9, 8);
+    layer.reshape({&bottom}, {}, {&top}, {});
+    EXPECT_TRUE(top.has_same_shape({2, 3, g.out_h, g.out_w}));
+
+    EXPECT_TRUE(layer.supports(ConvolutionLayerProto::DIRECT));
+    EXPECT_TRUE(layer.supports(ConvolutionLayerProto::IM2COL_GEMM));
+    EXPECT_FALSE(layer.supports(ConvolutionLayerProto::WINOGRAD_4X4));
+    EXPECT_FALSE(layer.supports(ConvolutionLayerProto::FFT));
+
+    // the values are integers, so im2col + gemm is exact; Winograd
+    // and FFT fall back to im2col + gemm
+    for (auto algorithm :
+         {ConvolutionLayerProto::IM2COL_GEMM,
+          ConvolutionLayerProto::WINOGRAD_2X2, ConvolutionLayerProto::FFT}) {
+      conv_proto.set_algorithm(algorithm);
+      for (int n : {1, 2}) {
+        expect_same_as_direct<TypeParam>(conv_proto, n, 4, 9, 8, 0);
+      }
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, direct_blocks) {
+  // wide enough for several blocks of interior columns, and with
+  // output counts that are not multiples of the block size
+  for (int num_output : {1, 2, 3, 6, 7})
+    for (int kernel_size : {1, 3, 5})
+      for (int stride : {1, 2})
+        for (int dilation : {1, 2}) {
+          ConvolutionLayerProto conv_proto;
+          conv_proto.set_num_output(num_output);
+          conv_proto.set_kernel_size(kernel_size);
+          conv_proto.set_stride(stride);
+          conv_proto.set_dilation(dilation);
+          conv_proto.set_algorithm(ConvolutionLayerProto::IM2COL_GEMM);
+          expect_same_as_direct<TypeParam>(conv_proto, 2, 3, 6, 37, 0);
+        }
+
+  // channels in more than one block of the packed weight
+  for (int kernel_size : {1, 3, 5}) {
+    ConvolutionLayerProto conv_proto;
+    conv_proto.set_num_output(7);
+    conv_proto.set_kernel_size(kernel_size);
+    conv_proto.set_algorithm(ConvolutionLayerProto::IM2COL_GEMM);
+    expect_same_as_direct<TypeParam>(conv_proto, 1, 300, 5, 9, 0);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, group) {
+  static constexpr int C = 4;
+
+  {
+    // depthwise 1x1 with two outputs per channel:
+    // top(n, o) = w[o] * bottom(n, o/2) + b[o]
+    LayerProto proto;
+    proto.set_phase(TEST);
+    proto.set_type(CONVOLUTION);
+    proto.mutable_conv_proto()->set_num_output(2 * C);
+    proto.mutable_conv_proto()->set_kernel_size(1);
+    proto.mutable_conv_proto()->set_group(C);
+
+    ConvolutionLayer<TypeParam> layer(proto);
+    Array<TypeParam> bottom;
+    Array<TypeParam> top;
+    bottom.init(2, C, 3, 2);
+    uniform<TypeParam>(&bottom, -10, 10);
+    layer.reshape({&bottom}, {}, {&top}, {});
+
+    const auto& w = *layer.param()[0];
+    const auto& b = *layer.param()[1];
+    EXPECT_TRUE(w.has_same_shape({2 * C, 1, 1, 1}));
+    EXPECT_FALSE(layer.supports(ConvolutionLayerProto::WINOGRAD_2X2));
+    EXPECT_FALSE(layer.supports(ConvolutionLayerProto::FFT));
+
+    layer.fprop({&bottom}, {&top});
+    for (int n = 0; n < 2; n++)
+      for (int o = 0; o < 2 * C; o++)
+        for (int i = 0; i < 3 * 2; i++) {
+          EXPECT_EQ((&top(n, o, 0, 0))[i],
+                    w[o] * (&bottom(n, o / 2, 0, 0))[i] + b[o]);
+        }
+  }
+
+  struct Config {
+    int group;
+    int num_output;
+    int kernel_size;
+    int stride;
+    int dilation;
+  };
+
+  std::vector<Config> configs = {
+      {2, 6, 3, 1, 1},  // grouped
+      {2, 2, 5, 2, 1},  // grouped, one output per group
+      {2, 6, 1, 1, 1},  // grouped 1x1
+      {C, C, 3, 1, 1},  // depthwise
+      {C, C, 5, 2, 1},  // depthwise with stride
+      {C, 2 * C, 3, 1, 2},  // depthwise with dilation and multiplier 2
+  };
+
+  // the values are integers, so the results are exact
+  for (const auto& cfg : configs) {
+    ConvolutionLayerProto conv_proto;
+    conv_proto.set_num_output(cfg.num_output);
+    conv_proto.set_kernel_size(cfg.kernel_size);
+    conv_proto.set_stride(cfg.stride);
+    conv_proto.set_dilation(cfg.dilation);
+    conv_proto.set_group(cfg.group);
+    conv_proto.set_algorithm(ConvolutionLayerProto::IM2COL_GEMM);
+    for (int n : {1, 3}) {
+      expect_same_as_direct<TypeParam>(conv_proto, n, C, 9, 8, 0);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, set_algorithm) {
+  LayerProto proto;
+  proto.set_phase(TEST);
+  proto.set_type(CONVOLUTION);
+  proto.mutable_conv_proto()->set_num_output(3);
+  proto.mutable_conv_proto()->set_kernel_size(3);
+  proto.mutable_conv_proto()->set_algorithm(ConvolutionLayerProto::AUTO);
+
+  auto layer = Layer<TypeParam>::create(proto);
+  auto* conv = dynamic_cast<ConvolutionLayer<TypeParam>*>(layer.get());
+  ASSERT_NE(conv, nullptr);
+
+  // AUTO is resolved by the network
+  EXPECT_EQ(conv->algorithm(), ConvolutionLayerProto::IM2COL_GEMM);
+  EXPECT_FALSE(conv->supports(ConvolutionLayerProto::AUTO));
+  EXPECT_TRUE(conv->supports(ConvolutionLayerProto::WINOGRAD_4X4));
+
+  Array<TypeParam> bottom;
+  Array<TypeParam> expected;
+  Array<TypeParam> top;
+  bottom.init(2, 2, 5, 6);
+  uniform<TypeParam>(&bottom, -10, 10);
+
+  conv->set_algorithm(ConvolutionLayerProto::DIRECT);
+  conv->reshape({&bottom}, {}, {&expected}, {});
+  conv->fprop({&bottom}, {&expected});
+
+  double tol = std::is_same<TypeParam, float>::value ? 1e-2 : 1e-9;
+
+  // switching between algorithms that cache the
+  // transformed kernels does not reuse stale ones
+  for (auto algorithm : {ConvolutionLayerProto::WINOGRAD_2X2,
+                         ConvolutionLayerProto::WINOGRAD_4X4,
+                         ConvolutionLayerProto::FFT,
+                         ConvolutionLayerProto::WINOGRAD_2X2}) {
+    conv->set_algorithm(algorithm);
+    EXPECT_EQ(conv->algorithm(), algorithm);
+    conv->reshape({&bottom}, {}, {&top}, {});
+    conv->fprop({&bottom}, {&top});
+    for (int i = 0; i < top.total_; i++) {
+      EXPECT_NEAR(top[i], expected[i], tol);
+    }
+  }
+
+  // unsupported algorithms fall back to IM2COL_GEMM
+  proto.mutable_conv_proto()->set_kernel_size(5);
+  auto layer5 = Layer<TypeParam>::create(proto);
+  auto* conv5 = dynamic_cast<ConvolutionLayer<TypeParam>*>(layer5.get());
+  EXPECT_FALSE(conv5->supports(ConvolutionLayerProto::WINOGRAD_2X2));
+  conv5->set_algorithm(ConvolutionLayerProto::WINOGRAD_2X2);
+  EXPECT_EQ(conv5->algorithm(), ConvolutionLayerProto::IM2COL_GEMM);
+}
+
+TYPED_TEST(ConvolutionLayerTest, packed_param) {
+  LayerProto proto;
+  proto.set_phase(TEST);
+  proto.set_type(CONVOLUTION);
+  proto.mutable_conv_proto()->set_num_output(6);
+  proto.mutable_conv_proto()->set_kernel_size(3);
+  proto.mutable_conv_proto()->set_group(2);
+  proto.mutable_conv_proto()->set_algorithm(ConvolutionLayerProto::DIRECT);
+
+  auto layer = Layer<TypeParam>::create(proto);
+  auto* conv = dynamic_cast<ConvolutionLayer<TypeParam>*>(layer.get());
+  ASSERT_NE(conv, nullptr);
+
+  // no parameters before reshape()
+  EXPECT_TRUE(layer->packed_param().empty());
+
+  Array<TypeParam> bottom;
+  Array<TypeParam> top;
+  bottom.init(2, 4, 5, 6);
+  uniform<TypeParam>(&bottom, -10, 10);
+  layer->reshape({&bottom}, {}, {&top}, {});
+  uniform<TypeParam>(layer->mutable_param()[0], -3, 3);
+  uniform<TypeParam>(layer->mutable_param()[1], -3, 3);
+
+  // every group is a 3 x 18 matrix, padded to 4 rows
+  auto packed = layer->packed_param();
+  ASSERT_EQ(packed.size(), 1);
+  EXPECT_EQ(packed[0]->total_, 2 * gemm_packed_size(3, 18));
+  EXPECT_EQ(packed[0]->total_, 2 * 4 * 18);
+  const auto& weight = *layer->param()[0];
+  EXPECT_EQ((*packed[0])[0], weight(0, 0, 0, 0));
+  EXPECT_EQ((*packed[0])[1], weight(1, 0, 0, 0));
+  EXPECT_EQ((*packed[0])[4], weight(0, 0, 0, 1));
+  EXPECT_EQ((*packed[0])[3], 0);
+  EXPECT_EQ((*packed[0])[4 * 18], weight(3, 0, 0, 0));
+
+  // it is packed once per parameter change
+  EXPECT_EQ(layer->packed_param()[0], packed[0]);
+  layer->mutable_param()[0]->d_[0] = 100;
+  packed = layer->packed_param();
+  EXPECT_EQ((*packed[0])[0], 100);
+
+  Array<TypeParam> expected;
+  layer->reshape({&bottom}, {}, {&expected}, {});
+  layer->fprop({&bottom}, {&expected});
+
+  // a trained layer with its packed parameters is not packed again,
+  // so zero packed weights leave only the bias
+  LayerProto trained = layer->proto();
+  trained.clear_param();
+  for (const auto* p : layer->param()) {
+    p->to_proto(trained.add_param());
+  }
+  Array<TypeParam> zeros;
+  zeros.init_like(*packed[0]);
+  set_to<TypeParam>(&zeros, 0);
+  zeros.to_proto(trained.add_packed_param());
+
+  // with a BLAS backend, IM2COL_GEMM reads the weight as it is
+  std::vector<ConvolutionLayerProto::Algorithm> algorithms = {
+      ConvolutionLayerProto::DIRECT};
+  if (!Blas<TypeParam>::kEnabled) {
+    algorithms.push_back(ConvolutionLayerProto::IM2COL_GEMM);
+  }
+  for (auto algorithm : algorithms) {
+    layer->copy_trained_layer(trained);
+    conv->set_algorithm(algorithm);
+    layer->reshape({&bottom}, {}, {&top}, {});
+    layer->fprop({&bottom}, {&top});
+    for (int n = 0; n < top.n_; n++)
+      for (int c = 0; c < top.c_; c++)
+        for (int i = 0; i < top.h_ * top.w_; i++) {
+          EXPECT_EQ((&top(n, c, 0, 0))[i], layer->param()[1]->d_[c]);
+        }
+  }
+
+  // without them, the weight is packed after copy_trained_layer()
+  trained.clear_packed_param();
+  layer->copy_trained_layer(trained);
+  EXPECT_EQ((*layer->packed_param()[0])[0], 100);
+  layer->fprop({&bottom}, {&top});
+  for (int i = 0; i < top.total_; i++) {
+    EXPECT_EQ(top[i], expected[i]);
+  }
+
+  // and released if fprop() does not read it
+  conv->set_algorithm(ConvolutionLayerProto::IM2COL_GEMM);
+  bool has_blas = Blas<TypeParam>::kEnabled;
+  EXPECT_EQ(layer->packed_param().empty(), has_blas);
+  layer->reshape({&bottom}, {}, {&top}, {});
+  layer->fprop({&bottom}, {&top});
+  for (int i = 0; i < top.total_; i++) {
+    EXPECT_EQ(top[i], expected[i]);
+  }
+}
+
 // gradient for the bottom
 TYPED_TEST(ConvolutionLayerTest, bprop_with_jet_input) {
   static constexpr int N = 2;
@@ -446,7 +1066,12 @@ TYPED_TEST(ConvolutionLayerTest, bprop_with_jet_input) {
 
     for (int i = 0; i < DIM; i++) {
       TypeParam expected = s.v_[i];
-      EXPECT_NEAR(bottom_gradient[n * DIM + i], expected, 1e-5);
+      // the gemm based bprop sums in a different order from fprop;
+      // the rounding error is relative to the sum of the absolute
+      // values of the terms, which is in the order of 1e4 here
+      double tol =
+          std::max(1e-5, 1e4 * std::numeric_limits<TypeParam>::epsilon());
+      EXPECT_NEAR(bottom_gradient[n * DIM + i], expected, tol);
     }
   }
 }
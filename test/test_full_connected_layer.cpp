@@ -177,6 +177,97 @@ TYPED_TEST(FullConnectedLayerTest, fprop) {
   EXPECT_EQ(expected11, this->top_[3]);
 }
 
+TYPED_TEST(FullConnectedLayerTest, gemm) {
+  // more than one cache block of gemm along K
+  static constexpr int N = 17;
+  static constexpr int K = 3 * 10 * 10;
+  static constexpr int M = 13;
+
+  LayerProto proto;
+  proto.set_phase(TRAIN);
+  proto.set_type(FULL_CONNECTED);
+  proto.mutable_fc_proto()->set_num_output(M);
+  auto layer = Layer<TypeParam>::create(proto);
+
+  Array<TypeParam> bottom;
+  Array<TypeParam> bottom_gradient;
+  Array<TypeParam> top;
+  Array<TypeParam> top_gradient;
+  bottom.init(N, 3, 10, 10);
+  uniform<TypeParam>(&bottom, -5, 5);
+
+  layer->reshape({&bottom}, {&bottom_gradient}, {&top}, {&top_gradient});
+  const auto& w = *layer->param()[0];
+  const auto& b = *layer->param()[1];
+  uniform<TypeParam>(layer->mutable_param()[0], -5, 5);
+  uniform<TypeParam>(layer->mutable_param()[1], -5, 5);
+
+  layer->fprop({&bottom}, {&top});
+  for (int n = 0; n < N; n++)
+    for (int m = 0; m < M; m++) {
+      TypeParam expected = b[m];
+      for (int k = 0; k < K; k++) {
+        expected += w[m * K + k] * bottom[n * K + k];
+      }
+      EXPECT_EQ(top[n * M + m], expected);
+    }
+
+  // cblas reads the weight as it is
+  bool has_blas = Blas<TypeParam>::kEnabled;
+  EXPECT_EQ(layer->packed_param().empty(), has_blas);
+
+  // the gradients are accumulated
+  uniform<TypeParam>(&top_gradient, -5, 5);
+  set_to<TypeParam>(&bottom_gradient, 1);
+  set_to<TypeParam>(layer->mutable_gradient()[0], 2);
+  set_to<TypeParam>(layer->mutable_gradient()[1], 3);
+  layer->bprop({&bottom}, {&bottom_gradient}, {&top}, {&top_gradient});
+
+  const auto& dw = *layer->gradient()[0];
+  const auto& db = *layer->gradient()[1];
+  for (int m = 0; m < M; m++) {
+    TypeParam expected = 3;
+    for (int n = 0; n < N; n++) {
+      expected += top_gradient[n * M + m];
+    }
+    EXPECT_EQ(db[m], expected);
+
+    for (int k = 0; k < K; k++) {
+      expected = 2;
+      for (int n = 0; n < N; n++) {
+        expected += top_gradient[n * M + m] * bottom[n * K + k];
+      }
+      EXPECT_EQ(dw[m * K + k], expected);
+    }
+  }
+
+  for (int n = 0; n < N; n++)
+    for (int k = 0; k < K; k++) {
+      TypeParam expected = 1;
+      for (int m = 0; m < M; m++) {
+        expected += top_gradient[n * M + m] * w[m * K + k];
+      }
+      EXPECT_EQ(bottom_gradient[n * K + k], expected);
+    }
+
+  if (has_blas) {
+    return;
+  }
+
+  // a packed weight of another layout, e.g., saved by a build with
+  // another gemm blocking, is rejected instead of read out of bounds
+  LayerProto trained = layer->proto();
+  trained.clear_param();
+  for (const auto* p : layer->param()) {
+    p->to_proto(trained.add_param());
+  }
+  Array<TypeParam> packed;
+  packed.init(1, 1, 1, layer->packed_param()[0]->total_ - 1);
+  packed.to_proto(trained.add_packed_param());
+  layer->copy_trained_layer(trained);
+  EXPECT_DEATH(layer->fprop({&bottom}, {&top}), "packed_param does not match");
+}
+
 TYPED_TEST(FullConnectedLayerTest, bprop_with_jet_input) {
   static constexpr int N = 2;
   static constexpr int C = 3;
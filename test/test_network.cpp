@@ -15,17 +15,37 @@
 #include <glog/logging.h>
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <sstream>
+#include <string>
 
 #define private public
 
 #include "cnn/array_math.hpp"
 #include "cnn/io.hpp"
 #include "cnn/network.hpp"
+#include "cnn/rng.hpp"
 #include "proto/cnn.pb.h"
 
 namespace cnn {
 
+namespace {
+
+// random inputs with labels that are valid for all example models
+template <typename Dtype>
+void random_input(const std::vector<Array<Dtype>*>& top) {
+  gaussian<Dtype>(top[0], 0, 1);
+  if (top.size() == 2) {
+    for (int i = 0; i < top[1]->total_; i++) {
+      (*top[1])[i] = i % 2;
+    }
+  }
+}
+
+}  // namespace
+
 template <typename Dtype>
 class NetworkTest : public ::testing::Test {
  protected:
@@ -220,4 +240,524 @@ TYPED_TEST(NetworkTest, fprop2) {
   }
 }
 
+TYPED_TEST(NetworkTest, compile) {
+  Network<TypeParam> network(this->filename_);
+  network.reshape();
+
+  ASSERT_EQ(network.steps_.size(), network.layers().size());
+  for (int i = 0; i < network.layers().size(); i++) {
+    const auto& s = network.steps_[i];
+    EXPECT_EQ(s.bottom, network.get_data_bottom(i));
+    EXPECT_EQ(s.bottom_gradient, network.get_gradient_bottom_mutable(i));
+    EXPECT_EQ(s.top, network.get_data_top_mutable(i));
+    EXPECT_EQ(s.const_top, network.get_data_top(i));
+    EXPECT_EQ(s.top_gradient, network.get_gradient_top(i));
+  }
+  EXPECT_EQ(network.gradients_.size(), network.gradient_.size());
+}
+
+TYPED_TEST(NetworkTest, autotune) {
+  std::string model = R"(
+    conv_algorithm_cache: "conv_algorithm_cache.prototxt"
+    layer_proto {
+      name: "input"
+      type: INPUT
+      top: "data"
+      input_proto { n: 2 c: 3 h: 6 w: 5 }
+    }
+    layer_proto {
+      name: "conv"
+      type: CONVOLUTION
+      phase: TRAIN
+      bottom: "data"
+      top: "conv"
+      conv_proto { num_output: 4 kernel_size: 3 algorithm: AUTO }
+    }
+  )";
+  NetworkProto proto;
+  string_to_proto(model, &proto);
+  std::remove(proto.conv_algorithm_cache().c_str());
+
+  {
+    Network<TypeParam> network(proto);
+    network.reshape();
+    auto* conv =
+        dynamic_cast<ConvolutionLayer<TypeParam>*>(network.layer(1).get());
+    ASSERT_NE(conv, nullptr);
+    EXPECT_NE(conv->algorithm(), ConvolutionLayerProto::AUTO);
+
+    ConvolutionAlgorithmCache cache;
+    read_proto_txt(proto.conv_algorithm_cache(), &cache);
+    ASSERT_EQ(cache.entry_size(), 1);
+
+    const auto& e = cache.entry(0);
+    EXPECT_EQ(e.n(), 2);
+    EXPECT_EQ(e.c(), 3);
+    EXPECT_EQ(e.h(), 6);
+    EXPECT_EQ(e.w(), 5);
+    EXPECT_EQ(e.num_output(), 4);
+    EXPECT_EQ(e.kernel_size(), 3);
+    EXPECT_EQ(e.stride(), 1);
+    EXPECT_EQ(e.pad_h(), 1);
+    EXPECT_EQ(e.pad_w(), 1);
+    EXPECT_EQ(e.dilation(), 1);
+    EXPECT_EQ(e.num_threads(), 1);
+    EXPECT_EQ(e.phase(), TRAIN);
+    EXPECT_EQ(e.dtype_size(), static_cast<int>(sizeof(TypeParam)));
+    EXPECT_EQ(e.algorithm(), conv->algorithm());
+  }
+
+  {
+    // the cached algorithm is used without timing
+    ConvolutionAlgorithmCache cache;
+    read_proto_txt(proto.conv_algorithm_cache(), &cache);
+    cache.mutable_entry(0)->set_algorithm(ConvolutionLayerProto::DIRECT);
+    write_proto_txt(proto.conv_algorithm_cache(), cache);
+
+    Network<TypeParam> network(proto);
+    network.reshape();
+    auto* conv =
+        dynamic_cast<ConvolutionLayer<TypeParam>*>(network.layer(1).get());
+    EXPECT_EQ(conv->algorithm(), ConvolutionLayerProto::DIRECT);
+  }
+
+  {
+    // a new shape is measured and appended
+    proto.mutable_layer_proto(0)->mutable_input_proto()->set_n(1);
+    Network<TypeParam> network(proto);
+    network.reshape();
+
+    ConvolutionAlgorithmCache cache;
+    read_proto_txt(proto.conv_algorithm_cache(), &cache);
+    ASSERT_EQ(cache.entry_size(), 2);
+    EXPECT_EQ(cache.entry(1).n(), 1);
+  }
+
+  {
+    // an entry measured with another element type is not used
+    ConvolutionAlgorithmCache cache;
+    read_proto_txt(proto.conv_algorithm_cache(), &cache);
+    cache.mutable_entry()->DeleteSubrange(1, 1);
+    cache.mutable_entry(0)->set_dtype_size(sizeof(TypeParam) + 1);
+    write_proto_txt(proto.conv_algorithm_cache(), cache);
+
+    proto.mutable_layer_proto(0)->mutable_input_proto()->set_n(2);
+    Network<TypeParam> network(proto);
+    network.reshape();
+
+    read_proto_txt(proto.conv_algorithm_cache(), &cache);
+    ASSERT_EQ(cache.entry_size(), 2);
+    EXPECT_EQ(cache.entry(1).n(), 2);
+    EXPECT_EQ(cache.entry(1).dtype_size(),
+              static_cast<int>(sizeof(TypeParam)));
+  }
+
+  std::remove(proto.conv_algorithm_cache().c_str());
+}
+
+TYPED_TEST(NetworkTest, plan_memory) {
+  std::string model = R"(
+    layer_proto {
+      name: "input" type: INPUT phase: TEST top: "data"
+      input_proto { n: 2 c: 3 h: 8 w: 8 }
+    }
+    layer_proto {
+      name: "conv1" type: CONVOLUTION phase: TEST
+      bottom: "data" top: "conv1"
+      conv_proto { num_output: 8 kernel_size: 3 }
+    }
+    layer_proto {
+      name: "relu1" type: RELU phase: TEST bottom: "conv1" top: "relu1"
+    }
+    layer_proto {
+      name: "pool1" type: MAX_POOLING phase: TEST
+      bottom: "relu1" top: "pool1"
+      max_pooling_proto { win_size: 2 stride: 2 }
+    }
+    layer_proto {
+      name: "fc1" type: FULL_CONNECTED phase: TEST
+      bottom: "pool1" top: "fc1"
+      fc_proto { num_output: 16 }
+    }
+    layer_proto {
+      name: "relu2" type: RELU phase: TEST bottom: "fc1" top: "relu2"
+    }
+    layer_proto {
+      name: "fc2" type: FULL_CONNECTED phase: TEST
+      bottom: "relu2" top: "fc2"
+      fc_proto { num_output: 10 }
+    }
+    layer_proto {
+      name: "softmax" type: SOFTMAX phase: TEST bottom: "fc2" top: "prob"
+    }
+  )";
+  NetworkProto proto;
+  string_to_proto(model, &proto);
+
+  Network<TypeParam> expected(proto);
+  expected.reshape();
+  EXPECT_EQ(expected.memory_plan().num_buffers, 0);
+
+  proto.set_plan_memory(true);
+  Network<TypeParam> network(proto);
+  network.reshape();
+
+  for (int i = 0; i < network.layers().size(); i++) {
+    auto src = expected.layer(i)->mutable_param();
+    auto dst = network.layer(i)->mutable_param();
+    for (int j = 0; j < src.size(); j++) {
+      gaussian<TypeParam>(src[j], 0, 1);
+      for (int k = 0; k < src[j]->total_; k++) {
+        (*dst[j])[k] = (*src[j])[k];
+      }
+    }
+  }
+
+  auto check = [&]() {
+    auto& x = *expected.get_data_top_mutable(0)[0];
+    auto& y = *network.get_data_top_mutable(0)[0];
+    gaussian<TypeParam>(&x, 0, 1);
+    for (int k = 0; k < x.total_; k++) {
+      y[k] = x[k];
+    }
+
+    expected.fprop();
+    // twice, so that the second run reads memory left by the first
+    network.fprop();
+    network.fprop();
+    EXPECT_EQ(network.get_predications(), expected.get_predications());
+  };
+
+  // conv1, pool1 and relu2 share one buffer,
+  // relu1, fc1 and fc2 share another one
+  const auto& plan = network.memory_plan();
+  EXPECT_EQ(plan.num_shared, 6);
+  EXPECT_EQ(plan.num_buffers, 2);
+  EXPECT_EQ(network.get_data_top(1)[0]->d_, network.get_data_top(3)[0]->d_);
+  EXPECT_EQ(network.get_data_top(2)[0]->d_, network.get_data_top(4)[0]->d_);
+  EXPECT_NE(network.get_data_top(1)[0]->d_, network.get_data_top(2)[0]->d_);
+
+  size_t before = 0;
+  for (const auto& p : network.data_) {
+    before += p.second->padded_total() * sizeof(TypeParam);
+  }
+  EXPECT_EQ(plan.bytes_before, before);
+
+  // data, prob, conv1 and relu1
+  size_t after = 0;
+  for (int i : {0, 1, 2, 7}) {
+    after += network.get_data_top(i)[0]->padded_total() * sizeof(TypeParam);
+  }
+  EXPECT_EQ(plan.bytes_after, after);
+  EXPECT_LT(plan.bytes_after, plan.bytes_before);
+
+  check();
+
+  // reshape() plans again
+  network.reshape();
+  EXPECT_EQ(network.memory_plan().num_buffers, 2);
+  check();
+}
+
+TYPED_TEST(NetworkTest, arena) {
+  std::string model = R"(
+    layer_proto {
+      name: "input" type: INPUT top: "data" top: "label"
+      input_proto { n: 4 c: 2 h: 3 w: 3 }
+    }
+    layer_proto {
+      name: "fc1" type: FULL_CONNECTED bottom: "data" top: "fc1"
+      fc_proto { num_output: 8 }
+    }
+    layer_proto {
+      name: "bn1" type: BATCH_NORMALIZATION bottom: "fc1" top: "bn1"
+    }
+    layer_proto { name: "relu1" type: RELU bottom: "bn1" top: "relu1" }
+    layer_proto {
+      name: "fc2" type: FULL_CONNECTED bottom: "relu1" top: "fc2"
+      fc_proto { num_output: 1 }
+    }
+    layer_proto {
+      name: "loss" type: L2_LOSS bottom: "fc2" bottom: "label" top: "loss"
+    }
+  )";
+  NetworkProto proto;
+  string_to_proto(model, &proto);
+
+  Network<TypeParam> expected(proto);
+  expected.reshape();
+  EXPECT_EQ(expected.arena_bytes(), 0);
+
+  proto.set_use_arena(true);
+  Network<TypeParam> network(proto);
+  network.reshape();
+  ASSERT_GT(network.arena_bytes(), 0);
+
+  // the parameters with gradients come first
+  EXPECT_EQ(network.layer(1)->param()[0]->d_, network.param_begin_);
+  EXPECT_EQ(network.layer(1)->gradient()[0]->d_, network.gradient_begin_);
+
+  const char* begin = network.arena_->data();
+  const char* end = begin + network.arena_bytes();
+  auto in_arena = [&](const Array<TypeParam>* arr) {
+    const char* p = reinterpret_cast<const char*>(arr->d_);
+    return p >= begin && p < end;
+  };
+  for (const auto& _layer : network.layers()) {
+    for (const auto* arr : _layer->param()) EXPECT_TRUE(in_arena(arr));
+    for (const auto* arr : _layer->gradient()) EXPECT_TRUE(in_arena(arr));
+  }
+  for (const auto& p : network.data_) EXPECT_TRUE(in_arena(p.second.get()));
+  for (const auto& p : network.gradient_) {
+    if (p.second->total_) {
+      EXPECT_TRUE(in_arena(p.second.get()));
+    }
+  }
+
+  for (int i = 0; i < network.layers().size(); i++) {
+    auto src = expected.layer(i)->mutable_param();
+    auto dst = network.layer(i)->mutable_param();
+    for (int j = 0; j < src.size(); j++) {
+      for (int k = 0; k < src[j]->total_; k++) {
+        (*dst[j])[k] = (*src[j])[k];
+      }
+    }
+  }
+
+  auto expect_same_param = [&]() {
+    for (int i = 0; i < network.layers().size(); i++) {
+      auto a = expected.layer(i)->param();
+      auto b = network.layer(i)->param();
+      ASSERT_EQ(a.size(), b.size());
+      for (int j = 0; j < a.size(); j++) {
+        for (int k = 0; k < a[j]->total_; k++) {
+          EXPECT_EQ((*a[j])[k], (*b[j])[k]);
+        }
+      }
+    }
+  };
+
+  // the flat update is the same as the one of every layer
+  for (int iter = 0; iter < 5; iter++) {
+    auto x = expected.get_data_top_mutable(0);
+    auto y = network.get_data_top_mutable(0);
+    for (int i = 0; i < 2; i++) {
+      gaussian<TypeParam>(x[i], 0, 1);
+      for (int k = 0; k < x[i]->total_; k++) {
+        (*y[i])[k] = (*x[i])[k];
+      }
+    }
+
+    expected.fprop();
+    expected.bprop();
+    expected.update_parameters(iter, 0.01);
+
+    network.fprop();
+    network.bprop();
+    network.update_parameters(iter, 0.01);
+
+    EXPECT_EQ(network.get_loss(), expected.get_loss());
+  }
+  expect_same_param();
+
+  // reshape() keeps the parameters
+  network.reshape();
+  EXPECT_EQ(network.layer(1)->param()[0]->d_, network.param_begin_);
+  expect_same_param();
+
+  std::string filename = "arena_param.bin";
+  network.save_param(filename);
+  set_to<TypeParam>(network.layer(1)->mutable_param()[0], 0);
+  network.load_param(filename);
+  expect_same_param();
+  std::remove(filename.c_str());
+}
+
+TYPED_TEST(NetworkTest, num_threads) {
+  std::string model = R"(
+    layer_proto {
+      name: "input" type: INPUT top: "data" top: "label"
+      input_proto { n: 16 c: 4 h: 24 w: 24 }
+    }
+    layer_proto {
+      name: "conv1" type: CONVOLUTION bottom: "data" top: "conv1"
+      conv_proto { num_output: 8 kernel_size: 3 }
+    }
+    layer_proto {
+      name: "bn1" type: BATCH_NORMALIZATION bottom: "conv1" top: "bn1"
+      batch_normalization_proto { momentum: 0.9 }
+    }
+    layer_proto { name: "relu1" type: RELU bottom: "bn1" top: "relu1" }
+    layer_proto {
+      name: "conv2" type: CONVOLUTION bottom: "relu1" top: "conv2"
+      conv_proto { num_output: 8 kernel_size: 3 algorithm: DIRECT group: 2 }
+    }
+    layer_proto {
+      name: "leaky1" type: LEAKY_RELU bottom: "conv2" top: "leaky1"
+    }
+    layer_proto {
+      name: "conv3" type: CONVOLUTION bottom: "leaky1" top: "conv3"
+      conv_proto { num_output: 8 kernel_size: 3 group: 8 }
+    }
+    layer_proto {
+      name: "pool1" type: MAX_POOLING bottom: "conv3" top: "pool1"
+      max_pooling_proto { win_size: 2 stride: 2 }
+    }
+    layer_proto {
+      name: "conv4" type: CONVOLUTION bottom: "pool1" top: "conv4"
+      conv_proto { num_output: 16 kernel_size: 1 }
+    }
+    layer_proto {
+      name: "drop1" type: DROP_OUT bottom: "conv4" top: "drop1"
+      dropout_proto { keep_prob: 0.5 }
+    }
+    layer_proto {
+      name: "fc1" type: FULL_CONNECTED bottom: "drop1" top: "fc1"
+      fc_proto { num_output: 32 }
+    }
+    layer_proto {
+      name: "fc2" type: FULL_CONNECTED bottom: "fc1" top: "fc2"
+      fc_proto { num_output: 10 }
+    }
+    layer_proto {
+      name: "loss" type: SOFTMAX_WITH_LOG_LOSS
+      bottom: "fc2" bottom: "label" top: "loss"
+    }
+  )";
+  NetworkProto proto;
+  string_to_proto(model, &proto);
+  for (auto& p : *proto.mutable_layer_proto()) {
+    p.set_phase(TRAIN);
+  }
+
+  // a few iterations with the same seed for the parameters,
+  // the inputs and the dropout masks
+  auto train = [&proto](Network<TypeParam>* network) {
+    set_seed(1234);
+    network->register_data_callback(&random_input<TypeParam>);
+    network->reshape();
+    for (int i = 0; i < 3; i++) {
+      network->fprop();
+      network->bprop();
+      network->update_parameters(i, 1e-3);
+    }
+    network->fprop();
+    network->bprop();
+  };
+
+  Network<TypeParam> expected(proto);
+  EXPECT_EQ(expected.num_threads(), 1);
+  train(&expected);
+
+  proto.set_num_threads(4);
+  Network<TypeParam> network(proto);
+  EXPECT_EQ(network.num_threads(), 4);
+  for (const auto& layer : network.layers()) {
+    EXPECT_EQ(layer->thread_pool(), network.thread_pool_.get());
+  }
+  train(&network);
+
+  // the loops are split so that every element is computed in the
+  // same order, except inside a BLAS backend
+  TypeParam tol = Blas<TypeParam>::kEnabled ? 1e-4 : 0;
+  auto expect_near = [tol](const Array<TypeParam>& a,
+                           const Array<TypeParam>& b,
+                           const std::string& name) {
+    ASSERT_TRUE(a.has_same_shape(b)) << name;
+    for (int i = 0; i < a.total_; i++) {
+      EXPECT_NEAR(a[i], b[i], tol * std::max(TypeParam(1), std::abs(a[i])))
+          << name << ", index " << i;
+    }
+  };
+
+  EXPECT_NEAR(network.get_loss(), expected.get_loss(), tol);
+  for (int i = 0; i < network.layers().size(); i++) {
+    const auto& name = network.layer(i)->proto().name();
+    auto top = network.get_data_top(i);
+    auto expected_top = expected.get_data_top(i);
+    for (int j = 0; j < top.size(); j++) {
+      expect_near(*expected_top[j], *top[j], name + " top");
+    }
+
+    if (i > 0) {
+      auto g = network.get_gradient_bottom(i);
+      auto expected_g = expected.get_gradient_bottom(i);
+      expect_near(*expected_g[0], *g[0], name + " bottom gradient");
+    }
+
+    auto param = network.layer(i)->param();
+    auto expected_param = expected.layer(i)->param();
+    for (int j = 0; j < param.size(); j++) {
+      expect_near(*expected_param[j], *param[j], name + " param");
+    }
+
+    auto gradient = network.layer(i)->gradient();
+    auto expected_gradient = expected.layer(i)->gradient();
+    for (int j = 0; j < gradient.size(); j++) {
+      expect_near(*expected_gradient[j], *gradient[j], name + " gradient");
+    }
+  }
+}
+
+TYPED_TEST(NetworkTest, zero_allocations) {
+  if (!allocation_tracking_enabled()) {
+    LOG(WARNING) << "built without CNN_TRACK_ALLOCATIONS, skip it";
+    return;
+  }
+
+  auto start = thread_allocation_stats();
+  int* volatile p = new int(0);
+  delete p;
+  auto diff = thread_allocation_stats() - start;
+  EXPECT_EQ(diff.num_allocations, 1);
+  EXPECT_EQ(diff.bytes, sizeof(int));
+
+  struct Model {
+    std::string filename;
+    bool is_train;
+  };
+  std::vector<Model> models = {
+      {"../proto/model.prototxt", true},
+      {"../examples/linear_regression/model.prototxt", true},
+      {"../examples/logistic_regression/model.prototxt", true},
+      {"../examples/mnist/model_for_train.prototxt", true},
+      {"../examples/mnist/model_for_deploy.prototxt", false},
+  };
+
+  for (const auto& m : models)
+    for (int num_threads : {1, 4})
+      for (bool use_arena : {false, true}) {
+        NetworkProto proto;
+        read_proto_txt(m.filename, &proto);
+        proto.mutable_layer_proto(0)->mutable_input_proto()->set_n(2);
+        proto.set_use_arena(use_arena);
+        proto.set_num_threads(num_threads);
+        for (auto& p : *proto.mutable_layer_proto()) {
+          p.set_phase(m.is_train ? TRAIN : TEST);
+        }
+
+        Network<TypeParam> network(proto);
+        network.register_data_callback(&random_input<TypeParam>);
+        network.reshape();
+
+        // the first iterations may allocate, e.g., the history of the
+        // parameter update and buffers of the layers and the threads
+        for (int i = 0; i < 3; i++) {
+          network.fprop();
+          if (m.is_train) {
+            network.bprop();
+            network.update_parameters(i, 1e-3);
+          }
+        }
+
+        std::ostringstream os;
+        os << m.filename << ", num_threads: " << num_threads
+           << ", use_arena: " << use_arena;
+        EXPECT_EQ(network.fprop_allocations().num_allocations, 0) << os.str();
+        EXPECT_EQ(network.bprop_allocations().num_allocations, 0) << os.str();
+        EXPECT_EQ(network.update_allocations().num_allocations, 0)
+            << os.str();
+      }
+}
+
 }  // namespace cnn
@@ -214,4 +214,48 @@ TYPED_TEST(SoftmaxLayerTest, bprop_with_jet) {
         }
 }
 
+TYPED_TEST(SoftmaxLayerTest, large_image) {
+  // more pixels than a tile, with a partial tile at the end
+  static constexpr int N = 2;
+  static constexpr int C = 5;
+  static constexpr int H = 17;
+  static constexpr int W = 19;
+
+  this->layer_->proto().set_phase(TRAIN);
+  this->bottom_.init(N, C, H, W);
+  uniform<TypeParam>(&this->bottom_, -20, 20);
+
+  this->layer_->reshape({&this->bottom_}, {&this->bottom_gradient_},
+                        {&this->top_}, {&this->top_gradient_});
+  this->layer_->fprop({&this->bottom_}, {&this->top_});
+
+  uniform<TypeParam>(&this->top_gradient_, -1, 1);
+  set_to(&this->bottom_gradient_, TypeParam(0));
+  this->layer_->bprop({&this->bottom_}, {&this->bottom_gradient_},
+                      {&this->top_}, {&this->top_gradient_});
+
+  const auto& b = this->bottom_;
+  const auto& t = this->top_;
+  const auto& tg = this->top_gradient_;
+  const auto& bg = this->bottom_gradient_;
+  for (int n = 0; n < N; n++)
+    for (int h = 0; h < H; h++)
+      for (int w = 0; w < W; w++) {
+        double den = 0;
+        for (int c = 0; c < C; c++) {
+          den += std::exp(double(b(n, c, h, w)));
+        }
+        for (int c = 0; c < C; c++) {
+          double y = std::exp(double(b(n, c, h, w))) / den;
+          EXPECT_NEAR(t(n, c, h, w), y, 1e-5);
+
+          double g = 0;
+          for (int i = 0; i < C; i++) {
+            g += tg(n, i, h, w) * t(n, i, h, w) * ((i == c) - t(n, c, h, w));
+          }
+          EXPECT_NEAR(bg(n, c, h, w), g, 1e-5);
+        }
+      }
+}
+
 }  // namespace cnn
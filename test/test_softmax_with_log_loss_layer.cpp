@@ -135,6 +135,28 @@ TYPED_TEST(SoftmaxWithLogLossLayerTest, fprop) {
   EXPECT_NEAR(this->top_[0], expected, 1e-5);
 }
 
+TYPED_TEST(SoftmaxWithLogLossLayerTest, fprop_large_inputs) {
+  this->layer_->proto().set_phase(TRAIN);
+
+  this->bottom1_.init(1, 3, 1, 1);
+  this->bottom2_.init(1, 1, 1, 1);
+
+  this->layer_->reshape({&this->bottom1_, &this->bottom2_},
+                        {&this->bottom1_gradient_}, {&this->top_}, {});
+
+  // the probability of the label underflows to 0, but
+  // log-sum-exp still gives the exact loss
+  this->bottom1_[0] = TypeParam(-100);
+  this->bottom1_[1] = TypeParam(100);
+  this->bottom1_[2] = TypeParam(50);
+  this->bottom2_[0] = 0;
+
+  this->layer_->fprop({&this->bottom1_, &this->bottom2_}, {&this->top_});
+
+  TypeParam expected = 200 + std::log(1 + std::exp(TypeParam(-50)));
+  EXPECT_NEAR(this->top_[0], expected, 1e-4);
+}
+
 TYPED_TEST(SoftmaxWithLogLossLayerTest, bprop_with_jet) {
   static constexpr int N = 2;
   static constexpr int C = 3;
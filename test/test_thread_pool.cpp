@@ -0,0 +1,212 @@
+/*  ---------------------------------------------------------------------
+  Copyright 2018-2019 Fangjun Kuang
+  email: csukuangfj at gmail dot com
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+  You should have received a COPYING file of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>
+  -----------------------------------------------------------------  */
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include "cnn/thread_pool.hpp"
+
+namespace cnn {
+
+TEST(ThreadPoolTest, num_threads) {
+  EXPECT_EQ(ThreadPool(1).num_threads(), 1);
+  EXPECT_EQ(ThreadPool(3).num_threads(), 3);
+
+  int expected = std::max(1u, std::thread::hardware_concurrency());
+  EXPECT_EQ(ThreadPool(0).num_threads(), expected);
+}
+
+TEST(ThreadPoolTest, covers_range) {
+  struct Loop {
+    int begin;
+    int end;
+    int grain;
+  };
+  std::vector<Loop> loops = {
+      {0, 0, 1},   {0, 1, 1},  {0, 100, 1}, {0, 100, 7},   {-50, 50, 3},
+      {5, 1000, 64}, {0, 10, 0}, {3, 3, 5},  {0, 4096, 100}, {0, 17, 100},
+  };
+
+  for (int num_threads : {1, 2, 4}) {
+    ThreadPool pool(num_threads);
+    for (const auto& loop : loops) {
+      int n = std::max(0, loop.end - loop.begin);
+      std::vector<std::atomic<int>> hits(n);
+      for (auto& h : hits) {
+        h = 0;
+      }
+      std::atomic<int> max_len(0);
+
+      // run it a few times, since the threads may take the
+      // chunks in a different order every time
+      for (int k = 0; k < 3; k++) {
+        pool.parallel_for(loop.begin, loop.end, loop.grain,
+                          [&](int begin, int end) {
+                            EXPECT_LT(begin, end);
+                            for (int i = begin; i < end; i++) {
+                              hits[i - loop.begin]++;
+                            }
+                            int len = end - begin;
+                            int cur = max_len;
+                            while (len > cur &&
+                                   !max_len.compare_exchange_weak(cur, len)) {
+                            }
+                          });
+      }
+
+      for (int i = 0; i < n; i++) {
+        EXPECT_EQ(hits[i], 3) << "index " << loop.begin + i << " of ["
+                              << loop.begin << ", " << loop.end << ")";
+      }
+
+      if (num_threads > 1 && n > std::max(1, loop.grain)) {
+        EXPECT_LE(max_len, std::max(1, loop.grain));
+      }
+    }
+  }
+}
+
+TEST(ThreadPoolTest, small_loop_runs_inline) {
+  ThreadPool pool(4);
+  int num_calls = 0;
+  std::thread::id id;
+  pool.parallel_for(10, 30, 20, [&](int begin, int end) {
+    num_calls++;
+    id = std::this_thread::get_id();
+    EXPECT_EQ(begin, 10);
+    EXPECT_EQ(end, 30);
+  });
+  EXPECT_EQ(num_calls, 1);
+  EXPECT_EQ(id, std::this_thread::get_id());
+}
+
+TEST(ThreadPoolTest, nested_loop_runs_inline) {
+  ThreadPool pool(4);
+  std::vector<std::atomic<int>> hits(64 * 64);
+  for (auto& h : hits) {
+    h = 0;
+  }
+
+  pool.parallel_for(0, 64, 1, [&](int begin, int end) {
+    auto outer = std::this_thread::get_id();
+    for (int i = begin; i < end; i++) {
+      pool.parallel_for(0, 64, 1, [&](int b, int e) {
+        EXPECT_EQ(b, 0);
+        EXPECT_EQ(e, 64);
+        EXPECT_EQ(std::this_thread::get_id(), outer);
+        for (int j = b; j < e; j++) {
+          hits[i * 64 + j]++;
+        }
+      });
+    }
+  });
+
+  for (const auto& h : hits) {
+    EXPECT_EQ(h, 1);
+  }
+}
+
+TEST(ThreadPoolTest, without_pool) {
+  int num_calls = 0;
+  parallel_for(static_cast<ThreadPool*>(nullptr), 0, 1000, 1,
+               [&](int begin, int end) {
+                 num_calls++;
+                 EXPECT_EQ(begin, 0);
+                 EXPECT_EQ(end, 1000);
+               });
+  EXPECT_EQ(num_calls, 1);
+
+  parallel_for(static_cast<ThreadPool*>(nullptr), 5, 5, 1,
+               [&](int, int) { num_calls++; });
+  EXPECT_EQ(num_calls, 1);
+}
+
+TEST(ThreadPoolTest, pinned) {
+  // every worker is pinned to cpu 0, which exists on every machine
+  ThreadPool pool(3, {0});
+  std::atomic<int> sum(0);
+  pool.parallel_for(0, 1000, 10, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      sum += i;
+    }
+  });
+  EXPECT_EQ(sum, 999 * 1000 / 2);
+}
+
+TEST(ThreadPoolTest, for_each_thread) {
+  for (int num_threads : {1, 2, 4}) {
+    ThreadPool pool(num_threads);
+    std::vector<std::thread::id> ids(num_threads);
+    std::vector<std::atomic<int>> hits(num_threads);
+    for (auto& h : hits) {
+      h = 0;
+    }
+    pool.for_each_thread([&](int i) {
+      hits[i]++;
+      ids[i] = std::this_thread::get_id();
+    });
+
+    EXPECT_EQ(ids[0], std::this_thread::get_id());
+    for (int i = 0; i < num_threads; i++) {
+      EXPECT_EQ(hits[i], 1) << i;
+      for (int j = 0; j < i; j++) {
+        EXPECT_NE(ids[i], ids[j]) << i << ", " << j;
+      }
+    }
+
+    // the pool still runs loops afterwards
+    std::atomic<int> sum(0);
+    pool.parallel_for(0, 100, 1, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        sum += i;
+      }
+    });
+    EXPECT_EQ(sum, 99 * 100 / 2);
+  }
+}
+
+TEST(ThreadPoolTest, worker_allocation_stats) {
+  ThreadPool pool(4);
+  EXPECT_EQ(pool.worker_allocation_stats().num_allocations, 0);
+  if (!allocation_tracking_enabled()) {
+    return;
+  }
+
+  // the allocations of a loop are those of the caller plus
+  // those of the workers, whoever ran the iterations
+  auto caller = thread_allocation_stats();
+  auto workers = pool.worker_allocation_stats();
+  pool.parallel_for(0, 1000, 1, [](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      int* volatile p = new int(i);
+      delete p;
+    }
+  });
+  auto diff = (thread_allocation_stats() - caller) +
+              (pool.worker_allocation_stats() - workers);
+  EXPECT_EQ(diff.num_allocations, 1000);
+  EXPECT_EQ(diff.bytes, 1000 * sizeof(int));
+}
+
+TEST(ThreadPoolTest, parallel_grain) {
+  EXPECT_EQ(parallel_grain(0), kParallelGrain);
+  EXPECT_EQ(parallel_grain(1), kParallelGrain);
+  EXPECT_EQ(parallel_grain(kParallelGrain / 4), 4);
+  EXPECT_EQ(parallel_grain(int64_t(1) << 40), 1);
+}
+
+}  // namespace cnn